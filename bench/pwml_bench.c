@@ -0,0 +1,462 @@
+#include "PWML/file_utils.h"
+#include "PWML/pwml.h"
+#include <glib.h>
+#include <json-c/json_object.h>
+#include <json-c/json_types.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+// Generates a synthetic Wings 2 install plus a mod library in a temp directory,
+// times the public operations on it and prints the results as json.
+
+typedef struct {
+	int mods;
+	int files_per_mod;
+	int vanilla_files;
+	int min_file_size;
+	int max_file_size;
+	int weapons;
+	int weapons_per_mod;
+	int xml_entries;
+	int iterations;
+	int seed;
+	char* output;
+	bool keep;
+} Bench_Config;
+
+typedef struct {
+	guint64 state;
+	guint64 bytes_written;
+	guint64 files_written;
+	char* noise;
+} Bench_Generator;
+
+typedef struct {
+	guint64 read_syscalls;
+	guint64 write_syscalls;
+	guint64 read_bytes;
+	guint64 write_bytes;
+} Bench_IO;
+
+static const char* const FOLDERS[] = { "objects", "levels", "music", "graphics", "sound" };
+
+static guint64 __bench_random(Bench_Generator* generator) {
+	// xorshift64*, so runs with the same seed generate the same tree
+	generator->state ^= generator->state >> 12;
+	generator->state ^= generator->state << 25;
+	generator->state ^= generator->state >> 27;
+	return generator->state * 0x2545F4914F6CDD1DULL;
+}
+
+// Log-uniform between min and max, most files small with a long tail like real game data
+static guint64 __bench_file_size(Bench_Generator* generator, const Bench_Config* config) {
+	double min = MAX(config->min_file_size, 1);
+	double max = MAX(config->max_file_size, min);
+	double t = (double)(__bench_random(generator) >> 11) / (double)(1ULL << 53);
+	return (guint64)(min * pow(max / min, t));
+}
+
+static void __bench_write_file(Bench_Generator* generator, const char* path, const char* contents, gssize length) {
+	GError* error = NULL;
+	if (length < 0)
+		length = strlen(contents);
+	if (!g_file_set_contents(path, contents, length, &error)) {
+		g_printerr("Failed to write %s: %s\n", path, error->message);
+		g_error_free(error);
+		exit(1);
+	}
+	generator->bytes_written += length;
+	generator->files_written++;
+}
+
+static void __bench_write_noise_file(Bench_Generator* generator, const Bench_Config* config, const char* path) {
+	guint64 size = __bench_file_size(generator, config);
+	guint64 offset = __bench_random(generator) % (guint64)(config->max_file_size - size + 1);
+	__bench_write_file(generator, path, generator->noise + offset, size);
+}
+
+static void __bench_write_xml(Bench_Generator* generator, const char* path, const char* root, const char* element, const char* prefix, int entries) {
+	GString* xml = g_string_new(NULL);
+	g_string_append_printf(xml, "<?xml version=\"1.0\"?>\n<%s>\n", root);
+	for (int i = 0; i < entries; i++) {
+		g_string_append_printf(xml, "  <%s name=\"%s_%d\" file=\"%s_%d.dat\"/>\n", element, prefix, i, prefix, i);
+	}
+	g_string_append_printf(xml, "</%s>\n", root);
+	__bench_write_file(generator, path, xml->str, xml->len);
+	g_string_free(xml, true);
+}
+
+// Writes files_count noise files spread over the data folders under root, plus the special files
+static void __bench_fill_data(Bench_Generator* generator, const Bench_Config* config, const char* root, const char* prefix, int files_count) {
+	for (uint i = 0; i < G_N_ELEMENTS(FOLDERS); i++) {
+		const char* folder = g_build_filename(root, FOLDERS[i], NULL);
+		g_mkdir_with_parents(folder, 0755);
+		free((char*)folder);
+	}
+
+	for (int i = 0; i < files_count; i++) {
+		const char* name = g_strdup_printf("%s_%d.dat", prefix, i);
+		const char* path = g_build_filename(root, FOLDERS[i % G_N_ELEMENTS(FOLDERS)], name, NULL);
+		__bench_write_noise_file(generator, config, path);
+		free((char*)path);
+		free((char*)name);
+	}
+
+	const char* graphics_xml = g_build_filename(root, "graphics", "Graphics.xml", NULL);
+	__bench_write_xml(generator, graphics_xml, "graphics", "image", prefix, config->xml_entries);
+	const char* sounds_xml = g_build_filename(root, "sound", "Sounds.xml", NULL);
+	__bench_write_xml(generator, sounds_xml, "sounds", "sound", prefix, config->xml_entries);
+
+	const char* menu_music = g_build_filename(root, "music", "menu_music.txt", NULL);
+	const char* menu_music_contents = g_strdup_printf("%s_menu.ogg", prefix);
+	__bench_write_file(generator, menu_music, menu_music_contents, -1);
+
+	free((char*)graphics_xml);
+	free((char*)sounds_xml);
+	free((char*)menu_music);
+	free((char*)menu_music_contents);
+}
+
+static void __bench_generate_game(Bench_Generator* generator, const Bench_Config* config, const char* game) {
+	__bench_fill_data(generator, config, game, "vanilla", config->vanilla_files);
+
+	const char* bin = g_build_filename(game, "bin", NULL);
+	const char* weapons = g_build_filename(game, "weapons", NULL);
+	g_mkdir_with_parents(bin, 0755);
+	g_mkdir_with_parents(weapons, 0755);
+	free((char*)bin);
+	free((char*)weapons);
+
+	GString* weapons_dat = g_string_new("Weapons:\n");
+	GString* ship = g_string_new("Ship weapons:\n");
+	GString* pilot = g_string_new("Pilot weapons:\n");
+	for (int i = 0; i < config->weapons; i++) {
+		// Every fourth weapon only exists inside the executable
+		if (i % 4 != 0) {
+			const char* weapon_path = g_strdup_printf("%s/weapons/vanilla_weapon_%d", game, i);
+			g_mkdir_with_parents(weapon_path, 0755);
+			const char* sprite_path = g_build_filename(weapon_path, "sprite.dat", NULL);
+			__bench_write_noise_file(generator, config, sprite_path);
+			free((char*)sprite_path);
+			free((char*)weapon_path);
+		}
+
+		g_string_append_printf(weapons_dat, "  vanilla_weapon_%d\n", i);
+		if (i % 2 == 0)
+			g_string_append_printf(ship, "  vanilla_weapon_%d\n", i);
+		if (i % 3 == 0)
+			g_string_append_printf(pilot, "  vanilla_weapon_%d\n", i);
+	}
+	g_string_append(weapons_dat, ship->str);
+	g_string_append(weapons_dat, pilot->str);
+
+	const char* weapons_dat_path = g_build_filename(game, "weapons", "Weapons.dat", NULL);
+	__bench_write_file(generator, weapons_dat_path, weapons_dat->str, weapons_dat->len);
+
+	free((char*)weapons_dat_path);
+	g_string_free(weapons_dat, true);
+	g_string_free(ship, true);
+	g_string_free(pilot, true);
+}
+
+static void __bench_generate_mods(Bench_Generator* generator, const Bench_Config* config, const char* game) {
+	for (int m = 0; m < config->mods; m++) {
+		const char* id = g_strdup_printf("mod_%d", m);
+		const char* mod_path = g_build_filename(game, "mods", id, NULL);
+		const char* data_path = g_build_filename(mod_path, "data", NULL);
+		g_mkdir_with_parents(data_path, 0755);
+
+		const char* metadata_path = g_build_filename(mod_path, "metadata.json", NULL);
+		const char* metadata = g_strdup_printf("{\"name\":\"Synthetic mod %d\",\"short_description\":\"Generated by pwml_bench\"}", m);
+		__bench_write_file(generator, metadata_path, metadata, -1);
+
+		__bench_fill_data(generator, config, data_path, id, config->files_per_mod);
+
+		for (int w = 0; w < config->weapons_per_mod; w++) {
+			const char* weapon_path = g_strdup_printf("%s/weapons/%s_weapon_%d", data_path, id, w);
+			g_mkdir_with_parents(weapon_path, 0755);
+			const char* weapon_json = g_build_filename(weapon_path, "weapon.json", NULL);
+			const char* contents = g_strdup_printf("{\"ship\":%s,\"pilot\":%s}", w % 2 ? "true" : "false", w % 3 ? "false" : "true");
+			__bench_write_file(generator, weapon_json, contents, -1);
+			const char* sprite_path = g_build_filename(weapon_path, "sprite.dat", NULL);
+			__bench_write_noise_file(generator, config, sprite_path);
+
+			free((char*)sprite_path);
+			free((char*)contents);
+			free((char*)weapon_json);
+			free((char*)weapon_path);
+		}
+
+		free((char*)metadata);
+		free((char*)metadata_path);
+		free((char*)data_path);
+		free((char*)mod_path);
+		free((char*)id);
+	}
+}
+
+static Bench_IO __bench_read_io(void) {
+	Bench_IO io = { 0 };
+	char* contents;
+	if (!g_file_get_contents("/proc/self/io", &contents, NULL, NULL))
+		return io;
+
+	char** lines = g_strsplit(contents, "\n", -1);
+	for (char** line = lines; *line; line++) {
+		guint64 value;
+		if (sscanf(*line, "syscr: %" G_GUINT64_FORMAT, &value) == 1)
+			io.read_syscalls = value;
+		else if (sscanf(*line, "syscw: %" G_GUINT64_FORMAT, &value) == 1)
+			io.write_syscalls = value;
+		else if (sscanf(*line, "rchar: %" G_GUINT64_FORMAT, &value) == 1)
+			io.read_bytes = value;
+		else if (sscanf(*line, "wchar: %" G_GUINT64_FORMAT, &value) == 1)
+			io.write_bytes = value;
+	}
+	g_strfreev(lines);
+	g_free(contents);
+	return io;
+}
+
+// getrusage's peak is the whole process's, so every operation would report the biggest one run before it.
+// Writing 5 to clear_refs resets the peak /proc/self/status reports as VmHWM.
+static void __bench_reset_peak_rss(void) {
+	// Written in place, g_file_set_contents would try to rename a temp file over it
+	FILE* clear_refs = fopen("/proc/self/clear_refs", "w");
+	if (!clear_refs)
+		return;
+	fputs("5", clear_refs);
+	fclose(clear_refs);
+}
+
+// 0 if the kernel doesn't report it
+static guint64 __bench_peak_rss_kb(void) {
+	guint64 peak = 0;
+	char* contents;
+	if (!g_file_get_contents("/proc/self/status", &contents, NULL, NULL))
+		return peak;
+
+	char** lines = g_strsplit(contents, "\n", -1);
+	for (char** line = lines; *line; line++) {
+		if (sscanf(*line, "VmHWM: %" G_GUINT64_FORMAT, &peak) == 1)
+			break;
+	}
+	g_strfreev(lines);
+	g_free(contents);
+	return peak;
+}
+
+typedef void (*Bench_Operation)(const char* game, PWML** pwml);
+
+// Needs the capture to copy, see main
+static void __bench_op_clone(const char* game, PWML** pwml) {
+	// Without active_mods.json pwml_new clones vanilla again
+	const char* active_mods = g_build_filename(game, "active_mods.json", NULL);
+	const char* vanilla = g_build_filename(game, "mods", "vanilla", NULL);
+	remove(active_mods);
+	if (g_file_test(vanilla, G_FILE_TEST_IS_DIR))
+		_file_utils_delete_recursive(NULL, vanilla);
+	free((char*)active_mods);
+	free((char*)vanilla);
+
+	if (*pwml)
+		pwml_free(*pwml);
+	*pwml = pwml_new(game);
+}
+
+static void __bench_op_new(const char* game, PWML** pwml) {
+	if (*pwml)
+		pwml_free(*pwml);
+	*pwml = pwml_new(game);
+}
+
+static void __bench_op_load_mods(const char* game, PWML** pwml) {
+	(void)game;
+	pwml_load_mods(*pwml);
+}
+
+static void __bench_op_apply_mods(const char* game, PWML** pwml) {
+	(void)game;
+	GPtrArray* ids = pwml_list_mods(*pwml);
+	for (uint i = 0; i < ids->len; i++) {
+		pwml_set_mod_active(*pwml, g_ptr_array_index(ids, i), true);
+	}
+	g_ptr_array_set_free_func(ids, free);
+	g_ptr_array_free(ids, true);
+
+	pwml_apply_mods(*pwml);
+}
+
+static json_object* __bench_run(const char* name, Bench_Operation operation, const char* game, PWML** pwml, int iterations, guint64 bytes_per_iteration) {
+	gint64 total = 0, min = G_MAXINT64, max = 0;
+	guint64 peak_rss = 0;
+	Bench_IO before = __bench_read_io();
+
+	for (int i = 0; i < iterations; i++) {
+		__bench_reset_peak_rss();
+		gint64 start = g_get_monotonic_time();
+		operation(game, pwml);
+		gint64 elapsed = g_get_monotonic_time() - start;
+		peak_rss = MAX(peak_rss, __bench_peak_rss_kb());
+
+		total += elapsed;
+		min = MIN(min, elapsed);
+		max = MAX(max, elapsed);
+	}
+
+	Bench_IO after = __bench_read_io();
+
+	double seconds = total / (double)G_USEC_PER_SEC;
+	json_object* result = json_object_new_object();
+	json_object_object_add(result, "operation", json_object_new_string(name));
+	json_object_object_add(result, "iterations", json_object_new_int(iterations));
+	json_object_object_add(result, "total_us", json_object_new_int64(total));
+	json_object_object_add(result, "mean_us", json_object_new_int64(total / iterations));
+	json_object_object_add(result, "min_us", json_object_new_int64(min));
+	json_object_object_add(result, "max_us", json_object_new_int64(max));
+	json_object_object_add(result, "bytes_per_iteration", json_object_new_int64(bytes_per_iteration));
+	json_object_object_add(result, "throughput_bytes_per_s", json_object_new_double(seconds > 0 ? bytes_per_iteration * iterations / seconds : 0));
+	json_object_object_add(result, "read_syscalls", json_object_new_int64((after.read_syscalls - before.read_syscalls) / iterations));
+	json_object_object_add(result, "write_syscalls", json_object_new_int64((after.write_syscalls - before.write_syscalls) / iterations));
+	json_object_object_add(result, "read_bytes", json_object_new_int64((after.read_bytes - before.read_bytes) / iterations));
+	json_object_object_add(result, "write_bytes", json_object_new_int64((after.write_bytes - before.write_bytes) / iterations));
+	json_object_object_add(result, "peak_rss_kb", json_object_new_int64(peak_rss));
+
+	g_printerr("%-12s %10.3f ms mean\n", name, total / (double)iterations / 1000.0);
+	return result;
+}
+
+int main(int argc, char** argv) {
+	Bench_Config config = {
+		.mods = 20,
+		.files_per_mod = 200,
+		.vanilla_files = 2000,
+		.min_file_size = 256,
+		.max_file_size = 4 * 1024 * 1024,
+		.weapons = 100,
+		.weapons_per_mod = 5,
+		.xml_entries = 100,
+		.iterations = 5,
+		.seed = 1,
+		.output = NULL,
+		.keep = false,
+	};
+
+	GOptionEntry entries[] = {
+		{ "mods", 0, 0, G_OPTION_ARG_INT, &config.mods, "Number of mods to generate", "N" },
+		{ "files-per-mod", 0, 0, G_OPTION_ARG_INT, &config.files_per_mod, "Data files per mod", "N" },
+		{ "vanilla-files", 0, 0, G_OPTION_ARG_INT, &config.vanilla_files, "Data files in the base game", "N" },
+		{ "min-file-size", 0, 0, G_OPTION_ARG_INT, &config.min_file_size, "Smallest generated file in bytes", "BYTES" },
+		{ "max-file-size", 0, 0, G_OPTION_ARG_INT, &config.max_file_size, "Largest generated file in bytes", "BYTES" },
+		{ "weapons", 0, 0, G_OPTION_ARG_INT, &config.weapons, "Weapons in the base game", "N" },
+		{ "weapons-per-mod", 0, 0, G_OPTION_ARG_INT, &config.weapons_per_mod, "Weapons added by each mod", "N" },
+		{ "xml-entries", 0, 0, G_OPTION_ARG_INT, &config.xml_entries, "Entries in every Graphics.xml and Sounds.xml", "N" },
+		{ "iterations", 'n', 0, G_OPTION_ARG_INT, &config.iterations, "Runs per operation", "N" },
+		{ "seed", 0, 0, G_OPTION_ARG_INT, &config.seed, "Seed for the generated tree", "N" },
+		{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &config.output, "Write the json results here instead of stdout", "PATH" },
+		{ "keep", 0, 0, G_OPTION_ARG_NONE, &config.keep, "Don't delete the generated tree", NULL },
+		{ NULL, 0, 0, 0, NULL, NULL, NULL }
+	};
+
+	GError* error = NULL;
+	GOptionContext* context = g_option_context_new("- benchmark PWML operations on a synthetic install");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (config.iterations < 1 || config.min_file_size < 1 || config.max_file_size < config.min_file_size) {
+		g_printerr("Invalid configuration\n");
+		return 1;
+	}
+
+	char* root = g_dir_make_tmp("pwml-bench-XXXXXX", &error);
+	if (!root) {
+		g_printerr("Failed to make temp directory: %s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	Bench_Generator generator = { .state = (guint64)config.seed * 0x9E3779B97F4A7C15ULL + 1 };
+	generator.noise = malloc(config.max_file_size);
+	for (int i = 0; i < config.max_file_size; i++)
+		generator.noise[i] = __bench_random(&generator) & 0xFF;
+
+	const char* game = g_build_filename(root, "Wings 2", NULL);
+	const char* mods = g_build_filename(game, "mods", NULL);
+	g_mkdir_with_parents(mods, 0755);
+
+	gint64 generate_start = g_get_monotonic_time();
+	__bench_generate_game(&generator, &config, game);
+	guint64 vanilla_bytes = generator.bytes_written;
+	__bench_generate_mods(&generator, &config, game);
+	guint64 mod_bytes = generator.bytes_written - vanilla_bytes;
+	gint64 generate_time = g_get_monotonic_time() - generate_start;
+
+	g_printerr("Generated %" G_GUINT64_FORMAT " files, %" G_GUINT64_FORMAT " bytes in %s\n", generator.files_written, generator.bytes_written, root);
+
+	json_object* root_json = json_object_new_object();
+	json_object* j_config = json_object_new_object();
+	json_object_object_add(j_config, "mods", json_object_new_int(config.mods));
+	json_object_object_add(j_config, "files_per_mod", json_object_new_int(config.files_per_mod));
+	json_object_object_add(j_config, "vanilla_files", json_object_new_int(config.vanilla_files));
+	json_object_object_add(j_config, "min_file_size", json_object_new_int(config.min_file_size));
+	json_object_object_add(j_config, "max_file_size", json_object_new_int(config.max_file_size));
+	json_object_object_add(j_config, "weapons", json_object_new_int(config.weapons));
+	json_object_object_add(j_config, "weapons_per_mod", json_object_new_int(config.weapons_per_mod));
+	json_object_object_add(j_config, "xml_entries", json_object_new_int(config.xml_entries));
+	json_object_object_add(j_config, "iterations", json_object_new_int(config.iterations));
+	json_object_object_add(j_config, "seed", json_object_new_int(config.seed));
+	json_object_object_add(root_json, "config", j_config);
+
+	json_object* j_generated = json_object_new_object();
+	json_object_object_add(j_generated, "files", json_object_new_int64(generator.files_written));
+	json_object_object_add(j_generated, "vanilla_bytes", json_object_new_int64(vanilla_bytes));
+	json_object_object_add(j_generated, "mod_bytes", json_object_new_int64(mod_bytes));
+	json_object_object_add(j_generated, "generate_us", json_object_new_int64(generate_time));
+	json_object_object_add(root_json, "generated", j_generated);
+
+	// Every clone deletes the vanilla mod and captures the game again, a move capture would leave
+	// the game folders empty after the first one
+	g_setenv("PWML_CAPTURE", "copy", true);
+
+	PWML* pwml = NULL;
+	json_object* results = json_object_new_array();
+	json_object_array_add(results, __bench_run("clone", __bench_op_clone, game, &pwml, config.iterations, vanilla_bytes));
+	json_object_array_add(results, __bench_run("new", __bench_op_new, game, &pwml, config.iterations, 0));
+	json_object_array_add(results, __bench_run("load_mods", __bench_op_load_mods, game, &pwml, config.iterations, 0));
+	json_object_array_add(results, __bench_run("apply_mods", __bench_op_apply_mods, game, &pwml, config.iterations, vanilla_bytes + mod_bytes));
+	json_object_object_add(root_json, "results", results);
+
+	if (pwml)
+		pwml_free(pwml);
+
+	const char* json_str = json_object_to_json_string_ext(root_json, JSON_C_TO_STRING_PRETTY);
+	if (config.output) {
+		if (!g_file_set_contents(config.output, json_str, -1, &error)) {
+			g_printerr("Failed to write %s: %s\n", config.output, error->message);
+			g_error_free(error);
+		}
+	} else {
+		printf("%s\n", json_str);
+	}
+	json_object_put(root_json);
+
+	if (!config.keep)
+		_file_utils_delete_recursive(NULL, root);
+
+	free(generator.noise);
+	free((char*)game);
+	free((char*)mods);
+	g_free(root);
+	g_free(config.output);
+
+	return 0;
+}
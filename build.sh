@@ -7,8 +7,29 @@ INCLUDE_DIRECTORY="include"
 LIB_INSTALL_DIRECTORY="/usr/local/lib"
 INCLUDE_INSTALL_DIRECTORY="/usr/local/include"
 NAME="PWML"
-PKG_CONFIG_DEPENDENCIES="glib-2.0 json-c"
-EXTRA_FLAGS="-g $(xml2-config --cflags --libs) -O0 -Wall -Wextra -pedantic -Werror"
+PKG_CONFIG_DEPENDENCIES="glib-2.0 gio-unix-2.0 json-c"
+# PWML_BUILD_TYPE=release builds an optimised library, anything else a debug one
+if [ "$PWML_BUILD_TYPE" = "release" ]
+then
+    OPTIMIZATION_FLAGS="-O2 -DNDEBUG"
+else
+    OPTIMIZATION_FLAGS="-O0"
+fi
+EXTRA_FLAGS="-g $(xml2-config --cflags --libs) $OPTIMIZATION_FLAGS -Wall -Wextra -pedantic -Werror"
+
+# Optional, the copy and delete paths fall back to plain syscalls without it
+if pkg-config --exists liburing
+then
+    PKG_CONFIG_DEPENDENCIES="$PKG_CONFIG_DEPENDENCIES liburing"
+    EXTRA_FLAGS="$EXTRA_FLAGS -DPWML_HAVE_LIBURING"
+fi
+
+# Optional, pwml_verify_install hashes with MD5 without it, which is CPU bound on fast disks
+if pkg-config --exists libxxhash
+then
+    PKG_CONFIG_DEPENDENCIES="$PKG_CONFIG_DEPENDENCIES libxxhash"
+    EXTRA_FLAGS="$EXTRA_FLAGS -DPWML_HAVE_XXHASH"
+fi
 
 RETURN_WORKING_DIRECTORY=$(pwd)
 cd /home/poupeuu/Coding/C/PWML/PWMLCore
@@ -28,6 +49,21 @@ done
 echo Creating static library
 ar rcs "build/lib$NAME.a" build/*.o
 
+# ./build.sh bench also builds the benchmark, see build/pwml_bench --help
+# ./build.sh daemon also builds the daemon, see build/pwml_daemon --help
+for target in "$@"
+do
+    if [ "$target" = "bench" ]
+    then
+        echo Building benchmark
+        gcc -I"$INCLUDE_DIRECTORY" bench/pwml_bench.c "build/lib$NAME.a" -o build/pwml_bench $(pkg-config --cflags --libs $PKG_CONFIG_DEPENDENCIES gio-2.0) $EXTRA_FLAGS -lm
+    elif [ "$target" = "daemon" ]
+    then
+        echo Building daemon
+        gcc -I"$INCLUDE_DIRECTORY" daemon/pwml_daemon.c "build/lib$NAME.a" -o build/pwml_daemon $(pkg-config --cflags --libs $PKG_CONFIG_DEPENDENCIES) $EXTRA_FLAGS
+    fi
+done
+
 if [ -w "$LIB_INSTALL_DIRECTORY" ] && [ -w "$INCLUDE_INSTALL_DIRECTORY" ]; then
     echo Installing
     cp "build/lib$NAME.a" "$LIB_INSTALL_DIRECTORY/"
@@ -0,0 +1,374 @@
+#include "PWML/client.h"
+#include "PWML/import.h"
+#include "PWML/pwml.h"
+#include "PWML/search.h"
+#include "PWML/vanilla.h"
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include <glib/gstdio.h>
+#include <json-c/json_object.h>
+#include <json-c/json_types.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Keeps one PWML handle loaded for a game folder and serves the protocol described in client.h
+// on a unix socket, so frontends don't pay for pwml_new on every start.
+
+// Connections served at the same time, the handle takes care of the locking between them
+#define MAX_CONNECTIONS 16
+#define MAX_SEARCH_RESULTS 256
+
+typedef struct {
+	PWML* pwml;
+	gint64 started;
+	gint applying;
+	// Guards applies and last_apply_us
+	GMutex mutex;
+	guint64 applies;
+	gint64 last_apply_us;
+} Daemon_State;
+
+static void __daemon_reply(GString* reply, const char* line) {
+	char* escaped = g_strescape(line, NULL);
+	g_string_append(reply, escaped);
+	g_string_append_c(reply, '\n');
+	g_free(escaped);
+}
+
+// Lines are collected first so the count can go in front of them
+static void __daemon_reply_ok(GString* response, GString* lines, uint count) {
+	g_string_append_printf(response, "OK %u\n", count);
+	g_string_append_len(response, lines->str, lines->len);
+}
+
+static void __daemon_reply_error(GString* response, const char* message) {
+	char* escaped = g_strescape(message, NULL);
+	g_string_append_printf(response, "ERR %s\n", escaped);
+	g_free(escaped);
+}
+
+static char* __daemon_get_status(Daemon_State* state) {
+	GPtrArray* mods = pwml_list_mods(state->pwml);
+	uint active = 0;
+	for (uint i = 0; i < mods->len; i++) {
+		if (pwml_is_mod_active(state->pwml, g_ptr_array_index(mods, i)))
+			active++;
+	}
+
+	json_object* root = json_object_new_object();
+	json_object_object_add(root, "working_directory", json_object_new_string(state->pwml->working_directory));
+	json_object_object_add(root, "mods", json_object_new_int(mods->len));
+	json_object_object_add(root, "active_mods", json_object_new_int(active));
+	json_object_object_add(root, "applying", json_object_new_boolean(g_atomic_int_get(&state->applying)));
+	g_mutex_lock(&state->mutex);
+	json_object_object_add(root, "applies", json_object_new_int64(state->applies));
+	json_object_object_add(root, "last_apply_us", json_object_new_int64(state->last_apply_us));
+	g_mutex_unlock(&state->mutex);
+	json_object_object_add(root, "uptime_us", json_object_new_int64(g_get_monotonic_time() - state->started));
+
+	PWML_CatalogMemory memory;
+	pwml_get_catalog_memory(state->pwml, &memory);
+	json_object_object_add(root, "catalog_bytes", json_object_new_int64(memory.mod_bytes + memory.string_bytes + memory.description_bytes));
+	json_object_object_add(root, "description_bytes", json_object_new_int64(memory.description_bytes));
+
+	char* status = g_strdup(json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN));
+	json_object_put(root);
+	g_ptr_array_set_free_func(mods, free);
+	g_ptr_array_free(mods, true);
+	return status;
+}
+
+static char* __daemon_get_verify_result(const PWML_VerifyResult* result) {
+	json_object* root = json_object_new_object();
+	json_object_object_add(root, "checked", json_object_new_int64(result->checked));
+	json_object_object_add(root, "missing", json_object_new_int64(result->missing));
+	json_object_object_add(root, "mismatched", json_object_new_int64(result->mismatched));
+	json_object_object_add(root, "repaired", json_object_new_int64(result->repaired));
+	json_object_object_add(root, "errors", json_object_new_int64(result->errors));
+
+	char* json = g_strdup(json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN));
+	json_object_put(root);
+	return json;
+}
+
+static char* __daemon_get_refresh_result(const PWML_RefreshResult* result) {
+	json_object* root = json_object_new_object();
+	json_object_object_add(root, "captured", json_object_new_int64(result->captured));
+	json_object_object_add(root, "removed", json_object_new_int64(result->removed));
+	json_object_object_add(root, "weapons_refreshed", json_object_new_boolean(result->weapons_refreshed));
+
+	char* json = g_strdup(json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN));
+	json_object_put(root);
+	return json;
+}
+
+static char* __daemon_get_import_result(const PWML_ImportResult* result) {
+	json_object* root = json_object_new_object();
+	json_object_object_add(root, "files", json_object_new_int64(result->files));
+	json_object_object_add(root, "bytes", json_object_new_int64(result->bytes));
+	json_object_object_add(root, "invalid", json_object_new_int64(result->invalid));
+
+	char* json = g_strdup(json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN));
+	json_object_put(root);
+	return json;
+}
+
+static void __daemon_handle_request(Daemon_State* state, const char* command, const char* argument, GString* response) {
+	GString* lines = g_string_new(NULL);
+	PWML* pwml = state->pwml;
+
+	if (g_str_equal(command, "LIST")) {
+		GPtrArray* mods = pwml_list_mods(pwml);
+		for (uint i = 0; i < mods->len; i++) {
+			__daemon_reply(lines, g_ptr_array_index(mods, i));
+		}
+		__daemon_reply_ok(response, lines, mods->len);
+		g_ptr_array_set_free_func(mods, free);
+		g_ptr_array_free(mods, true);
+	} else if (g_str_equal(command, "SEARCH") && argument) {
+		// Every match is sent, a full array may have cut some off so ask again with room for more
+		uint max_results = MAX_SEARCH_RESULTS;
+		char** results = malloc(max_results * sizeof(char*));
+		uint count = pwml_search_mods(pwml, argument, results, max_results);
+		while (count == max_results) {
+			for (uint i = 0; i < count; i++)
+				free(results[i]);
+			max_results *= 2;
+			results = realloc(results, max_results * sizeof(char*));
+			count = pwml_search_mods(pwml, argument, results, max_results);
+		}
+		for (uint i = 0; i < count; i++) {
+			__daemon_reply(lines, results[i]);
+			free(results[i]);
+		}
+		free(results);
+		__daemon_reply_ok(response, lines, count);
+	} else if (g_str_equal(command, "NAME") && argument) {
+		char* name = pwml_get_mod_name(pwml, argument);
+		if (name) {
+			__daemon_reply(lines, name);
+			__daemon_reply_ok(response, lines, 1);
+			free(name);
+		} else {
+			__daemon_reply_error(response, "No such mod");
+		}
+	} else if (g_str_equal(command, "ACTIVE") && argument) {
+		__daemon_reply(lines, pwml_is_mod_active(pwml, argument) ? "1" : "0");
+		__daemon_reply_ok(response, lines, 1);
+	} else if ((g_str_equal(command, "ACTIVATE") || g_str_equal(command, "DEACTIVATE")) && argument) {
+		char* name = pwml_get_mod_name(pwml, argument);
+		if (name) {
+			free(name);
+			pwml_set_mod_active(pwml, argument, g_str_equal(command, "ACTIVATE"));
+			__daemon_reply_ok(response, lines, 0);
+		} else {
+			__daemon_reply_error(response, "No such mod");
+		}
+	} else if (g_str_equal(command, "APPLY")) {
+		g_atomic_int_inc(&state->applying);
+		gint64 start = g_get_monotonic_time();
+		bool applied = pwml_apply_mods(pwml);
+		g_mutex_lock(&state->mutex);
+		state->last_apply_us = g_get_monotonic_time() - start;
+		state->applies++;
+		g_mutex_unlock(&state->mutex);
+		g_atomic_int_add(&state->applying, -1);
+		if (applied)
+			__daemon_reply_ok(response, lines, 0);
+		else
+			__daemon_reply_error(response, "Not enough free space");
+	} else if (g_str_equal(command, "VERIFY") || g_str_equal(command, "REPAIR")) {
+		PWML_VerifyResult result;
+		if (pwml_verify_install(pwml, g_str_equal(command, "REPAIR"), &result)) {
+			char* json = __daemon_get_verify_result(&result);
+			__daemon_reply(lines, json);
+			__daemon_reply_ok(response, lines, 1);
+			g_free(json);
+		} else {
+			__daemon_reply_error(response, "No apply has been recorded");
+		}
+	} else if (g_str_equal(command, "REFRESH")) {
+		PWML_RefreshResult result;
+		if (pwml_refresh_vanilla(pwml, &result)) {
+			char* json = __daemon_get_refresh_result(&result);
+			__daemon_reply(lines, json);
+			__daemon_reply_ok(response, lines, 1);
+			g_free(json);
+		} else {
+			__daemon_reply_error(response, "No vanilla mod to refresh");
+		}
+	} else if (g_str_equal(command, "IMPORT") && argument) {
+		// Copies, the frontend's folder is left alone
+		PWML_ImportResult result;
+		if (pwml_import_mod(pwml, argument, NULL, PWML_CAPTURE_COPY, &result)) {
+			char* json = __daemon_get_import_result(&result);
+			__daemon_reply(lines, json);
+			__daemon_reply_ok(response, lines, 1);
+			g_free(json);
+		} else {
+			__daemon_reply_error(response, "Couldn't import mod");
+		}
+	} else if (g_str_equal(command, "PROFILE")) {
+		if (!argument) {
+			char* current = pwml_get_current_profile(pwml);
+			__daemon_reply(lines, current);
+			__daemon_reply_ok(response, lines, 1);
+			free(current);
+		} else if (pwml_switch_profile(pwml, argument)) {
+			__daemon_reply_ok(response, lines, 0);
+		} else {
+			__daemon_reply_error(response, "Couldn't switch profile");
+		}
+	} else if (g_str_equal(command, "RELOAD")) {
+		pwml_load_mods(pwml);
+		__daemon_reply_ok(response, lines, 0);
+	} else if (g_str_equal(command, "STATUS")) {
+		char* status = __daemon_get_status(state);
+		__daemon_reply(lines, status);
+		__daemon_reply_ok(response, lines, 1);
+		g_free(status);
+	} else {
+		__daemon_reply_error(response, "Unknown command");
+	}
+
+	g_string_free(lines, true);
+}
+
+// Runs on one of the service's threads for as long as the client stays connected
+static gboolean __daemon_handle_connection(GThreadedSocketService* service, GSocketConnection* connection, GObject* source, gpointer data) {
+	(void)service;
+	(void)source;
+	Daemon_State* state = (Daemon_State*)data;
+
+	GDataInputStream* input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+	GOutputStream* output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+	GString* response = g_string_new(NULL);
+
+	char* line;
+	while ((line = g_data_input_stream_read_line(input, NULL, NULL, NULL))) {
+		char* space = strchr(line, ' ');
+		char* argument = NULL;
+		if (space) {
+			*space = '\0';
+			argument = g_strcompress(space + 1);
+		}
+
+		g_string_truncate(response, 0);
+		__daemon_handle_request(state, line, argument, response);
+		g_free(argument);
+		g_free(line);
+
+		if (!g_output_stream_write_all(output, response->str, response->len, NULL, NULL, NULL))
+			break;
+	}
+
+	g_string_free(response, true);
+	g_object_unref(input);
+	return false;
+}
+
+// Whether another daemon answers on the socket, its file must then be left alone
+static bool __daemon_is_running(const char* socket_path) {
+	GSocketClient* socket_client = g_socket_client_new();
+	GSocketAddress* address = g_unix_socket_address_new(socket_path);
+	GSocketConnection* connection = g_socket_client_connect(socket_client, G_SOCKET_CONNECTABLE(address), NULL, NULL);
+	g_object_unref(address);
+	g_object_unref(socket_client);
+	if (!connection)
+		return false;
+	g_object_unref(connection);
+	return true;
+}
+
+static gboolean __daemon_quit(gpointer loop) {
+	g_main_loop_quit((GMainLoop*)loop);
+	return G_SOURCE_REMOVE;
+}
+
+int main(int argc, char** argv) {
+	char* working_directory = NULL;
+	char* socket_path = NULL;
+	gint64 description_budget = 0;
+
+	GOptionEntry entries[] = {
+		{ "directory", 'd', 0, G_OPTION_ARG_FILENAME, &working_directory, "The Wings 2 folder to manage", "PATH" },
+		{ "socket", 's', 0, G_OPTION_ARG_FILENAME, &socket_path, "Listen here instead of the default socket for the folder", "PATH" },
+		{ "description-budget", 'b', 0, G_OPTION_ARG_INT64, &description_budget, "Keep at most this many bytes of mod descriptions loaded", "BYTES" },
+		{ NULL, 0, 0, 0, NULL, NULL, NULL }
+	};
+
+	GError* error = NULL;
+	GOptionContext* context = g_option_context_new("- keep a PWML handle loaded and serve it on a unix socket");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (!working_directory) {
+		g_printerr("--directory is required\n");
+		return 1;
+	}
+	if (!socket_path)
+		socket_path = pwml_client_get_default_socket_path(working_directory);
+	if (__daemon_is_running(socket_path)) {
+		g_printerr("A daemon is already serving %s\n", socket_path);
+		g_free(socket_path);
+		g_free(working_directory);
+		return 1;
+	}
+
+	Daemon_State state = { 0 };
+	g_mutex_init(&state.mutex);
+	state.started = g_get_monotonic_time();
+	state.pwml = pwml_new(working_directory);
+	if (!state.pwml) {
+		g_printerr("Failed to open %s\n", working_directory);
+		return 1;
+	}
+	if (description_budget > 0)
+		pwml_set_description_budget(state.pwml, description_budget);
+
+	char* socket_folder = g_path_get_dirname(socket_path);
+	g_mkdir_with_parents(socket_folder, 0700);
+	g_free(socket_folder);
+	// Nothing answered on it above, so it was left behind by a daemon that didn't exit cleanly
+	g_unlink(socket_path);
+
+	GSocketService* service = g_threaded_socket_service_new(MAX_CONNECTIONS);
+	GSocketAddress* address = g_unix_socket_address_new(socket_path);
+	if (!g_socket_listener_add_address(G_SOCKET_LISTENER(service), address, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &error)) {
+		g_printerr("Failed to listen on %s\nGError: %s\n", socket_path, error->message);
+		g_error_free(error);
+		g_object_unref(address);
+		pwml_free(state.pwml);
+		return 1;
+	}
+	g_object_unref(address);
+
+	g_signal_connect(service, "run", G_CALLBACK(__daemon_handle_connection), &state);
+	g_socket_service_start(service);
+	g_print("Serving %s on %s\n", working_directory, socket_path);
+
+	GMainLoop* loop = g_main_loop_new(NULL, false);
+	g_unix_signal_add(SIGINT, __daemon_quit, loop);
+	g_unix_signal_add(SIGTERM, __daemon_quit, loop);
+	g_main_loop_run(loop);
+
+	g_socket_service_stop(service);
+	g_socket_listener_close(G_SOCKET_LISTENER(service));
+	g_object_unref(service);
+	g_main_loop_unref(loop);
+	g_unlink(socket_path);
+
+	pwml_free(state.pwml);
+	g_free(socket_path);
+	g_free(working_directory);
+	return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <glib.h>
+
+// A blocking queue between two threads that holds at most capacity items.
+// NULL is a valid item, the pipelines use it to mark the end of the stream.
+typedef struct {
+	GMutex mutex;
+	GCond not_empty;
+	GCond not_full;
+	GQueue items;
+	guint capacity;
+} _PWML_BoundedQueue;
+
+_PWML_BoundedQueue* _pwml_bounded_queue_new(guint capacity);
+void _pwml_bounded_queue_free(_PWML_BoundedQueue* queue);
+void _pwml_bounded_queue_push(_PWML_BoundedQueue* queue, gpointer item);
+gpointer _pwml_bounded_queue_pop(_PWML_BoundedQueue* queue);
+
+#endif
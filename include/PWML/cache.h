@@ -0,0 +1,27 @@
+#ifndef PWML_CACHE_H
+#define PWML_CACHE_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+typedef struct PWML PWML;
+
+extern const char* const PWML_CACHE_FOLDER;
+extern const char* const PWML_GENERATED_CACHE_JSON;
+// Parsed merge inputs, see _XML_Utils_Merger
+extern const char* const PWML_XML_FRAGMENT_CACHE_FOLDER;
+
+// Fingerprints of generated files' inputs. Input files are described by path, size and mtime,
+// mode is anything else that changes the output, like how files are merged.
+char* _pwml_cache_fingerprint_files(GPtrArray* paths, const char* mode);
+char* _pwml_cache_fingerprint_data(const char* data, gsize length);
+
+// True if key was last generated from the same fingerprint and destination_path hasn't changed since
+bool _pwml_cache_is_fresh(PWML* pwml, const char* key, const char* fingerprint, const char* destination_path);
+// Records the fingerprint along with destination_path as it is now, call after writing it
+void _pwml_cache_store(PWML* pwml, const char* key, const char* fingerprint, const char* destination_path);
+void _pwml_cache_forget(PWML* pwml, const char* key);
+void _pwml_cache_save(PWML* pwml);
+void _pwml_cache_free(PWML* pwml);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef PWML_CATALOG_H
+#define PWML_CATALOG_H
+
+#include "PWML/mod.h"
+#include <glib.h>
+
+typedef struct PWML PWML;
+
+typedef struct {
+	guint64 mods;
+	// The mods themselves and the catalog's table, estimated
+	guint64 mod_bytes;
+	// The mods folder, ids, names and short descriptions, each distinct one counted once
+	guint64 string_bytes;
+	guint64 description_bytes;
+	// 0 for no limit
+	guint64 description_budget;
+} PWML_CatalogMemory;
+
+// Caps the memory the loaded descriptions take, 0 for no limit, which is the default. Past the budget the
+// least recently used ones are freed and read again when asked for. Loaded descriptions are only searched
+// while there is no budget, the search index would otherwise keep a copy of every one of them.
+void pwml_set_description_budget(PWML* pwml, guint64 bytes);
+void pwml_get_catalog_memory(PWML* pwml, PWML_CatalogMemory* memory);
+
+// The rest expect the PWML's description_mutex to be held
+// Call with a description that was just loaded, evicts others until the budget is met again
+void _pwml_catalog_add_description(PWML* pwml, PWML_Mod* mod);
+// Call when a loaded description is used
+void _pwml_catalog_touch_description(PWML* pwml, PWML_Mod* mod);
+// Call when the catalog is replaced, the old mods free their descriptions themselves
+void _pwml_catalog_forget_descriptions(PWML* pwml);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef PWML_CLIENT_H
+#define PWML_CLIENT_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+// Talks to pwml_daemon, which keeps one PWML handle loaded for a game folder.
+//
+// The protocol is one request line, "COMMAND[ argument]\n", answered by either "OK count\n" followed
+// by count lines, or "ERR message\n". Arguments and result lines are escaped with g_strescape.
+// Commands: LIST, NAME id, ACTIVE id, ACTIVATE id, DEACTIVATE id, SEARCH query, APPLY, VERIFY, REPAIR,
+// REFRESH, IMPORT path, PROFILE[ name], RELOAD, STATUS. SEARCH answers with every match, best first.
+
+typedef struct PWML_Client PWML_Client;
+
+// $XDG_RUNTIME_DIR/pwml/<hash of the game folder>.sock, the daemon listens there unless told otherwise
+char* pwml_client_get_default_socket_path(const char* working_directory);
+
+PWML_Client* pwml_client_connect(const char* socket_path);
+void pwml_client_free(PWML_Client* client);
+
+// Same ownership as pwml_list_mods, NULL if the request failed
+GPtrArray* pwml_client_list_mods(PWML_Client* client);
+GPtrArray* pwml_client_search_mods(PWML_Client* client, const char* query);
+// Has to be freed, NULL if there's no such mod
+char* pwml_client_get_mod_name(PWML_Client* client, const char* id);
+bool pwml_client_is_mod_active(PWML_Client* client, const char* id);
+bool pwml_client_set_mod_active(PWML_Client* client, const char* id, bool active);
+// Returns once the daemon has finished applying
+bool pwml_client_apply_mods(PWML_Client* client);
+// pwml_verify_install in the daemon, the result as a json object. Has to be freed, NULL if nothing was ever applied.
+char* pwml_client_verify_install(PWML_Client* client, bool repair);
+// pwml_refresh_vanilla in the daemon, the result as a json object. Has to be freed, NULL if it failed.
+char* pwml_client_refresh_vanilla(PWML_Client* client);
+// pwml_import_mod of the folder at path in the daemon, which copies it. The result as a json object,
+// has to be freed, NULL if the mod was rejected.
+char* pwml_client_import_mod(PWML_Client* client, const char* path);
+// Has to be freed, NULL if the request failed
+char* pwml_client_get_current_profile(PWML_Client* client);
+bool pwml_client_switch_profile(PWML_Client* client, const char* name);
+// Rescans mods/ in the daemon
+bool pwml_client_reload_mods(PWML_Client* client);
+// A json object, has to be freed
+char* pwml_client_get_status(PWML_Client* client);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef PWML_DEPLOY_H
+#define PWML_DEPLOY_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+typedef struct PWML PWML;
+
+extern const char* const PWML_DEPLOY_MANIFEST_JSON;
+
+// Which mod file every path pwml_apply_mods deployed came from, kept in the cache folder.
+// Generated files aren't in it, they are checked against the generated cache by the next apply.
+typedef struct _PWML_DeployManifest _PWML_DeployManifest;
+
+typedef struct {
+	guint64 checked;
+	// Deleted since the apply
+	guint64 missing;
+	// No longer the same as the mod file they were copied from
+	guint64 mismatched;
+	// Missing and mismatched files copied again, only by a repair
+	guint64 repaired;
+	// Files whose mod file is gone or that couldn't be read
+	guint64 errors;
+} PWML_VerifyResult;
+
+// Hashes every deployed file on all cores and compares it with the mod file it came from, without
+// hashing the mod files again while they are unchanged. With repair the missing and mismatched files
+// are copied again. Returns false if no apply has been recorded.
+bool pwml_verify_install(PWML* pwml, bool repair, PWML_VerifyResult* result);
+
+// Starts the manifest of an apply, what the last one knew about unchanged mod files is kept
+void _pwml_deploy_begin(PWML* pwml);
+void _pwml_deploy_record(PWML* pwml, const char* destination, const char* source);
+// With source's digest as of size and mtime, so a verify doesn't hash it again while it is unchanged
+void _pwml_deploy_record_hashed(PWML* pwml, const char* destination, const char* source, const char* digest, gint64 size, gint64 mtime);
+// The mod file the last apply deployed to destination, NULL if it deployed nothing there
+const char* _pwml_deploy_get_source(PWML* pwml, const char* destination);
+void _pwml_deploy_save(PWML* pwml);
+void _pwml_deploy_free(PWML* pwml);
+
+#endif
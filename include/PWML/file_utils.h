@@ -4,12 +4,124 @@
 #include <glib.h>
 #include <stdbool.h>
 
-void _file_utils_copy_file_with_path(const char* source, const char* destination);
-void _file_utils_copy_recursive(const char* source_path, const char* destination_path);
-void _file_utils_copy_all(const char* from, const char* to);
-void _file_utils_copy_all_except(const char* from, const char* to, const char* ignore);
-void _file_utils_delete_recursive(const char* path);
-void _file_utils_delete_all(const char* path);
+// Every method but _FILE_UTILS_COPY falls back to a copy if it fails
+typedef enum {
+	_FILE_UTILS_COPY,
+	// Hard link destination to source
+	_FILE_UTILS_LINK,
+	// A new file sharing source's blocks through FICLONE, only on copy on write filesystems like btrfs and xfs
+	_FILE_UTILS_REFLINK,
+	// Rename source to destination, only within one filesystem
+	_FILE_UTILS_MOVE
+} _File_Utils_CopyMethod;
+
+typedef struct {
+	char* source;
+	char* destination;
+	_File_Utils_CopyMethod method;
+	// Of source when it was collected, 0 if it wasn't stat'ed. Only used to order the copies and to
+	// check for free space before them.
+	guint64 device;
+	guint64 inode;
+	guint64 size;
+	// An empty source folder, destination is created instead of anything being copied and method is ignored
+	bool folder;
+} _File_Utils_CopyJob;
+
+typedef struct _File_Utils_Counters {
+	guint64 files;
+	guint64 bytes;
+	guint64 errors;
+} _File_Utils_Counters;
+
+// The order a batch of copies reads its sources in. On rotating disks reading them
+// in the order they sit on the platter instead of directory order saves most of the seeking.
+typedef enum {
+	// Directory order
+	PWML_COPY_ORDER_NONE,
+	PWML_COPY_ORDER_INODE,
+	// FIEMAP offset of each file's first extent, inode order for files without one
+	PWML_COPY_ORDER_PHYSICAL
+} PWML_CopyOrder;
+
+// When written files are forced to disk
+typedef enum {
+	// Left to the kernel's writeback
+	PWML_DURABILITY_NONE,
+	// A single syncfs once a whole apply or clone is done, see _file_utils_sync_filesystem
+	PWML_DURABILITY_BATCHED,
+	// Every copied and generated file is fsynced before it is considered written
+	PWML_DURABILITY_STRICT
+} PWML_Durability;
+
+// Passed to every copy and delete, NULL means default behaviour
+typedef struct {
+	// Only counted when not NULL
+	_File_Utils_Counters* counters;
+	// Anything but NONE also hints the kernel to read the next sources ahead
+	PWML_CopyOrder order;
+	// The jobs are in order already, only the readahead is left to do
+	bool presorted;
+	PWML_Durability durability;
+} _File_Utils_Context;
+
+void _file_utils_count(_File_Utils_Context* context, bool success, guint64 bytes);
+
+// Rules like a .gitignore's for what a copy leaves out, one per line:
+// name      excludes files and directories with that name anywhere
+// a/b       excludes the path relative to the root, as does /name
+// dir/      only matches directories, whose contents aren't looked at at all
+// !rule     copies what an earlier rule excluded
+// Names are fnmatch patterns, * doesn't match across folders in the relative ones. Blank lines and # comments are skipped.
+typedef struct {
+	char* root;
+	size_t root_length;
+	// Compiled rules, the last one that matches a path decides
+	GPtrArray* rules;
+} _File_Utils_Filter;
+
+_File_Utils_Filter* _file_utils_filter_new(const char* root);
+void _file_utils_filter_free(_File_Utils_Filter* filter);
+void _file_utils_filter_add_rule(_File_Utils_Filter* filter, const char* rule);
+// Adds every line of the file at path, true if it doesn't exist
+bool _file_utils_filter_add_file(_File_Utils_Filter* filter, const char* path);
+// A NULL filter excludes nothing
+bool _file_utils_filter_excludes(const _File_Utils_Filter* filter, const char* path, bool is_dir);
+
+void _file_utils_copy_job_free(void* job);
+void _file_utils_add_copy_job(GPtrArray* jobs, const char* source, const char* destination);
+bool _file_utils_copy_job(_File_Utils_Context* context, _File_Utils_CopyJob* job);
+// Copies from source_fd, an open descriptor of the source that is closed afterwards, or opens the source itself if it is -1
+bool _file_utils_copy_job_from(_File_Utils_Context* context, _File_Utils_CopyJob* job, int source_fd);
+// Creates the folder of every destination and the folder jobs' destinations first
+void _file_utils_copy_jobs(_File_Utils_Context* context, GPtrArray* jobs);
+// Only queue the jobs, _file_utils_copy_jobs creates the folders they go in. Empty folders are queued as folder jobs.
+// filter may be NULL.
+void _file_utils_collect_copy_jobs(const char* source_path, const char* destination_path, const _File_Utils_Filter* filter, GPtrArray* jobs);
+// Everything in from, not from itself
+void _file_utils_collect_all(const char* from, const char* to, const _File_Utils_Filter* filter, GPtrArray* jobs);
+
+bool _file_utils_copy_file_with_path(const char* source, const char* destination);
+void _file_utils_copy_recursive(_File_Utils_Context* context, const char* source_path, const char* destination_path);
+void _file_utils_copy_all(_File_Utils_Context* context, const char* from, const char* to);
+void _file_utils_delete_recursive(_File_Utils_Context* context, const char* path);
+void _file_utils_delete_all(_File_Utils_Context* context, const char* path);
+void _file_utils_delete_all_except(_File_Utils_Context* context, const char* path, const char* ignore);
+// Atomically replaces path through a rename, fsyncing it and its folder if the context is strict
+bool _file_utils_set_contents(_File_Utils_Context* context, const char* path, const char* data, gssize length, GError** error);
+// Both return false on failure and leave the existing file alone if the contents are the same
+bool _file_utils_write_if_changed(_File_Utils_Context* context, const char* path, const char* data, gsize length, bool* written);
+bool _file_utils_replace_if_changed(_File_Utils_Context* context, const char* new_path, const char* path, bool* replaced);
+// Apparent size of the regular files under path that deleting them would free: files with other hard
+// links or whose blocks are shared with a reflink don't count. 0 if path doesn't exist.
+guint64 _file_utils_reclaimable_size(const char* path);
+// Bytes an unprivileged user can still write to the filesystem path is on
+bool _file_utils_get_free_space(const char* path, guint64* bytes);
+bool _file_utils_fsync_path(const char* path);
+// syncfs on the filesystem path is on, only does anything if the context's durability is batched
+bool _file_utils_sync_filesystem(_File_Utils_Context* context, const char* path);
+// "none", "batched" or "strict", returns false if name is none of them
+bool _file_utils_parse_durability(const char* name, PWML_Durability* durability);
 bool _file_utils_is_dir(const char* path);
 GPtrArray* _file_utils_list_files_in_directory(const char* path);
 
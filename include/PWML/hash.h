@@ -0,0 +1,13 @@
+#ifndef PWML_HASH_H
+#define PWML_HASH_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+// "xxh3:" and 16 hex digits when built with libxxhash, "md5:" and 32 without.
+// NULL if the file can't be read.
+char* _pwml_hash_file(const char* path);
+// False for digests made by a build with the other algorithm, they have to be made again
+bool _pwml_hash_is_current(const char* digest);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef PWML_IMPORT_H
+#define PWML_IMPORT_H
+
+#include "PWML/resource.h"
+#include <glib.h>
+#include <stdbool.h>
+
+typedef struct PWML PWML;
+
+typedef struct {
+	// Transferred into the mod's folder
+	guint64 files;
+	guint64 bytes;
+	// json and xml files that didn't parse, nothing is transferred if there are any
+	guint64 invalid;
+} PWML_ImportResult;
+
+// Adds the mod folder at source_path to mods/<id>, id being the folder's name if NULL. Every file is
+// hashed and the json and xml are parsed on all cores before anything is transferred, and a mod without
+// valid metadata or weapons is rejected the same way. The digests and weapons are kept in the mod's
+// PWML_MOD_INDEX_JSON, so applies don't read the weapons again and verifies don't hash the files again
+// while they are unchanged. mode says how the files are transferred, PWML_CAPTURE_MOVE empties source_path.
+// A source whose size or mtime changed between the hashing and the transfer fails the import. Staging
+// folders a crashed import left in mods are deleted first. The catalog is reloaded once the mod is in
+// place. Returns false if the mod was rejected, id is taken or is vanilla, or the transfer failed.
+bool pwml_import_mod(PWML* pwml, const char* source_path, const char* id, PWML_CaptureMode mode, PWML_ImportResult* result);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef PWML_INDEX_H
+#define PWML_INDEX_H
+
+#include "PWML/file_utils.h"
+#include <glib.h>
+#include <stdbool.h>
+
+// What pwml_import_mod found out about a mod, kept in the mod's folder
+extern const char* const PWML_MOD_INDEX_JSON;
+
+typedef struct {
+	char* digest;
+	gint64 size;
+	gint64 mtime;
+} _PWML_IndexFile;
+
+typedef struct {
+	// Path relative to the mod's folder -> _PWML_IndexFile*
+	GHashTable* files;
+	// _PWML_Weapon*, what the mod's weapon.json and builtin_weapons.json said
+	GPtrArray* weapons;
+	// mtime of the mod's weapons folder, which changes when a weapon is added or removed. 0 if there was none.
+	gint64 weapons_mtime;
+} _PWML_Index;
+
+_PWML_Index* _pwml_index_new(void);
+void _pwml_index_free(_PWML_Index* index);
+// Takes digest
+void _pwml_index_add_file(_PWML_Index* index, const char* relative_path, char* digest, gint64 size, gint64 mtime);
+// NULL if the mod has no index or it can't be read
+_PWML_Index* _pwml_index_load(const char* mod_path);
+bool _pwml_index_save(_PWML_Index* index, const char* mod_path, _File_Utils_Context* context);
+
+// A copy of the index's weapons, NULL if a weapon was added or removed or a weapon.json or builtin_weapons.json
+// changed since the import. Nothing else is checked, the copies read whatever the mod has now.
+GPtrArray* _pwml_index_get_weapons(_PWML_Index* index, const char* mod_path);
+// The entry of a file under mod_path, NULL if it wasn't imported
+const _PWML_IndexFile* _pwml_index_get_file(_PWML_Index* index, const char* mod_path, const char* path);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef JSON_UTILS_H
+#define JSON_UTILS_H
+
+#include <glib.h>
+#include <json-c/json_types.h>
+#include <stdbool.h>
+
+// Parses the file at path with the calling thread's tokener. Small files are read into a buffer the thread
+// keeps for the next one, large ones are mapped. NULL if the file can't be read or isn't valid json.
+// missing may be NULL, otherwise it says whether the file doesn't exist, which isn't reported as an error.
+json_object* _json_utils_load(const char* path, bool* missing);
+
+// A field an object has to have
+typedef struct {
+	const char* key;
+	json_type type;
+	// Set to the field's value, which belongs to the object it was read from
+	json_object** value;
+	// Missing optional fields set value to NULL, a field of the wrong type still fails
+	bool optional;
+} _JSON_Utils_Field;
+
+// Sets the value of every field of object, false if one is missing or has the wrong type.
+// path is only used to say where the object came from in the error.
+bool _json_utils_get_fields(json_object* object, const char* path, const _JSON_Utils_Field* fields, uint count);
+
+// _json_utils_load and _json_utils_get_fields on its root, NULL if either fails. The fields belong to the returned root.
+json_object* _json_utils_load_fields(const char* path, bool* missing, const _JSON_Utils_Field* fields, uint count);
+
+#endif
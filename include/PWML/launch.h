@@ -0,0 +1,16 @@
+#ifndef PWML_LAUNCH_H
+#define PWML_LAUNCH_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+typedef struct PWML PWML;
+
+// Starts background threads that pull the deployed assets into the page cache, files referenced by
+// the merged Graphics.xml and Sounds.xml first. Returns right away, the threads outlive the handle.
+void pwml_prewarm_assets(PWML* pwml);
+// Prewarms and starts bin/Wings.exe from the game folder. PWML_LAUNCHER in the environment
+// is put in front of the executable, for example "wine" or "proton run".
+bool pwml_launch(PWML* pwml);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef LINE_UTILS_H
+#define LINE_UTILS_H
+
+#include "PWML/file_utils.h"
+#include <glib.h>
+#include <stdbool.h>
+
+// Streams the lines of every file in paths into destination_path in order, through one buffered writer.
+// \r\n and \n are both taken as line ends, every written line ends in \n and blank lines are dropped.
+// With deduplicate every line is written once, where it first shows up, and its later copies are dropped.
+// Files that can't be read are skipped and counted as errors, returns false if destination_path couldn't be written.
+bool _line_utils_merge_files(GPtrArray* paths, bool deduplicate, const char* destination_path, _File_Utils_Counters* counters);
+
+#endif
@@ -1,21 +1,95 @@
 #ifndef PWML_MOD_H
 #define PWML_MOD_H
 
+#include "PWML/file_utils.h"
+#include "PWML/index.h"
+#include "PWML/resource.h"
+#include <glib.h>
+#include <json-c/json_types.h>
 #include <stdbool.h>
 
 typedef struct PWML PWML;
 
+// The strings of every mod of one pwml_load_mods packed together, freed along with the last of those mods
 typedef struct {
-	const char* path;
+	GStringChunk* chunk;
+	// Every string in chunk, so equal ones are only stored once
+	GHashTable* interned;
+	guint64 bytes;
+	gint ref_count;
+} _PWML_ModStrings;
+
+typedef struct {
+	// These four are in strings. mods_path is the same copy for every mod, the mod's folder is in it under id.
+	const char* mods_path;
 	const char* id;
 	const char* name;
 	const char* short_description;
+	// Loaded on first use by pwml_get_mod_description and evicted again past the description budget.
+	// Only touched under the PWML's description_mutex.
 	const char* description;
+	// The mod's place in the PWML's description_lru while description is loaded
+	GList* description_link;
 	bool active;
+	// Place in the apply order: the position in active_mods.json counting from 1, past the others for mods
+	// activated since and 0 for the rest. Guarded by the catalog's lock like active.
+	guint priority;
+	// The catalog holds one reference, pwml_apply_mods another while it uses the mod
+	gint ref_count;
+	_PWML_ModStrings* strings;
 } PWML_Mod;
 
 void pwml_mod_free(PWML_Mod* mod);
 
-void _pwml_mod_apply(PWML* pwml, PWML_Mod* mod);
+_PWML_ModStrings* _pwml_mod_strings_new(void);
+_PWML_ModStrings* _pwml_mod_strings_ref(_PWML_ModStrings* strings);
+void _pwml_mod_strings_unref(_PWML_ModStrings* strings);
+// Only from the thread filling the catalog, the copy lives as long as strings. Equal strings get the same copy.
+const char* _pwml_mod_strings_insert(_PWML_ModStrings* strings, const char* string);
+// The mod's folder, has to be freed
+char* _pwml_mod_get_path(const PWML_Mod* mod);
+PWML_Mod* _pwml_mod_ref(PWML_Mod* mod);
+// Sorts PWML_Mod* values in apply order, see pwml_apply_mods. Expects the catalog's lock or mods nobody else changes.
+int _pwml_mod_compare_apply_order(const void* a, const void* b);
+// Takes a void* so it can be a GDestroyNotify
+void _pwml_mod_unref(void* mod);
+
+// Reads the metadata.json of the mod at mod_path, NULL if it is missing or invalid. name and
+// short_description belong to the returned root.
+json_object* _pwml_mod_read_metadata(const char* mod_path, bool* missing, json_object** name, json_object** short_description);
+// Reads every weapon the mod at mod_path adds, both the ones with files and the built-in ones, without copying anything
+GPtrArray* _pwml_mod_scan_weapons(const char* mod_path, _File_Utils_Counters* counters);
+
+// Everything needed to apply a mod, worked out before anything is copied. Nothing is
+// written to the game folders until the plan is copied.
+typedef struct {
+	PWML_Mod* mod;
+	// The mod's folder
+	char* path;
+	// What pwml_import_mod found out about the mod, NULL if it wasn't imported or the index can't be read
+	_PWML_Index* index;
+	// _PWML_Weapon*, handed to pwml->weapons when the plan is executed
+	GPtrArray* weapons;
+	// _File_Utils_CopyJob* per resource
+	GPtrArray* jobs[PWML_RESOURCE_COUNT];
+	// The mod's copy of each resource's generated file, NULL if it doesn't have one
+	char* merge_inputs[PWML_RESOURCE_COUNT];
+} _PWML_ModPlan;
+
+// Plans of different mods can be made in parallel. Each resource's jobs come out in the PWML's copy order.
+_PWML_ModPlan* _pwml_mod_plan(PWML* pwml, PWML_Mod* mod);
+// Frees the jobs of plan that a later mod overrides and claims the destinations of the rest. A job is
+// overridden by a later mod deploying the same path, a file where the job's path has a folder, or files
+// under the job's path. claimed borrows the destinations, claimed_folders owns the folders they are in.
+// Going from the last mod to the first leaves every path to the last mod that deploys it, so the plans
+// left neither overlap nor nest and can be copied in any order. Returns how many jobs were dropped.
+guint _pwml_mod_plan_drop_overridden(_PWML_ModPlan* plan, GHashTable* claimed, GHashTable* claimed_folders);
+// Copies count of the resource's jobs starting at first, from any thread. Returns false if any of them failed.
+bool _pwml_mod_plan_copy(PWML* pwml, _PWML_ModPlan* plan, PWML_ResourceType type, uint first, uint count);
+// Records what plan deployed and hands its weapons and merge inputs to pwml once it is copied.
+// Plans are finished in apply order, which is the order the merged files list the mods in.
+void _pwml_mod_plan_finish(PWML* pwml, _PWML_ModPlan* plan);
+// Takes a void* so it can be a GDestroyNotify
+void _pwml_mod_plan_free(void* plan);
 
 #endif
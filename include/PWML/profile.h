@@ -0,0 +1,40 @@
+#ifndef PWML_PROFILE_H
+#define PWML_PROFILE_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+typedef struct PWML PWML;
+
+extern const char* const PWML_PROFILES_FOLDER;
+extern const char* const PWML_DEFAULT_PROFILE;
+extern const char* const PWML_PROFILES_JSON;
+extern const char* const PWML_PROFILE_JSON;
+extern const char* const PWML_PROFILE_DEPLOYMENT_FOLDER;
+extern const char* const PWML_DEPLOYED_FINGERPRINT;
+
+// Named sets of active mods, kept in .pwml_profiles. The game folders always hold the current profile's
+// deployment, PWML_DEFAULT_PROFILE's until another one is switched to.
+//
+// Switching renames the game folders into the current profile's folder and the target's deployment, if it
+// has one, back in their place, so going back and forth copies nothing. A deployment is only reused while
+// none of its mods' files changed since it was applied, otherwise the switch applies the profile.
+
+// Saves the active mods as the set of profile name, creating it if needed
+bool pwml_save_profile(PWML* pwml, const char* name);
+// Also makes the profile's set the active mods and writes it to active_mods.json
+bool pwml_switch_profile(PWML* pwml, const char* name);
+// Switches back to the profile that was current before the last switch
+bool pwml_rollback_profile(PWML* pwml);
+// Same ownership as pwml_list_mods
+GPtrArray* pwml_list_profiles(PWML* pwml);
+// Has to be freed
+char* pwml_get_current_profile(PWML* pwml);
+// The current profile can't be deleted
+bool pwml_delete_profile(PWML* pwml, const char* name);
+
+// Called by pwml_apply_mods with the mods it applied, once profiles are in use. mods is NULL when the
+// apply failed, which forgets the stored fingerprint so a half deployed tree is never reused.
+void _pwml_profile_store_fingerprint(PWML* pwml, GPtrArray* mods);
+
+#endif
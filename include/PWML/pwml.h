@@ -1,7 +1,14 @@
 #ifndef PWML_H
 #define PWML_H
 
+#include "PWML/catalog.h"
+#include "PWML/deploy.h"
+#include "PWML/file_utils.h"
 #include "PWML/mod.h"
+#include "PWML/profile.h"
+#include "PWML/resource.h"
+#include "PWML/search.h"
+#include "PWML/stats.h"
 #include <glib.h>
 #include <sys/types.h>
 #include <stdbool.h>
@@ -15,11 +22,14 @@ extern const char* const PWML_MUSIC_FOLDER;
 extern const char* const PWML_LEVELS_FOLDER;
 extern const char* const PWML_GRAPHICS_FOLDER;
 extern const char* const PWML_BIN_FOLDER;
+extern const char* const PWML_WEAPONS_DAT;
 
 extern const char* const PWML_METADATA_JSON;
 extern const char* const PWML_ACTIVE_MODS_JSON;
 extern const char* const PWML_WEAPON_JSON;
 extern const char* const PWML_BUILTIN_WEAPONS_JSON;
+// Rules in a mod's folder for files it doesn't deploy, see _File_Utils_Filter
+extern const char* const PWML_MOD_IGNORE_FILE;
 
 extern const char* const PWML_MENU_MUSIC_TXT;
 extern const char* const PWML_GRAPHICS_XML;
@@ -29,10 +39,29 @@ extern const char* const PWML_WINGS_EXECUTABLE;
 
 extern const char* const PWML_MOD_DATA_FOLDER;
 
+// Queries and pwml_set_mod_active may be called from any thread, also while another one is in
+// pwml_load_mods or pwml_apply_mods. Applies run one at a time and only block each other.
 typedef struct PWML {
 	const char* working_directory;
 	const char* exectuable_path;
+
+	// Guards mods, search_index and the mods' active flags. Only held for lookups and swaps,
+	// pwml_load_mods reads the disk and builds the new catalog before taking it.
+	GRWLock catalog_lock;
+	// id -> PWML_Mod*, the ids are the mods' own
 	GHashTable* mods;
+	// What the current catalog's strings are packed in
+	_PWML_ModStrings* mod_strings;
+
+	// Guards the mods' descriptions and everything below, see catalog.h
+	GMutex description_mutex;
+	// PWML_Mod* with a loaded description, most recently used first
+	GQueue description_lru;
+	guint64 description_bytes;
+	guint64 description_budget;
+
+	// Held for the whole of pwml_apply_mods, guards everything below that only an apply uses
+	GMutex apply_mutex;
 	GPtrArray* weapons;
 
 	GPtrArray* menu_music_paths;
@@ -47,20 +76,58 @@ typedef struct PWML {
 	const char* objects_path;
 	const char* sound_path;
 	const char* weapons_path;
+
+	// Defaults to PWML_COPY_ORDER_INODE, or PWML_COPY_ORDER=none|inode|physical from the environment
+	PWML_CopyOrder copy_order;
+	// Defaults to PWML_DURABILITY_BATCHED, or PWML_DURABILITY=none|batched|strict from the environment
+	PWML_Durability durability;
+	// Defaults to PWML_CAPTURE_COPY, or PWML_CAPTURE=copy|link|reflink|move from the environment
+	PWML_CaptureMode capture_mode;
+	// Set with pwml_set_deploy_strategy, see resource.h
+	PWML_DeployStrategy deploy_strategies[PWML_RESOURCE_COUNT];
+
+	// Guards stats and what it points to, the apply's threads all record into it while pwml_get_stats copies it
+	GMutex stats_mutex;
+	// NULL unless enabled with pwml_set_stats_enabled
+	PWML_Stats* stats;
+
+	// Rebuilt by pwml_load_mods, see search.h
+	_PWML_SearchIndex* search_index;
+
+	// Loaded on first use, see cache.h
+	GHashTable* generated_cache;
+	bool generated_cache_dirty;
+
+	// Loaded on first use, see deploy.h
+	_PWML_DeployManifest* deploy_manifest;
 } PWML;
 
 PWML* pwml_new(const char *working_directory);
 void pwml_free(PWML* pwml);
 
 GPtrArray* pwml_list_mods(PWML* pwml);
+// Mods already in the catalog keep their active state and priority, new ones take theirs from active_mods.json
 void pwml_load_mods(PWML* pwml);
 
 void pwml_set_mod_active(PWML* pwml, const char* id, bool active);
 bool pwml_is_mod_active(PWML* pwml, const char* id);
 
-const char* pwml_get_mod_name(PWML* pwml, const char* id);
-const char* pwml_get_mod_description(PWML* pwml, const char* id);
-
-void pwml_apply_mods(PWML* pwml);
+// Copies, so a pwml_load_mods on another thread can't free them under the caller. Have to be freed
+char* pwml_get_mod_name(PWML* pwml, const char* id);
+char* pwml_get_mod_description(PWML* pwml, const char* id);
+
+// Used by pwml_apply_mods, the vanilla clone in pwml_new only follows the environment for these
+void pwml_set_copy_order(PWML* pwml, PWML_CopyOrder order);
+void pwml_set_durability(PWML* pwml, PWML_Durability durability);
+
+// Mods are applied vanilla first, then in the order active_mods.json lists them, with mods activated since
+// by pwml_set_mod_active after those. A profile keeps the order it was saved in. Where two mods
+// deploy the same path, or one deploys a file where the other has a folder, the later one's is used.
+// Only that is copied, so the mods' copies don't depend on each other and run in parallel.
+// Returns false without touching anything if the filesystem doesn't have room for the active mods, and
+// false once done if any file couldn't be copied or generated.
+bool pwml_apply_mods(PWML* pwml);
+// pwml_apply_mods for callers already holding apply_mutex
+bool _pwml_apply_mods_locked(PWML* pwml);
 
 #endif
@@ -0,0 +1,85 @@
+#ifndef PWML_RESOURCE_H
+#define PWML_RESOURCE_H
+
+#include "PWML/file_utils.h"
+#include "PWML/stats.h"
+#include <glib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct PWML PWML;
+
+// Every folder of the game a mod can put files in. Adding one here and to the table in
+// resource.c is enough for the apply, delete and clone to handle it.
+typedef enum {
+	PWML_RESOURCE_WEAPONS,
+	PWML_RESOURCE_OBJECTS,
+	PWML_RESOURCE_LEVELS,
+	PWML_RESOURCE_MUSIC,
+	PWML_RESOURCE_GRAPHICS,
+	PWML_RESOURCE_SOUND,
+	PWML_RESOURCE_COUNT
+} PWML_ResourceType;
+
+typedef enum {
+	PWML_DEPLOY_COPY,
+	// Hard links to the mod's own files, copies where linking fails. Only for files the game never writes to.
+	PWML_DEPLOY_LINK
+} PWML_DeployStrategy;
+
+// How pwml_new captures the game's own files into the vanilla mod on first run. Every mode but
+// PWML_CAPTURE_COPY only writes the weapons' metadata, falling back to copies for files it can't handle.
+typedef enum {
+	PWML_CAPTURE_COPY,
+	// Hard links, the game and the vanilla mod share the files until the first apply replaces the game's
+	PWML_CAPTURE_LINK,
+	// Reflinks on copy on write filesystems, independent files without copying any data
+	PWML_CAPTURE_REFLINK,
+	// Renames the files into the vanilla mod, the game is missing them until the first apply
+	PWML_CAPTURE_MOVE
+} PWML_CaptureMode;
+
+// How the generated file of a resource is built from the mods
+typedef enum {
+	_PWML_MERGE_NONE,
+	// The lines of the mods' copies one after another, see line_utils.h
+	_PWML_MERGE_LINES,
+	// The children of every mod's root element under the first mod's root
+	_PWML_MERGE_XML_APPEND,
+	// Built from the weapons the mods add, not from files
+	_PWML_MERGE_WEAPONS_DAT
+} _PWML_MergeKind;
+
+typedef struct {
+	const char* const* folder;
+	// The game's copy of the folder, an offset of a const char* in PWML
+	size_t path_offset;
+	// Written by the apply instead of deployed, and kept through the delete so it can be
+	// left alone if nothing changed. NULL if the resource has none.
+	const char* const* generated_file;
+	_PWML_MergeKind merge;
+	PWML_Phase merge_phase;
+	// The mods' copies of generated_file collected during the apply, an offset of a GPtrArray* in PWML.
+	// Only used by the file based merges.
+	size_t merge_inputs_offset;
+	// Only for _PWML_MERGE_LINES, keeps the first copy of every line
+	bool deduplicate_lines;
+	// Left out of the vanilla clone, NULL if nothing is
+	const char* clone_ignore;
+	// Deployed by the weapons code, which only copies the weapons a mod declares
+	bool custom_deploy;
+} _PWML_ResourceHandler;
+
+// Defaults to PWML_DEPLOY_COPY for everything
+void pwml_set_deploy_strategy(PWML* pwml, PWML_ResourceType type, PWML_DeployStrategy strategy);
+
+// "copy", "link", "reflink" or "move", returns false if name is none of them
+bool _pwml_resource_parse_capture_mode(const char* name, PWML_CaptureMode* mode);
+// The copy method that transfers files the way mode says
+_File_Utils_CopyMethod _pwml_resource_get_capture_method(PWML_CaptureMode mode);
+
+const _PWML_ResourceHandler* _pwml_resource_get_handler(PWML_ResourceType type);
+const char* _pwml_resource_get_path(PWML* pwml, PWML_ResourceType type);
+GPtrArray* _pwml_resource_get_merge_inputs(PWML* pwml, PWML_ResourceType type);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef SCHEDULE_UTILS_H
+#define SCHEDULE_UTILS_H
+
+#include "PWML/file_utils.h"
+#include <glib.h>
+
+// Reorders copy jobs so their sources are read in the order they are laid out on disk
+void _schedule_utils_sort_jobs(PWML_CopyOrder order, GPtrArray* jobs);
+// Sources opened ahead of the one being copied
+#define SCHEDULE_UTILS_READAHEAD_WINDOW 8
+
+// Opens the sources of the jobs a window ahead of the copy and asks the kernel to start reading them.
+// The copy reads from the same descriptor, so no source is opened twice.
+typedef struct {
+	GPtrArray* jobs;
+	// The first job whose source isn't open yet
+	uint next;
+	// By job index modulo the window, -1 where nothing is open
+	int fds[SCHEDULE_UTILS_READAHEAD_WINDOW];
+} _Schedule_Utils_Readahead;
+
+void _schedule_utils_readahead_init(_Schedule_Utils_Readahead* readahead, GPtrArray* jobs);
+// Opens the sources up to the window ahead of current and returns current's descriptor, which the caller
+// closes, or -1 if it couldn't be opened. Has to be called for every job in order, which leaves nothing open.
+int _schedule_utils_readahead_take(_Schedule_Utils_Readahead* readahead, uint current);
+// "none", "inode" or "physical", returns false if name is none of them
+bool _schedule_utils_parse_order(const char* name, PWML_CopyOrder* order);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef PWML_SEARCH_H
+#define PWML_SEARCH_H
+
+#include "PWML/mod.h"
+#include <glib.h>
+
+typedef struct PWML PWML;
+typedef struct _PWML_SearchIndex _PWML_SearchIndex;
+
+// Fills results with the ids of up to max_results mods matching every word of query, best match first.
+// Matches in the id and name rank above the short description, which ranks above the description.
+// Descriptions are only searched once they have been loaded with pwml_get_mod_description, and only
+// while there is no description budget.
+// The ids are copies and each has to be freed. Returns how many were written.
+uint pwml_search_mods(PWML* pwml, const char* query, char** results, uint max_results);
+
+// Built from scratch at the end of pwml_load_mods
+_PWML_SearchIndex* _pwml_search_index_new(GHashTable* mods);
+void _pwml_search_index_free(_PWML_SearchIndex* index);
+// Call when a mod's description has been loaded, with a copy of it since the mod's own may be evicted meanwhile
+void _pwml_search_index_add_description(_PWML_SearchIndex* index, PWML_Mod* mod, const char* description);
+
+#endif
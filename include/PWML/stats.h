@@ -0,0 +1,55 @@
+#ifndef PWML_STATS_H
+#define PWML_STATS_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+typedef struct PWML PWML;
+typedef struct _File_Utils_Counters _File_Utils_Counters;
+
+typedef enum {
+	PWML_PHASE_DELETE,
+	PWML_PHASE_COPY,
+	PWML_PHASE_WEAPONS_SCAN,
+	PWML_PHASE_WEAPONS_DAT,
+	PWML_PHASE_MENU_MUSIC,
+	PWML_PHASE_GRAPHICS_XML,
+	PWML_PHASE_SOUNDS_XML,
+	PWML_PHASE_COUNT
+} PWML_Phase;
+
+typedef struct {
+	// Summed over the threads the phase ran on, so the copies of an apply can add up to more than the apply took
+	guint64 wall_time_us;
+	guint64 files;
+	guint64 bytes;
+	guint64 errors;
+} PWML_PhaseStats;
+
+typedef struct {
+	const char* id;
+	PWML_PhaseStats phases[PWML_PHASE_COUNT];
+} PWML_ModStats;
+
+typedef struct {
+	// Summed over every apply since the last reset
+	PWML_PhaseStats phases[PWML_PHASE_COUNT];
+	// PWML_ModStats*, in the order the mods were first applied
+	GPtrArray* mods;
+	GHashTable* mods_by_id;
+} PWML_Stats;
+
+// Stats are off by default, and cost a single branch per event while off
+void pwml_set_stats_enabled(PWML* pwml, bool enabled);
+// A copy, so it can be read while an apply is recording more. NULL while stats are off, has to be freed with pwml_stats_free.
+PWML_Stats* pwml_get_stats(PWML* pwml);
+void pwml_stats_free(PWML_Stats* stats);
+void pwml_reset_stats(PWML* pwml);
+const char* pwml_phase_get_name(PWML_Phase phase);
+
+// Returns the start time to pass to _pwml_stats_end, or 0 if stats are off
+gint64 _pwml_stats_begin(PWML* pwml);
+// mod_id may be NULL for phases that don't belong to a single mod
+void _pwml_stats_end(PWML* pwml, PWML_Phase phase, const char* mod_id, gint64 start, const _File_Utils_Counters* counters);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef PWML_TRACE_H
+#define PWML_TRACE_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+// Chrome trace-event json, open it in chrome://tracing or ui.perfetto.dev.
+// Setting PWML_TRACE=path in the environment starts tracing on first use without any calls, and stops it at exit.
+bool pwml_trace_start(const char* path);
+// Flushes what is left and closes the file
+void pwml_trace_stop(void);
+bool pwml_trace_is_enabled(void);
+
+// Returns the start time to pass to _pwml_trace_end, or 0 if tracing is off
+gint64 _pwml_trace_begin(void);
+// name should be a string literal, detail is copied and may be NULL
+void _pwml_trace_end(const char* category, const char* name, const char* detail, gint64 start);
+// Moves the events buffered by every thread to the file
+void _pwml_trace_flush(void);
+
+#endif
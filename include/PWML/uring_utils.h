@@ -0,0 +1,13 @@
+#ifndef URING_UTILS_H
+#define URING_UTILS_H
+
+#include "PWML/file_utils.h"
+#include <glib.h>
+#include <stdbool.h>
+
+// Both return false without touching anything if io_uring can't be used,
+// in which case the caller should do the work synchronously instead.
+bool _uring_utils_copy_files(_File_Utils_Context* context, GPtrArray* jobs);
+bool _uring_utils_unlink_files(_File_Utils_Context* context, GPtrArray* paths);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef PWML_VANILLA_H
+#define PWML_VANILLA_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+typedef struct PWML PWML;
+
+// The size, mtime and hash of every game file captured into mods/vanilla, kept in the cache folder
+extern const char* const PWML_CAPTURE_MANIFEST_JSON;
+
+typedef struct {
+	// Added or changed game files captured into the vanilla mod
+	guint64 captured;
+	// Captured files the game no longer has, deleted from the vanilla mod
+	guint64 removed;
+	// Weapons.dat changed, builtin_weapons.json and the weapons' weapon.json were written again from it
+	bool weapons_refreshed;
+} PWML_RefreshResult;
+
+// Brings the vanilla mod up to date after a game update without capturing everything again. A file in
+// the game folders counts as changed if its size or mtime differ from what the capture manifest has for it
+// and its contents do too, and is captured with the same PWML_CAPTURE mode as the first one. Files the last
+// apply deployed from another mod are left alone. The generated files, which PWML writes itself, count as
+// changed if their ctime is newer than the last capture, refresh or apply. A removed file is only noticed
+// where the last apply deployed it from the vanilla mod.
+// Has to run before the next apply, which replaces the game folders with what the mods deploy.
+bool pwml_refresh_vanilla(PWML* pwml, PWML_RefreshResult* result);
+
+// Creates mods/vanilla from the game on first run
+void _pwml_vanilla_capture(PWML* pwml);
+
+#endif
@@ -1,8 +1,11 @@
 #ifndef WEAPON_H
 #define WEAPON_H
 
+#include <glib.h>
 #include <stdbool.h>
 
+typedef struct PWML PWML;
+
 typedef struct {
 	const char* name;
 	bool ship;
@@ -11,5 +14,8 @@ typedef struct {
 } _PWML_Weapon;
 
 void _pwml_weapon_free(void* weapon);
+_PWML_Weapon* _pwml_weapon_copy(const _PWML_Weapon* weapon);
+// The game's Weapons.dat as name -> _PWML_Weapon*, every weapon with has_built_in_files set. NULL if it can't be read.
+GHashTable* _pwml_parse_weapons_dat(PWML* pwml, const char* weapons_path);
 
 #endif
@@ -1,10 +1,42 @@
 #ifndef XML_UTILS_H
 #define XML_UTILS_H
 
+#include "PWML/file_utils.h"
 #include <glib.h>
 #include <stdbool.h>
 
-bool _xml_utils_combine_files(const char* path_a, const char* path_b, const char* destination_path);
-bool _xml_utils_combine_all_files(GPtrArray* files, const char* destination_path);
+// What the append merge needs of one input, serialised so merging is only concatenating them
+typedef struct {
+	// The declaration and the root's start tag
+	char* head;
+	// The root's children as they are written out
+	char* body;
+	// The root's end tag
+	char* tail;
+} _XML_Utils_Fragment;
+
+// Appends the children of each input's root to the first input's root, one input at a time,
+// so the inputs can be merged as soon as they are known.
+typedef struct {
+	// _XML_Utils_Fragment*, in the order they were added
+	GPtrArray* fragments;
+	char* first_path;
+	// Fragments of unchanged inputs are read from here instead of parsing them, NULL to always parse
+	char* cache_folder;
+	// How the cached fragments are written
+	_File_Utils_Context context;
+	bool failed;
+} _XML_Utils_Merger;
+
+// context is copied, its counters aren't used
+_XML_Utils_Merger* _xml_utils_merger_new(const _File_Utils_Context* context, const char* cache_folder);
+bool _xml_utils_merger_add(_XML_Utils_Merger* merger, const char* path);
+// A single input is copied as is
+bool _xml_utils_merger_save(_XML_Utils_Merger* merger, const char* destination_path);
+void _xml_utils_merger_free(_XML_Utils_Merger* merger);
+
+// Every attribute value and text node of xml_path that names an existing file under base_folder,
+// in document order without duplicates. Empty if the file can't be read.
+GPtrArray* _xml_utils_collect_file_references(const char* xml_path, const char* base_folder);
 
 #endif
@@ -0,0 +1,40 @@
+#include "PWML/bounded_queue.h"
+#include <glib.h>
+#include <stdlib.h>
+
+_PWML_BoundedQueue* _pwml_bounded_queue_new(guint capacity) {
+	_PWML_BoundedQueue* queue = malloc(sizeof(_PWML_BoundedQueue));
+	g_mutex_init(&queue->mutex);
+	g_cond_init(&queue->not_empty);
+	g_cond_init(&queue->not_full);
+	g_queue_init(&queue->items);
+	queue->capacity = capacity > 0 ? capacity : 1;
+	return queue;
+}
+
+void _pwml_bounded_queue_free(_PWML_BoundedQueue* queue) {
+	g_queue_clear(&queue->items);
+	g_cond_clear(&queue->not_empty);
+	g_cond_clear(&queue->not_full);
+	g_mutex_clear(&queue->mutex);
+	free(queue);
+}
+
+void _pwml_bounded_queue_push(_PWML_BoundedQueue* queue, gpointer item) {
+	g_mutex_lock(&queue->mutex);
+	while (queue->items.length >= queue->capacity)
+		g_cond_wait(&queue->not_full, &queue->mutex);
+	g_queue_push_tail(&queue->items, item);
+	g_cond_signal(&queue->not_empty);
+	g_mutex_unlock(&queue->mutex);
+}
+
+gpointer _pwml_bounded_queue_pop(_PWML_BoundedQueue* queue) {
+	g_mutex_lock(&queue->mutex);
+	while (queue->items.length == 0)
+		g_cond_wait(&queue->not_empty, &queue->mutex);
+	gpointer item = g_queue_pop_head(&queue->items);
+	g_cond_signal(&queue->not_full);
+	g_mutex_unlock(&queue->mutex);
+	return item;
+}
@@ -0,0 +1,170 @@
+#include "PWML/cache.h"
+#include "PWML/file_utils.h"
+#include "PWML/json_utils.h"
+#include "PWML/pwml.h"
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <json-c/json_object.h>
+#include <json-c/json_types.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char* const PWML_CACHE_FOLDER = ".pwml_cache";
+const char* const PWML_GENERATED_CACHE_JSON = "generated.json";
+const char* const PWML_XML_FRAGMENT_CACHE_FOLDER = "xml";
+
+typedef struct {
+	char* fingerprint;
+	// -1 if the destination didn't exist
+	gint64 size;
+	gint64 mtime;
+} __PWML_CacheEntry;
+
+static void __pwml_cache_entry_free(void* voidptr_entry) {
+	__PWML_CacheEntry* entry = (__PWML_CacheEntry*)voidptr_entry;
+	free(entry->fingerprint);
+	free(entry);
+}
+
+static void __pwml_cache_stat(const char* path, gint64* size, gint64* mtime) {
+	GStatBuf stat_buf;
+	if (g_stat(path, &stat_buf) != 0) {
+		*size = -1;
+		*mtime = 0;
+		return;
+	}
+	*size = stat_buf.st_size;
+	*mtime = (gint64)stat_buf.st_mtim.tv_sec * 1000000000 + stat_buf.st_mtim.tv_nsec;
+}
+
+static const char* __pwml_cache_get_json_path(PWML* pwml) {
+	return g_build_filename(pwml->working_directory, PWML_CACHE_FOLDER, PWML_GENERATED_CACHE_JSON, NULL);
+}
+
+static GHashTable* __pwml_cache_get(PWML* pwml) {
+	if (pwml->generated_cache)
+		return pwml->generated_cache;
+
+	pwml->generated_cache = g_hash_table_new_full(g_str_hash, g_str_equal, free, __pwml_cache_entry_free);
+	pwml->generated_cache_dirty = false;
+
+	const char* json_path = __pwml_cache_get_json_path(pwml);
+	bool missing;
+	json_object* root = _json_utils_load(json_path, &missing);
+	free((char*)json_path);
+	if (!root)
+		return pwml->generated_cache;
+
+	json_object_object_foreach(root, key, j_entry) {
+		json_object *fingerprint, *size, *mtime;
+		if (!json_object_object_get_ex(j_entry, "fingerprint", &fingerprint)
+			|| !json_object_object_get_ex(j_entry, "size", &size)
+			|| !json_object_object_get_ex(j_entry, "mtime", &mtime))
+			continue;
+
+		__PWML_CacheEntry* entry = malloc(sizeof(__PWML_CacheEntry));
+		entry->fingerprint = strdup(json_object_get_string(fingerprint));
+		entry->size = json_object_get_int64(size);
+		entry->mtime = json_object_get_int64(mtime);
+		g_hash_table_insert(pwml->generated_cache, strdup(key), entry);
+	}
+
+	json_object_put(root);
+	return pwml->generated_cache;
+}
+
+char* _pwml_cache_fingerprint_files(GPtrArray* paths, const char* mode) {
+	GChecksum* checksum = g_checksum_new(G_CHECKSUM_SHA256);
+	g_checksum_update(checksum, (const guchar*)mode, -1);
+
+	for (uint i = 0; i < paths->len; i++) {
+		const char* path = g_ptr_array_index(paths, i);
+		gint64 size, mtime;
+		__pwml_cache_stat(path, &size, &mtime);
+
+		char* line = g_strdup_printf("\n%s\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT, path, size, mtime);
+		g_checksum_update(checksum, (const guchar*)line, -1);
+		free(line);
+	}
+
+	char* fingerprint = strdup(g_checksum_get_string(checksum));
+	g_checksum_free(checksum);
+	return fingerprint;
+}
+
+char* _pwml_cache_fingerprint_data(const char* data, gsize length) {
+	return g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar*)data, length);
+}
+
+bool _pwml_cache_is_fresh(PWML* pwml, const char* key, const char* fingerprint, const char* destination_path) {
+	__PWML_CacheEntry* entry = g_hash_table_lookup(__pwml_cache_get(pwml), key);
+	if (!entry || strcmp(entry->fingerprint, fingerprint) != 0)
+		return false;
+
+	gint64 size, mtime;
+	__pwml_cache_stat(destination_path, &size, &mtime);
+	return size == entry->size && mtime == entry->mtime;
+}
+
+void _pwml_cache_store(PWML* pwml, const char* key, const char* fingerprint, const char* destination_path) {
+	__PWML_CacheEntry* entry = malloc(sizeof(__PWML_CacheEntry));
+	entry->fingerprint = strdup(fingerprint);
+	__pwml_cache_stat(destination_path, &entry->size, &entry->mtime);
+	g_hash_table_insert(__pwml_cache_get(pwml), strdup(key), entry);
+	pwml->generated_cache_dirty = true;
+}
+
+void _pwml_cache_forget(PWML* pwml, const char* key) {
+	if (g_hash_table_remove(__pwml_cache_get(pwml), key))
+		pwml->generated_cache_dirty = true;
+}
+
+void _pwml_cache_save(PWML* pwml) {
+	if (!pwml->generated_cache || !pwml->generated_cache_dirty)
+		return;
+
+	const char* cache_folder = g_build_filename(pwml->working_directory, PWML_CACHE_FOLDER, NULL);
+	if (g_mkdir_with_parents(cache_folder, 0755) == -1) {
+		g_printerr("Failed to create cache folder %s\n", cache_folder);
+		free((char*)cache_folder);
+		return;
+	}
+	free((char*)cache_folder);
+
+	json_object* root = json_object_new_object();
+
+	GHashTableIter iter;
+	g_hash_table_iter_init(&iter, pwml->generated_cache);
+
+	const char* key;
+	__PWML_CacheEntry* entry;
+	while (g_hash_table_iter_next(&iter, (void**)&key, (void**)&entry)) {
+		json_object* j_entry = json_object_new_object();
+		json_object_object_add(j_entry, "fingerprint", json_object_new_string(entry->fingerprint));
+		json_object_object_add(j_entry, "size", json_object_new_int64(entry->size));
+		json_object_object_add(j_entry, "mtime", json_object_new_int64(entry->mtime));
+		json_object_object_add(root, key, j_entry);
+	}
+
+	const char* json_path = __pwml_cache_get_json_path(pwml);
+	const char* json_str = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
+
+	GError* error = NULL;
+	_File_Utils_Context context = { .durability = pwml->durability };
+	_file_utils_set_contents(&context, json_path, json_str, -1, &error);
+	if (error) {
+		g_printerr("Failed to write %s\nGError: %s\n", json_path, error->message);
+		g_error_free(error);
+	} else {
+		pwml->generated_cache_dirty = false;
+	}
+
+	json_object_put(root);
+	free((char*)json_path);
+}
+
+void _pwml_cache_free(PWML* pwml) {
+	if (pwml->generated_cache)
+		g_hash_table_destroy(pwml->generated_cache);
+	pwml->generated_cache = NULL;
+}
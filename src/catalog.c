@@ -0,0 +1,71 @@
+#include "PWML/catalog.h"
+#include "PWML/pwml.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Roughly what a GHashTable spends per entry on top of the mod
+#define CATALOG_ENTRY_OVERHEAD (3 * sizeof(void*) + sizeof(guint))
+
+static guint64 __pwml_catalog_description_size(PWML_Mod* mod) {
+	return strlen(mod->description) + 1;
+}
+
+static void __pwml_catalog_evict(PWML* pwml, PWML_Mod* keep) {
+	while (pwml->description_budget && pwml->description_bytes > pwml->description_budget) {
+		PWML_Mod* mod = g_queue_peek_tail(&pwml->description_lru);
+		if (!mod || mod == keep)
+			break;
+
+		pwml->description_bytes -= __pwml_catalog_description_size(mod);
+		g_queue_delete_link(&pwml->description_lru, mod->description_link);
+		mod->description_link = NULL;
+		free((char*)mod->description);
+		mod->description = NULL;
+	}
+}
+
+void pwml_set_description_budget(PWML* pwml, guint64 bytes) {
+	g_mutex_lock(&pwml->description_mutex);
+	pwml->description_budget = bytes;
+	__pwml_catalog_evict(pwml, NULL);
+	g_mutex_unlock(&pwml->description_mutex);
+}
+
+void pwml_get_catalog_memory(PWML* pwml, PWML_CatalogMemory* memory) {
+	memset(memory, 0, sizeof(PWML_CatalogMemory));
+
+	g_rw_lock_reader_lock(&pwml->catalog_lock);
+	memory->mods = g_hash_table_size(pwml->mods);
+	memory->mod_bytes = memory->mods * (sizeof(PWML_Mod) + CATALOG_ENTRY_OVERHEAD);
+	if (pwml->mod_strings)
+		memory->string_bytes = pwml->mod_strings->bytes;
+	g_rw_lock_reader_unlock(&pwml->catalog_lock);
+
+	g_mutex_lock(&pwml->description_mutex);
+	memory->description_bytes = pwml->description_bytes;
+	memory->description_budget = pwml->description_budget;
+	g_mutex_unlock(&pwml->description_mutex);
+}
+
+void _pwml_catalog_add_description(PWML* pwml, PWML_Mod* mod) {
+	g_queue_push_head(&pwml->description_lru, mod);
+	mod->description_link = g_queue_peek_head_link(&pwml->description_lru);
+	pwml->description_bytes += __pwml_catalog_description_size(mod);
+	__pwml_catalog_evict(pwml, mod);
+}
+
+void _pwml_catalog_touch_description(PWML* pwml, PWML_Mod* mod) {
+	if (!mod->description_link)
+		return;
+	g_queue_unlink(&pwml->description_lru, mod->description_link);
+	g_queue_push_head_link(&pwml->description_lru, mod->description_link);
+}
+
+void _pwml_catalog_forget_descriptions(PWML* pwml) {
+	PWML_Mod* mod;
+	while ((mod = g_queue_pop_head(&pwml->description_lru))) {
+		mod->description_link = NULL;
+	}
+	pwml->description_bytes = 0;
+}
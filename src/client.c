@@ -0,0 +1,190 @@
+#include "PWML/client.h"
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct PWML_Client {
+	GSocketConnection* connection;
+	GDataInputStream* input;
+	GOutputStream* output;
+	// One request at a time per connection
+	GMutex mutex;
+};
+
+char* pwml_client_get_default_socket_path(const char* working_directory) {
+	char* canonical = g_canonicalize_filename(working_directory, NULL);
+	char* hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, canonical, -1);
+	char* name = g_strconcat(hash, ".sock", NULL);
+	char* path = g_build_filename(g_get_user_runtime_dir(), "pwml", name, NULL);
+	g_free(canonical);
+	g_free(hash);
+	g_free(name);
+	return path;
+}
+
+PWML_Client* pwml_client_connect(const char* socket_path) {
+	GSocketClient* socket_client = g_socket_client_new();
+	GSocketAddress* address = g_unix_socket_address_new(socket_path);
+
+	GError* error = NULL;
+	GSocketConnection* connection = g_socket_client_connect(socket_client, G_SOCKET_CONNECTABLE(address), NULL, &error);
+	g_object_unref(address);
+	g_object_unref(socket_client);
+	if (!connection) {
+		g_printerr("Failed to connect to %s\nGError: %s\n", socket_path, error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	PWML_Client* client = malloc(sizeof(PWML_Client));
+	client->connection = connection;
+	client->input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+	client->output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+	g_mutex_init(&client->mutex);
+	return client;
+}
+
+void pwml_client_free(PWML_Client* client) {
+	if (!client)
+		return;
+	g_io_stream_close(G_IO_STREAM(client->connection), NULL, NULL);
+	g_object_unref(client->input);
+	g_object_unref(client->connection);
+	g_mutex_clear(&client->mutex);
+	free(client);
+}
+
+// The result lines, unescaped, or NULL if the daemon answered with an error or went away
+static GPtrArray* __pwml_client_request(PWML_Client* client, const char* command, const char* argument) {
+	char* escaped = argument ? g_strescape(argument, NULL) : NULL;
+	char* request = escaped ? g_strdup_printf("%s %s\n", command, escaped) : g_strdup_printf("%s\n", command);
+	g_free(escaped);
+
+	g_mutex_lock(&client->mutex);
+
+	GPtrArray* lines = NULL;
+	GError* error = NULL;
+	if (!g_output_stream_write_all(client->output, request, strlen(request), NULL, NULL, &error))
+		goto failed;
+
+	char* status = g_data_input_stream_read_line(client->input, NULL, NULL, &error);
+	if (!status)
+		goto failed;
+
+	if (!g_str_has_prefix(status, "OK ")) {
+		if (g_str_has_prefix(status, "ERR ")) {
+			char* message = g_strcompress(status + 4);
+			g_printerr("pwml_daemon couldn't %s: %s\n", command, message);
+			g_free(message);
+		} else {
+			g_printerr("Unexpected answer from pwml_daemon: %s\n", status);
+		}
+		g_free(status);
+		goto done;
+	}
+
+	guint64 count = g_ascii_strtoull(status + 3, NULL, 10);
+	g_free(status);
+
+	lines = g_ptr_array_new_with_free_func(g_free);
+	for (guint64 i = 0; i < count; i++) {
+		char* line = g_data_input_stream_read_line(client->input, NULL, NULL, &error);
+		if (!line) {
+			g_ptr_array_free(lines, true);
+			lines = NULL;
+			goto failed;
+		}
+		g_ptr_array_add(lines, g_strcompress(line));
+		g_free(line);
+	}
+	goto done;
+
+failed:
+	if (error) {
+		g_printerr("Lost pwml_daemon while sending %s\nGError: %s\n", command, error->message);
+		g_error_free(error);
+	} else {
+		g_printerr("pwml_daemon closed the connection during %s\n", command);
+	}
+
+done:
+	g_mutex_unlock(&client->mutex);
+	g_free(request);
+	return lines;
+}
+
+// For requests that answer a single line, NULL if they failed or answered nothing
+static char* __pwml_client_request_line(PWML_Client* client, const char* command, const char* argument) {
+	GPtrArray* lines = __pwml_client_request(client, command, argument);
+	if (!lines)
+		return NULL;
+
+	char* line = lines->len > 0 ? g_strdup(g_ptr_array_index(lines, 0)) : NULL;
+	g_ptr_array_free(lines, true);
+	return line;
+}
+
+static bool __pwml_client_request_ok(PWML_Client* client, const char* command, const char* argument) {
+	GPtrArray* lines = __pwml_client_request(client, command, argument);
+	if (!lines)
+		return false;
+	g_ptr_array_free(lines, true);
+	return true;
+}
+
+GPtrArray* pwml_client_list_mods(PWML_Client* client) {
+	return __pwml_client_request(client, "LIST", NULL);
+}
+
+GPtrArray* pwml_client_search_mods(PWML_Client* client, const char* query) {
+	return __pwml_client_request(client, "SEARCH", query);
+}
+
+char* pwml_client_get_mod_name(PWML_Client* client, const char* id) {
+	return __pwml_client_request_line(client, "NAME", id);
+}
+
+bool pwml_client_is_mod_active(PWML_Client* client, const char* id) {
+	char* line = __pwml_client_request_line(client, "ACTIVE", id);
+	bool active = line && g_str_equal(line, "1");
+	g_free(line);
+	return active;
+}
+
+bool pwml_client_set_mod_active(PWML_Client* client, const char* id, bool active) {
+	return __pwml_client_request_ok(client, active ? "ACTIVATE" : "DEACTIVATE", id);
+}
+
+bool pwml_client_apply_mods(PWML_Client* client) {
+	return __pwml_client_request_ok(client, "APPLY", NULL);
+}
+
+char* pwml_client_verify_install(PWML_Client* client, bool repair) {
+	return __pwml_client_request_line(client, repair ? "REPAIR" : "VERIFY", NULL);
+}
+
+char* pwml_client_refresh_vanilla(PWML_Client* client) {
+	return __pwml_client_request_line(client, "REFRESH", NULL);
+}
+
+char* pwml_client_import_mod(PWML_Client* client, const char* path) {
+	return __pwml_client_request_line(client, "IMPORT", path);
+}
+
+char* pwml_client_get_current_profile(PWML_Client* client) {
+	return __pwml_client_request_line(client, "PROFILE", NULL);
+}
+
+bool pwml_client_switch_profile(PWML_Client* client, const char* name) {
+	return __pwml_client_request_ok(client, "PROFILE", name);
+}
+
+bool pwml_client_reload_mods(PWML_Client* client) {
+	return __pwml_client_request_ok(client, "RELOAD", NULL);
+}
+
+char* pwml_client_get_status(PWML_Client* client) {
+	return __pwml_client_request_line(client, "STATUS", NULL);
+}
@@ -0,0 +1,354 @@
+#include "PWML/deploy.h"
+#include "PWML/cache.h"
+#include "PWML/file_utils.h"
+#include "PWML/hash.h"
+#include "PWML/json_utils.h"
+#include "PWML/pwml.h"
+#include "PWML/trace.h"
+#include <glib.h>
+#include <json-c/json_object.h>
+#include <json-c/json_types.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+const char* const PWML_DEPLOY_MANIFEST_JSON = "deploy.json";
+
+typedef struct {
+	char* source;
+	// The source's hash as of source_size and source_mtime, NULL until a verify needs it
+	char* digest;
+	gint64 source_size;
+	gint64 source_mtime;
+} __PWML_DeployEntry;
+
+struct _PWML_DeployManifest {
+	// Destination relative to the working directory -> __PWML_DeployEntry*
+	GHashTable* entries;
+	// The manifest of the last apply while a new one is recorded, NULL otherwise
+	_PWML_DeployManifest* previous;
+	bool dirty;
+};
+
+typedef enum {
+	__PWML_VERIFY_OK,
+	__PWML_VERIFY_MISSING,
+	__PWML_VERIFY_MISMATCHED,
+	__PWML_VERIFY_ERROR
+} __PWML_VerifyState;
+
+typedef struct {
+	char* destination;
+	// Only touched by the task's own thread while the pool runs
+	__PWML_DeployEntry* entry;
+	__PWML_VerifyState state;
+	bool rehashed_source;
+} __PWML_VerifyTask;
+
+static void __pwml_deploy_entry_free(void* voidptr_entry) {
+	__PWML_DeployEntry* entry = (__PWML_DeployEntry*)voidptr_entry;
+	free(entry->source);
+	free(entry->digest);
+	free(entry);
+}
+
+static _PWML_DeployManifest* __pwml_deploy_manifest_new(void) {
+	_PWML_DeployManifest* manifest = malloc(sizeof(_PWML_DeployManifest));
+	manifest->entries = g_hash_table_new_full(g_str_hash, g_str_equal, free, __pwml_deploy_entry_free);
+	manifest->previous = NULL;
+	manifest->dirty = false;
+	return manifest;
+}
+
+static void __pwml_deploy_manifest_free(_PWML_DeployManifest* manifest) {
+	if (!manifest)
+		return;
+	__pwml_deploy_manifest_free(manifest->previous);
+	g_hash_table_destroy(manifest->entries);
+	free(manifest);
+}
+
+static const char* __pwml_deploy_get_json_path(PWML* pwml) {
+	return g_build_filename(pwml->working_directory, PWML_CACHE_FOLDER, PWML_DEPLOY_MANIFEST_JSON, NULL);
+}
+
+// NULL if no apply has been recorded
+static _PWML_DeployManifest* __pwml_deploy_get(PWML* pwml) {
+	if (pwml->deploy_manifest)
+		return pwml->deploy_manifest;
+
+	const char* json_path = __pwml_deploy_get_json_path(pwml);
+	bool missing;
+	json_object* root = _json_utils_load(json_path, &missing);
+	free((char*)json_path);
+	if (!root)
+		return NULL;
+
+	pwml->deploy_manifest = __pwml_deploy_manifest_new();
+	json_object_object_foreach(root, key, j_entry) {
+		json_object *source, *digest, *size, *mtime;
+		if (!json_object_object_get_ex(j_entry, "source", &source))
+			continue;
+
+		__PWML_DeployEntry* entry = calloc(1, sizeof(__PWML_DeployEntry));
+		entry->source = strdup(json_object_get_string(source));
+		if (json_object_object_get_ex(j_entry, "digest", &digest)
+			&& json_object_object_get_ex(j_entry, "size", &size)
+			&& json_object_object_get_ex(j_entry, "mtime", &mtime)) {
+			entry->digest = strdup(json_object_get_string(digest));
+			entry->source_size = json_object_get_int64(size);
+			entry->source_mtime = json_object_get_int64(mtime);
+		}
+		g_hash_table_insert(pwml->deploy_manifest->entries, strdup(key), entry);
+	}
+
+	json_object_put(root);
+	return pwml->deploy_manifest;
+}
+
+// Paths under the working directory are stored relative to it, so moving the game doesn't lose the manifest
+static const char* __pwml_deploy_relative(PWML* pwml, const char* path) {
+	size_t length = strlen(pwml->working_directory);
+	if (strncmp(path, pwml->working_directory, length) == 0 && path[length] == G_DIR_SEPARATOR)
+		return path + length + 1;
+	return path;
+}
+
+void _pwml_deploy_begin(PWML* pwml) {
+	_PWML_DeployManifest* previous = __pwml_deploy_get(pwml);
+	pwml->deploy_manifest = __pwml_deploy_manifest_new();
+	pwml->deploy_manifest->previous = previous;
+	pwml->deploy_manifest->dirty = true;
+}
+
+void _pwml_deploy_record(PWML* pwml, const char* destination, const char* source) {
+	_pwml_deploy_record_hashed(pwml, destination, source, NULL, 0, 0);
+}
+
+void _pwml_deploy_record_hashed(PWML* pwml, const char* destination, const char* source, const char* digest, gint64 size, gint64 mtime) {
+	_PWML_DeployManifest* manifest = pwml->deploy_manifest;
+	if (!manifest)
+		return;
+
+	const char* key = __pwml_deploy_relative(pwml, destination);
+	__PWML_DeployEntry* entry = calloc(1, sizeof(__PWML_DeployEntry));
+	entry->source = strdup(source);
+
+	__PWML_DeployEntry* previous_entry = manifest->previous ? g_hash_table_lookup(manifest->previous->entries, key) : NULL;
+	if (previous_entry && previous_entry->digest && strcmp(previous_entry->source, source) == 0) {
+		entry->digest = strdup(previous_entry->digest);
+		entry->source_size = previous_entry->source_size;
+		entry->source_mtime = previous_entry->source_mtime;
+	} else if (digest) {
+		entry->digest = strdup(digest);
+		entry->source_size = size;
+		entry->source_mtime = mtime;
+	}
+
+	g_hash_table_insert(manifest->entries, strdup(key), entry);
+}
+
+const char* _pwml_deploy_get_source(PWML* pwml, const char* destination) {
+	_PWML_DeployManifest* manifest = __pwml_deploy_get(pwml);
+	if (!manifest)
+		return NULL;
+	__PWML_DeployEntry* entry = g_hash_table_lookup(manifest->entries, __pwml_deploy_relative(pwml, destination));
+	return entry ? entry->source : NULL;
+}
+
+void _pwml_deploy_save(PWML* pwml) {
+	_PWML_DeployManifest* manifest = pwml->deploy_manifest;
+	if (!manifest || !manifest->dirty)
+		return;
+
+	__pwml_deploy_manifest_free(manifest->previous);
+	manifest->previous = NULL;
+
+	const char* cache_folder = g_build_filename(pwml->working_directory, PWML_CACHE_FOLDER, NULL);
+	if (g_mkdir_with_parents(cache_folder, 0755) == -1) {
+		g_printerr("Failed to create cache folder %s\n", cache_folder);
+		free((char*)cache_folder);
+		return;
+	}
+	free((char*)cache_folder);
+
+	json_object* root = json_object_new_object();
+
+	GHashTableIter iter;
+	g_hash_table_iter_init(&iter, manifest->entries);
+
+	const char* key;
+	__PWML_DeployEntry* entry;
+	while (g_hash_table_iter_next(&iter, (void**)&key, (void**)&entry)) {
+		json_object* j_entry = json_object_new_object();
+		json_object_object_add(j_entry, "source", json_object_new_string(entry->source));
+		if (entry->digest) {
+			json_object_object_add(j_entry, "digest", json_object_new_string(entry->digest));
+			json_object_object_add(j_entry, "size", json_object_new_int64(entry->source_size));
+			json_object_object_add(j_entry, "mtime", json_object_new_int64(entry->source_mtime));
+		}
+		json_object_object_add(root, key, j_entry);
+	}
+
+	const char* json_path = __pwml_deploy_get_json_path(pwml);
+	const char* json_str = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
+
+	GError* error = NULL;
+	_File_Utils_Context context = { .durability = pwml->durability };
+	_file_utils_set_contents(&context, json_path, json_str, -1, &error);
+	if (error) {
+		g_printerr("Failed to write %s\nGError: %s\n", json_path, error->message);
+		g_error_free(error);
+	} else {
+		manifest->dirty = false;
+	}
+
+	json_object_put(root);
+	free((char*)json_path);
+}
+
+void _pwml_deploy_free(PWML* pwml) {
+	__pwml_deploy_manifest_free(pwml->deploy_manifest);
+	pwml->deploy_manifest = NULL;
+}
+
+static gint64 __pwml_deploy_mtime(const struct stat* stat_buf) {
+	return (gint64)stat_buf->st_mtim.tv_sec * 1000000000 + stat_buf->st_mtim.tv_nsec;
+}
+
+static void __pwml_verify_task(gpointer data, gpointer user_data) {
+	(void)user_data;
+	__PWML_VerifyTask* task = (__PWML_VerifyTask*)data;
+	__PWML_DeployEntry* entry = task->entry;
+
+	struct stat destination_stat, source_stat;
+	if (lstat(task->destination, &destination_stat) != 0) {
+		task->state = __PWML_VERIFY_MISSING;
+		return;
+	}
+	if (lstat(entry->source, &source_stat) != 0) {
+		g_printerr("%s was deployed from %s, which no longer exists\n", task->destination, entry->source);
+		task->state = __PWML_VERIFY_ERROR;
+		return;
+	}
+
+	// Hard linked, nothing to compare
+	if (destination_stat.st_dev == source_stat.st_dev && destination_stat.st_ino == source_stat.st_ino) {
+		task->state = __PWML_VERIFY_OK;
+		return;
+	}
+	if (destination_stat.st_size != source_stat.st_size) {
+		task->state = __PWML_VERIFY_MISMATCHED;
+		return;
+	}
+
+	if (!_pwml_hash_is_current(entry->digest) || entry->source_size != source_stat.st_size || entry->source_mtime != __pwml_deploy_mtime(&source_stat)) {
+		free(entry->digest);
+		entry->digest = _pwml_hash_file(entry->source);
+		entry->source_size = source_stat.st_size;
+		entry->source_mtime = __pwml_deploy_mtime(&source_stat);
+		task->rehashed_source = true;
+		if (!entry->digest) {
+			g_printerr("Failed to read %s\n", entry->source);
+			task->state = __PWML_VERIFY_ERROR;
+			return;
+		}
+	}
+
+	char* digest = _pwml_hash_file(task->destination);
+	if (!digest) {
+		g_printerr("Failed to read %s\n", task->destination);
+		task->state = __PWML_VERIFY_ERROR;
+	} else {
+		task->state = strcmp(digest, entry->digest) == 0 ? __PWML_VERIFY_OK : __PWML_VERIFY_MISMATCHED;
+		free(digest);
+	}
+}
+
+static void __pwml_verify_task_free(void* voidptr_task) {
+	__PWML_VerifyTask* task = (__PWML_VerifyTask*)voidptr_task;
+	free(task->destination);
+	free(task);
+}
+
+bool pwml_verify_install(PWML* pwml, bool repair, PWML_VerifyResult* result) {
+	memset(result, 0, sizeof(PWML_VerifyResult));
+
+	// An apply would change the files and the manifest under the verify
+	g_mutex_lock(&pwml->apply_mutex);
+	_PWML_DeployManifest* manifest = __pwml_deploy_get(pwml);
+	if (!manifest) {
+		g_mutex_unlock(&pwml->apply_mutex);
+		return false;
+	}
+
+	gint64 trace_start = _pwml_trace_begin();
+	GPtrArray* tasks = g_ptr_array_new_with_free_func(__pwml_verify_task_free);
+	GThreadPool* pool = g_thread_pool_new(__pwml_verify_task, NULL, g_get_num_processors(), true, NULL);
+
+	GHashTableIter iter;
+	g_hash_table_iter_init(&iter, manifest->entries);
+
+	const char* key;
+	__PWML_DeployEntry* entry;
+	while (g_hash_table_iter_next(&iter, (void**)&key, (void**)&entry)) {
+		__PWML_VerifyTask* task = calloc(1, sizeof(__PWML_VerifyTask));
+		task->destination = g_path_is_absolute(key) ? strdup(key) : g_build_filename(pwml->working_directory, key, NULL);
+		task->entry = entry;
+		g_ptr_array_add(tasks, task);
+		g_thread_pool_push(pool, task, NULL);
+	}
+
+	// Waits for every task
+	g_thread_pool_free(pool, false, true);
+
+	GPtrArray* jobs = g_ptr_array_new_with_free_func(_file_utils_copy_job_free);
+	for (uint i = 0; i < tasks->len; i++) {
+		__PWML_VerifyTask* task = g_ptr_array_index(tasks, i);
+		result->checked++;
+		if (task->rehashed_source)
+			manifest->dirty = true;
+
+		switch (task->state) {
+		case __PWML_VERIFY_OK:
+			continue;
+		case __PWML_VERIFY_ERROR:
+			result->errors++;
+			continue;
+		case __PWML_VERIFY_MISSING:
+			result->missing++;
+			break;
+		case __PWML_VERIFY_MISMATCHED:
+			result->mismatched++;
+			break;
+		}
+
+		if (repair) {
+			char* folder = g_path_get_dirname(task->destination);
+			g_mkdir_with_parents(folder, 0755);
+			free(folder);
+			_file_utils_add_copy_job(jobs, task->entry->source, task->destination);
+		}
+	}
+	_pwml_trace_end("verify", "pwml_verify_install", NULL, trace_start);
+
+	if (jobs->len > 0) {
+		_File_Utils_Counters counters = { 0 };
+		_File_Utils_Context context = { .counters = &counters, .order = pwml->copy_order, .durability = pwml->durability };
+		_file_utils_copy_jobs(&context, jobs);
+		_file_utils_sync_filesystem(&context, pwml->working_directory);
+		result->repaired = counters.files;
+		result->errors += counters.errors;
+		// Saved with the repair so the manifest on disk never lags behind what was rewritten
+		if (counters.files > 0)
+			manifest->dirty = true;
+	}
+
+	g_ptr_array_free(jobs, true);
+	g_ptr_array_free(tasks, true);
+	_pwml_deploy_save(pwml);
+	_pwml_trace_flush();
+	g_mutex_unlock(&pwml->apply_mutex);
+	return true;
+}
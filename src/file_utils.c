@@ -1,36 +1,188 @@
+// syncfs, fallocate and copy_file_range
+#define _GNU_SOURCE
 #include "PWML/file_utils.h"
+#include "PWML/schedule_utils.h"
+#include "PWML/trace.h"
+#include "PWML/uring_utils.h"
 #include "glib-object.h"
 #include <glib.h>
 #include <gio/gio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <sys/types.h>
+#include <sys/xattr.h>
 #include <unistd.h>
 
 const GFileCopyFlags FLAGS = G_FILE_COPY_OVERWRITE | G_FILE_COPY_ALL_METADATA | G_FILE_COPY_NOFOLLOW_SYMLINKS;
 
+// Files this big get their blocks allocated before they are written, the game streams the
+// big music and sound files and reads them faster in one piece
+#define PREALLOCATE_MIN_SIZE (1024 * 1024)
+#define COPY_BUFFER_SIZE (1024 * 1024)
+#define COMPARE_BUFFER_SIZE (64 * 1024)
+
 bool _file_utils_is_dir(const char* path) {
 	return g_file_test(path, G_FILE_TEST_IS_DIR);
 }
 
-void _file_utils_copy_file(GFile* source, GFile* destination) {
+static PWML_Durability __file_utils_durability(_File_Utils_Context* context) {
+	return context ? context->durability : PWML_DURABILITY_NONE;
+}
+
+void _file_utils_count(_File_Utils_Context* context, bool success, guint64 bytes) {
+	if (!context || !context->counters)
+		return;
+
+	if (success) {
+		context->counters->files++;
+		context->counters->bytes += bytes;
+	} else {
+		context->counters->errors++;
+	}
+}
+
+static void __file_utils_copy_progress(goffset current, goffset total, gpointer size) {
+	(void)current;
+	*(goffset*)size = total;
+}
+
+// size is only filled in if it isn't NULL, so the progress callback costs nothing otherwise
+bool _file_utils_copy_file(GFile* source, GFile* destination, goffset* size) {
 	GError* error = NULL;
 	const char* destination_path = g_file_get_path(destination);
-	g_file_copy(source, destination, FLAGS, NULL, NULL, NULL, &error);
+	g_file_copy(source, destination, FLAGS, NULL, size ? __file_utils_copy_progress : NULL, size, &error);
+	bool success = !error;
 	if (error) {
 		g_printerr("Failed to copy file %s to %s: %s\n", g_file_get_path(source), g_file_get_path(destination), error->message);
 		g_error_free(error);
 	}
 	free((char*)destination_path);
+	return success;
 }
 
-void _file_utils_copy_file_with_path(const char* source, const char* destination) {
+static bool __file_utils_copy_file_with_path(const char* source, const char* destination, goffset* size) {
 	GFile* source_gfile = g_file_new_for_path(source);
 	GFile* destination_gfile = g_file_new_for_path(destination);
-	_file_utils_copy_file(source_gfile, destination_gfile);
+	bool success = _file_utils_copy_file(source_gfile, destination_gfile, size);
 	g_object_unref(source_gfile);
 	g_object_unref(destination_gfile);
+	return success;
+}
+
+bool _file_utils_copy_file_with_path(const char* source, const char* destination) {
+	return __file_utils_copy_file_with_path(source, destination, NULL);
+}
+
+static bool __file_utils_copy_data(int source_fd, int destination_fd, off_t size) {
+	// copy_file_range keeps the data in the kernel, read and write are for the filesystems it doesn't work between
+	off_t copied = 0;
+	ssize_t result = 0;
+	while (copied < size && (result = copy_file_range(source_fd, NULL, destination_fd, NULL, size - copied, 0)) > 0)
+		copied += result;
+	// 0 means the source got shorter since it was stat'ed
+	if (copied == size || result == 0)
+		return true;
+	if (copied > 0 || (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP))
+		return false;
+
+	char* buffer = malloc(COPY_BUFFER_SIZE);
+	bool success = true;
+	ssize_t length = 0;
+	while (success && (length = read(source_fd, buffer, COPY_BUFFER_SIZE)) > 0) {
+		for (ssize_t written = 0; written < length; written += result) {
+			result = write(destination_fd, buffer + written, length - written);
+			if (result < 0) {
+				success = false;
+				break;
+			}
+		}
+	}
+	if (length < 0)
+		success = false;
+	free(buffer);
+	return success;
+}
+
+// Best effort like the rest of the metadata, a filesystem without xattrs just gets none
+static void __file_utils_copy_xattrs(int source_fd, int destination_fd) {
+	ssize_t names_length = flistxattr(source_fd, NULL, 0);
+	if (names_length <= 0)
+		return;
+
+	char* names = malloc(names_length);
+	names_length = flistxattr(source_fd, names, names_length);
+	for (ssize_t offset = 0; offset < names_length; offset += strlen(names + offset) + 1) {
+		const char* name = names + offset;
+		ssize_t value_length = fgetxattr(source_fd, name, NULL, 0);
+		if (value_length < 0)
+			continue;
+		char* value = malloc(value_length + 1);
+		value_length = fgetxattr(source_fd, name, value, value_length);
+		if (value_length >= 0)
+			fsetxattr(destination_fd, name, value, value_length, 0);
+		free(value);
+	}
+	free(names);
+}
+
+// Takes source_fd. Big files get their blocks allocated before they are written.
+static bool __file_utils_copy_from_fd(int source_fd, const char* source, const char* destination, const struct stat* source_stat) {
+	posix_fadvise(source_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	// Never write through an existing file, it may be a hard link to a mod's own copy
+	unlink(destination);
+	int destination_fd = open(destination, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, source_stat->st_mode & 07777);
+	if (destination_fd == -1) {
+		g_printerr("Failed to create %s\n", destination);
+		close(source_fd);
+		return false;
+	}
+
+	// Filesystems without fallocate just get the file the way they always did
+	bool success = true;
+	// Of the call that failed, the metadata calls and closes after it may change errno
+	int saved_errno = 0;
+	if (source_stat->st_size >= PREALLOCATE_MIN_SIZE && fallocate(destination_fd, FALLOC_FL_KEEP_SIZE, 0, source_stat->st_size) != 0 && errno == ENOSPC) {
+		success = false;
+		saved_errno = errno;
+	}
+	if (success && !__file_utils_copy_data(source_fd, destination_fd, source_stat->st_size)) {
+		success = false;
+		saved_errno = errno;
+	}
+
+	if (success) {
+		// The same metadata g_file_copy would have kept, all of it best effort. Only root can hand the file to
+		// another owner but the group may still be kept. The chown goes first since it clears the setuid bits.
+		const struct timespec times[2] = { source_stat->st_atim, source_stat->st_mtim };
+		if (fchown(destination_fd, source_stat->st_uid, source_stat->st_gid) != 0 && fchown(destination_fd, -1, source_stat->st_gid) != 0) {
+			// Neither is worth failing the copy for
+		}
+		__file_utils_copy_xattrs(source_fd, destination_fd);
+		fchmod(destination_fd, source_stat->st_mode & 07777);
+		futimens(destination_fd, times);
+	}
+
+	if (close(destination_fd) != 0 && success) {
+		success = false;
+		saved_errno = errno;
+	}
+	close(source_fd);
+
+	if (!success) {
+		g_printerr("Failed to copy file %s to %s: %s\n", source, destination, g_strerror(saved_errno));
+		unlink(destination);
+	}
+	return success;
 }
 
 GPtrArray* _file_utils_list_files_in_directory(const char* path) {
@@ -51,19 +203,333 @@ GPtrArray* _file_utils_list_files_in_directory(const char* path) {
 	return files;
 }
 
-void _file_utils_copy_recursive(const char* source_path, const char* destination_path) {
+void _file_utils_copy_job_free(void* voidptr_job) {
+	_File_Utils_CopyJob* job = (_File_Utils_CopyJob*)voidptr_job;
+	free(job->source);
+	free(job->destination);
+	free(job);
+}
+
+// source_stat is what the collector already knows about source, NULL if nothing
+static _File_Utils_CopyJob* __file_utils_add_copy_job(GPtrArray* jobs, const char* source, const char* destination, const struct stat* source_stat) {
+	_File_Utils_CopyJob* job = malloc(sizeof(_File_Utils_CopyJob));
+	job->source = g_strdup(source);
+	job->destination = g_strdup(destination);
+	job->method = _FILE_UTILS_COPY;
+	job->device = source_stat ? source_stat->st_dev : 0;
+	job->inode = source_stat ? source_stat->st_ino : 0;
+	job->size = source_stat ? source_stat->st_size : 0;
+	job->folder = false;
+	g_ptr_array_add(jobs, job);
+	return job;
+}
+
+void _file_utils_add_copy_job(GPtrArray* jobs, const char* source, const char* destination) {
+	__file_utils_add_copy_job(jobs, source, destination, NULL);
+}
+
+bool _file_utils_copy_job(_File_Utils_Context* context, _File_Utils_CopyJob* job) {
+	return _file_utils_copy_job_from(context, job, -1);
+}
+
+bool _file_utils_copy_job_from(_File_Utils_Context* context, _File_Utils_CopyJob* job, int source_fd) {
+	goffset size = 0;
+	bool counting = context && context->counters;
+	bool success;
+	struct stat source_stat;
+	// Without a descriptor only big files are worth opening here, the rest is left to g_file_copy
+	if (source_fd == -1 && lstat(job->source, &source_stat) == 0 && S_ISREG(source_stat.st_mode) && source_stat.st_size >= PREALLOCATE_MIN_SIZE)
+		source_fd = open(job->source, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+
+	if (source_fd != -1 && fstat(source_fd, &source_stat) == 0 && S_ISREG(source_stat.st_mode)) {
+		success = __file_utils_copy_from_fd(source_fd, job->source, job->destination, &source_stat);
+		size = source_stat.st_size;
+	} else {
+		if (source_fd != -1)
+			close(source_fd);
+		success = __file_utils_copy_file_with_path(job->source, job->destination, counting ? &size : NULL);
+	}
+	if (success && __file_utils_durability(context) == PWML_DURABILITY_STRICT)
+		success = _file_utils_fsync_path(job->destination);
+	_file_utils_count(context, success, size);
+	return success;
+}
+
+static bool __file_utils_reflink(const char* source, const char* destination) {
+	int source_fd = open(source, O_RDONLY | O_CLOEXEC);
+	if (source_fd == -1)
+		return false;
+
+	struct stat source_stat;
+	if (fstat(source_fd, &source_stat) != 0 || !S_ISREG(source_stat.st_mode)) {
+		close(source_fd);
+		return false;
+	}
+
+	int destination_fd = open(destination, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, source_stat.st_mode & 07777);
+	if (destination_fd == -1) {
+		close(source_fd);
+		return false;
+	}
+
+	bool success = ioctl(destination_fd, FICLONE, source_fd) == 0;
+	if (success) {
+		// Same metadata a copy keeps
+		struct timespec times[2] = { source_stat.st_atim, source_stat.st_mtim };
+		fchmod(destination_fd, source_stat.st_mode & 07777);
+		futimens(destination_fd, times);
+	}
+
+	close(destination_fd);
+	close(source_fd);
+	if (!success)
+		unlink(destination);
+	return success;
+}
+
+static bool __file_utils_transfer(_File_Utils_CopyJob* job) {
+	switch (job->method) {
+	case _FILE_UTILS_LINK:
+		return link(job->source, job->destination) == 0;
+	case _FILE_UTILS_REFLINK:
+		return __file_utils_reflink(job->source, job->destination);
+	case _FILE_UTILS_MOVE:
+		return rename(job->source, job->destination) == 0;
+	default:
+		return false;
+	}
+}
+
+// Links, reflinks or moves every job that asks for it and returns the ones left to copy, jobs itself if there were none
+static GPtrArray* __file_utils_link_jobs(_File_Utils_Context* context, GPtrArray* jobs) {
+	GPtrArray* remaining = NULL;
+	for (uint i = 0; i < jobs->len; i++) {
+		_File_Utils_CopyJob* job = g_ptr_array_index(jobs, i);
+		if (job->method != _FILE_UTILS_COPY) {
+			// An earlier mod's file is overwritten like a copy would
+			unlink(job->destination);
+			if (__file_utils_transfer(job)) {
+				if (!remaining) {
+					remaining = g_ptr_array_new();
+					for (uint j = 0; j < i; j++)
+						g_ptr_array_add(remaining, g_ptr_array_index(jobs, j));
+				}
+				_file_utils_count(context, true, 0);
+				continue;
+			}
+		}
+		if (remaining)
+			g_ptr_array_add(remaining, job);
+	}
+	return remaining ? remaining : jobs;
+}
+
+// Creates the folder every destination goes in, each one once, and the folder jobs' destinations themselves.
+// Jobs of the same folder are mostly next to each other. Returns the jobs left to copy, jobs itself if there were no folder jobs.
+static GPtrArray* __file_utils_create_destination_folders(_File_Utils_Context* context, GPtrArray* jobs) {
+	GHashTable* created = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	GPtrArray* remaining = NULL;
+	char* last_folder = NULL;
+	for (uint i = 0; i < jobs->len; i++) {
+		_File_Utils_CopyJob* job = g_ptr_array_index(jobs, i);
+		if (job->folder) {
+			if (!remaining) {
+				remaining = g_ptr_array_new();
+				for (uint j = 0; j < i; j++)
+					g_ptr_array_add(remaining, g_ptr_array_index(jobs, j));
+			}
+			// Only a failure is counted, the folder isn't a file that was copied
+			if (g_mkdir_with_parents(job->destination, 0755) != 0)
+				_file_utils_count(context, false, 0);
+			continue;
+		}
+		if (remaining)
+			g_ptr_array_add(remaining, job);
+
+		char* folder = g_path_get_dirname(job->destination);
+		if ((last_folder && strcmp(folder, last_folder) == 0) || g_hash_table_contains(created, folder)) {
+			g_free(folder);
+			continue;
+		}
+		g_mkdir_with_parents(folder, 0755);
+		g_hash_table_add(created, folder);
+		last_folder = folder;
+	}
+	g_hash_table_destroy(created);
+	return remaining ? remaining : jobs;
+}
+
+void _file_utils_copy_jobs(_File_Utils_Context* context, GPtrArray* jobs) {
+	if (jobs->len == 0)
+		return;
+
+	GPtrArray* all_jobs = jobs;
+	GPtrArray* file_jobs = __file_utils_create_destination_folders(context, jobs);
+	jobs = __file_utils_link_jobs(context, file_jobs);
+	if (jobs != file_jobs && file_jobs != all_jobs)
+		g_ptr_array_free(file_jobs, true);
+	if (jobs->len == 0) {
+		if (jobs != all_jobs)
+			g_ptr_array_free(jobs, true);
+		return;
+	}
+
+	PWML_CopyOrder order = context ? context->order : PWML_COPY_ORDER_NONE;
+	if (!context || !context->presorted)
+		_schedule_utils_sort_jobs(order, jobs);
+
+	gint64 trace_start = _pwml_trace_begin();
+	if (!_uring_utils_copy_files(context, jobs)) {
+		_Schedule_Utils_Readahead readahead;
+		if (order != PWML_COPY_ORDER_NONE)
+			_schedule_utils_readahead_init(&readahead, jobs);
+		for (uint i = 0; i < jobs->len; i++) {
+			int source_fd = order != PWML_COPY_ORDER_NONE ? _schedule_utils_readahead_take(&readahead, i) : -1;
+			_file_utils_copy_job_from(context, g_ptr_array_index(jobs, i), source_fd);
+		}
+	}
+
+	if (trace_start) {
+		char* detail = g_strdup_printf("%u files from %s", jobs->len, ((_File_Utils_CopyJob*)g_ptr_array_index(jobs, 0))->source);
+		_pwml_trace_end("copy", "copy_batch", detail, trace_start);
+		free(detail);
+	}
+
+	if (jobs != all_jobs)
+		g_ptr_array_free(jobs, true);
+}
+
+typedef struct {
+	char* pattern;
+	// Starts with !, a path it matches is copied after all
+	bool negate;
+	// Ends with /
+	bool directory_only;
+	// Has a / before its end, matched against the path relative to the root instead of the name
+	bool anchored;
+} __File_Utils_Rule;
+
+static void __file_utils_rule_free(void* voidptr_rule) {
+	__File_Utils_Rule* rule = (__File_Utils_Rule*)voidptr_rule;
+	free(rule->pattern);
+	free(rule);
+}
+
+_File_Utils_Filter* _file_utils_filter_new(const char* root) {
+	_File_Utils_Filter* filter = malloc(sizeof(_File_Utils_Filter));
+	filter->root = strdup(root);
+	filter->root_length = strlen(root);
+	filter->rules = g_ptr_array_new_with_free_func(__file_utils_rule_free);
+	return filter;
+}
+
+void _file_utils_filter_free(_File_Utils_Filter* filter) {
+	if (!filter)
+		return;
+	g_ptr_array_free(filter->rules, true);
+	free(filter->root);
+	free(filter);
+}
+
+void _file_utils_filter_add_rule(_File_Utils_Filter* filter, const char* line) {
+	char* pattern = g_strstrip(strdup(line));
+	char* start = pattern;
+	if (*start == '\0' || *start == '#') {
+		free(pattern);
+		return;
+	}
+
+	__File_Utils_Rule* rule = malloc(sizeof(__File_Utils_Rule));
+	rule->negate = *start == '!';
+	if (rule->negate)
+		start++;
+
+	size_t length = strlen(start);
+	rule->directory_only = length > 0 && start[length - 1] == '/';
+	if (rule->directory_only)
+		start[length - 1] = '\0';
+
+	rule->anchored = strchr(start, '/') != NULL;
+	if (*start == '/')
+		start++;
+
+	if (*start == '\0') {
+		free(rule);
+		free(pattern);
+		return;
+	}
+
+	rule->pattern = strdup(start);
+	free(pattern);
+	g_ptr_array_add(filter->rules, rule);
+}
+
+bool _file_utils_filter_add_file(_File_Utils_Filter* filter, const char* path) {
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return errno == ENOENT;
+
+	char* line = NULL;
+	size_t capacity = 0;
+	while (getline(&line, &capacity, file) != -1) {
+		_file_utils_filter_add_rule(filter, line);
+	}
+	free(line);
+	fclose(file);
+	return true;
+}
+
+bool _file_utils_filter_excludes(const _File_Utils_Filter* filter, const char* path, bool is_dir) {
+	if (!filter)
+		return false;
+
+	const char* relative = NULL;
+	if (strncmp(path, filter->root, filter->root_length) == 0 && path[filter->root_length] == G_DIR_SEPARATOR)
+		relative = path + filter->root_length + 1;
+	const char* separator = strrchr(path, G_DIR_SEPARATOR);
+	const char* name = separator ? separator + 1 : path;
+
+	// The last rule that matches decides, like in a .gitignore
+	for (int i = filter->rules->len - 1; i >= 0; i--) {
+		const __File_Utils_Rule* rule = g_ptr_array_index(filter->rules, i);
+		if (rule->directory_only && !is_dir)
+			continue;
+
+		bool matches = rule->anchored
+			? relative && fnmatch(rule->pattern, relative, FNM_PATHNAME) == 0
+			: fnmatch(rule->pattern, name, 0) == 0;
+		if (matches)
+			return !rule->negate;
+	}
+	return false;
+}
+
+// Queues the files so they can be copied in one batch, nothing is written until they are.
+// Whatever filter excludes is skipped while walking, a directory it excludes isn't even listed.
+void _file_utils_collect_copy_jobs(const char* source_path, const char* destination_path, const _File_Utils_Filter* filter, GPtrArray* jobs) {
 	const char* base = g_path_get_basename(source_path);
+	// Kept in the jobs, so ordering the copies doesn't stat every source again
+	struct stat stat_buf;
+	bool stated = stat(source_path, &stat_buf) == 0;
+
+	if (stated && S_ISDIR(stat_buf.st_mode)) {
+		if (_file_utils_filter_excludes(filter, source_path, true)) {
+			free((char*)base);
+			return;
+		}
 
-	if (_file_utils_is_dir(source_path)) {
-		const char* temp = g_build_filename(destination_path, base, NULL);
-		g_mkdir_with_parents(temp, 0755);
-		free((char*)temp);
-		
 		GQueue* queued_files = g_queue_new();
 		g_queue_push_head(queued_files, strdup(source_path));
 
 		const char* current_path;
 		while ((current_path = g_queue_pop_head(queued_files))) {
+			stated = stat(current_path, &stat_buf) == 0;
+			bool is_dir = stated && S_ISDIR(stat_buf.st_mode);
+			if (strcmp(current_path, source_path) != 0 && _file_utils_filter_excludes(filter, current_path, is_dir)) {
+				free((char*)current_path);
+				continue;
+			}
+
 			uint source_path_len = strlen(source_path) - strlen(base);
 			uint diff = strlen(current_path) - source_path_len;
 
@@ -73,86 +539,62 @@ void _file_utils_copy_recursive(const char* source_path, const char* destination
 			
 			const char* file_destination = g_build_filename(destination_path, relative_path, NULL);
 
-			if (_file_utils_is_dir(current_path)) {
-				g_mkdir_with_parents(file_destination, 0755);
+			if (is_dir) {
 				GPtrArray* files = _file_utils_list_files_in_directory(current_path);
-				for (uint i = 0; i < files->len; i++) {
+				// Nothing else would create it
+				if (files && files->len == 0)
+					__file_utils_add_copy_job(jobs, current_path, file_destination, NULL)->folder = true;
+				for (uint i = 0; files && i < files->len; i++) {
 					char* file = g_ptr_array_index(files, i);
 					g_queue_push_head(queued_files, file);
 				}
 				// FIXME: No free? If you add free, then test because this place had problems before
 				// Nevermind it pushes it to queued_files which does free it
-				g_ptr_array_free(files, false);
+				if (files)
+					g_ptr_array_free(files, false);
 			} else {
-				_file_utils_copy_file_with_path(current_path, file_destination);
+				__file_utils_add_copy_job(jobs, current_path, file_destination, stated ? &stat_buf : NULL);
 			}
 
 			free((char*)file_destination);
 			free((char*)current_path);
 		}
 		g_queue_free(queued_files);
-	} else {
+	} else if (!_file_utils_filter_excludes(filter, source_path, false)) {
 		const char* destination_file_path = g_build_filename(destination_path, base, NULL);
-		_file_utils_copy_file_with_path(source_path, destination_file_path);
+		__file_utils_add_copy_job(jobs, source_path, destination_file_path, stated ? &stat_buf : NULL);
 		free((char*)destination_file_path);
 	}
 
 	free((char*)base);
 }
 
-void _file_utils_copy_all(const char *from, const char *to) {
-	GPtrArray* files = _file_utils_list_files_in_directory(from);
-	for (uint i = 0; i < files->len; i++) {
-		const char* path = g_ptr_array_index(files, i);
-		_file_utils_copy_recursive(path, to);
-	}
+void _file_utils_copy_recursive(_File_Utils_Context* context, const char* source_path, const char* destination_path) {
+	GPtrArray* jobs = g_ptr_array_new_with_free_func(_file_utils_copy_job_free);
+	_file_utils_collect_copy_jobs(source_path, destination_path, NULL, jobs);
+	_file_utils_copy_jobs(context, jobs);
+	g_ptr_array_free(jobs, true);
 }
 
-void _file_utils_copy_all_except(const char* from, const char* to, const char* ignore) {
+void _file_utils_collect_all(const char* from, const char* to, const _File_Utils_Filter* filter, GPtrArray* jobs) {
 	GPtrArray* files = _file_utils_list_files_in_directory(from);
 	for (uint i = 0; i < files->len; i++) {
-		const char* path = g_ptr_array_index(files, i);
-		const char* basename = g_path_get_basename(path);
-		if (strcmp(path, ignore) == 0 || strcmp(basename, ignore) == 0)
-			continue;
-		_file_utils_copy_recursive(path, to);
-		free((char*)path);
-		free((char*)basename);
+		_file_utils_collect_copy_jobs(g_ptr_array_index(files, i), to, filter, jobs);
 	}
+	g_ptr_array_free(files, true);
 }
 
-/*static void __debug_print_file_flags(const char* path) {
-	g_print("-- BEGIN FLAGS FOR FILE \"%s\" --\n", path);
-	if (g_file_test(path, G_FILE_TEST_EXISTS)) {
-		g_print("exists\n");
-	} else {
-		g_print("doesn't exist\n");
-	}
-	if (g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
-		g_print("regular\n");
-	} else {
-		g_print("not regular\n");
-	}
-	if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
-		g_print("directory\n");
-	} else {
-		g_print("not a directory\n");
-	}
-	if (g_file_test(path, G_FILE_TEST_IS_EXECUTABLE)) {
-		g_print("executable\n");
-	} else {
-		g_print("not an executable\n");
-	}
-	if (g_file_test(path, G_FILE_TEST_IS_SYMLINK)) {
-		g_print("symlink\n");
-	} else {
-		g_print("not a symlink\n");
-	}
-}*/
+void _file_utils_copy_all(_File_Utils_Context* context, const char *from, const char *to) {
+	GPtrArray* jobs = g_ptr_array_new_with_free_func(_file_utils_copy_job_free);
+	_file_utils_collect_all(from, to, NULL, jobs);
+	_file_utils_copy_jobs(context, jobs);
+	g_ptr_array_free(jobs, true);
+}
 
-void _file_utils_delete_recursive(const char* path) {
+// Queues every file and directory under path, directories in the order they have to be removed
+static void __file_utils_collect_delete(const char* path, GPtrArray* file_hitlist, GPtrArray* directory_hitlist) {
 	if (g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
-		remove(path);
+		g_ptr_array_add(file_hitlist, strdup(path));
 		return;
 	}
 	if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
@@ -160,8 +602,8 @@ void _file_utils_delete_recursive(const char* path) {
 		return;
 	}
 
-	GPtrArray* directory_hitlist = g_ptr_array_new();
-	g_ptr_array_add(directory_hitlist, strdup(path));
+	GPtrArray* directories = g_ptr_array_new();
+	g_ptr_array_add(directories, strdup(path));
 
 	GQueue* queue = g_queue_new();
 	g_queue_push_head(queue, strdup(path));
@@ -174,33 +616,338 @@ void _file_utils_delete_recursive(const char* path) {
 				const char* file = g_ptr_array_index(files, i);
 				if (_file_utils_is_dir(file)) {
 					g_queue_push_head(queue, strdup(file));
-					g_ptr_array_add(directory_hitlist, strdup(file));
+					g_ptr_array_add(directories, strdup(file));
 				} else {
-					remove(file);
+					g_ptr_array_add(file_hitlist, strdup(file));
 				}
-				free((char*)file);
 			}
+			g_ptr_array_free(files, true);
 		}
+		free((char*)current_path);
+	}
+
+	for (int i = directories->len - 1; i >= 0; i--) {
+		g_ptr_array_add(directory_hitlist, g_ptr_array_index(directories, i));
 	}
 
-	for (int i = directory_hitlist->len - 1; i >= 0; i--) {
+	g_ptr_array_free(directories, false);
+	g_queue_free(queue);
+}
+
+static void __file_utils_delete_hitlists(_File_Utils_Context* context, GPtrArray* file_hitlist, GPtrArray* directory_hitlist) {
+	if (!_uring_utils_unlink_files(context, file_hitlist)) {
+		for (uint i = 0; i < file_hitlist->len; i++)
+			_file_utils_count(context, remove(g_ptr_array_index(file_hitlist, i)) == 0, 0);
+	}
+
+	for (uint i = 0; i < directory_hitlist->len; i++) {
 		rmdir(g_ptr_array_index(directory_hitlist, i));
 	}
+}
+
+void _file_utils_delete_recursive(_File_Utils_Context* context, const char* path) {
+	GPtrArray* file_hitlist = g_ptr_array_new_with_free_func(free);
+	GPtrArray* directory_hitlist = g_ptr_array_new_with_free_func(free);
+
+	__file_utils_collect_delete(path, file_hitlist, directory_hitlist);
+	__file_utils_delete_hitlists(context, file_hitlist, directory_hitlist);
 
+	g_ptr_array_free(file_hitlist, true);
 	g_ptr_array_free(directory_hitlist, true);
-	g_queue_free(queue);
 }
 
-void _file_utils_delete_all(const char* path) {
+void _file_utils_delete_all(_File_Utils_Context* context, const char* path) {
+	_file_utils_delete_all_except(context, path, NULL);
+}
+
+void _file_utils_delete_all_except(_File_Utils_Context* context, const char* path, const char* ignore) {
 	if (!g_file_test(path, G_FILE_TEST_IS_DIR)) {
 		g_printerr("Cannot delete all from %s; No such directory exists.\n", path);
 		return;
 	}
 
+	GPtrArray* file_hitlist = g_ptr_array_new_with_free_func(free);
+	GPtrArray* directory_hitlist = g_ptr_array_new_with_free_func(free);
+
 	GPtrArray* files = _file_utils_list_files_in_directory(path);
 	for (uint i = 0; i < files->len; i++) {
 		const char* file = g_ptr_array_index(files, i);
-		_file_utils_delete_recursive(file);
+		if (ignore) {
+			const char* basename = g_path_get_basename(file);
+			bool ignored = strcmp(basename, ignore) == 0;
+			free((char*)basename);
+			if (ignored)
+				continue;
+		}
+		__file_utils_collect_delete(file, file_hitlist, directory_hitlist);
 	}
 	g_ptr_array_free(files, true);
+
+	__file_utils_delete_hitlists(context, file_hitlist, directory_hitlist);
+
+	g_ptr_array_free(file_hitlist, true);
+	g_ptr_array_free(directory_hitlist, true);
+}
+
+// Whether the first extent of the file is shared with another file, as a reflink's are
+static bool __file_utils_is_shared(const char* path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+
+	// Room for the header and the first extent only
+	guint64 buffer[(sizeof(struct fiemap) + sizeof(struct fiemap_extent)) / sizeof(guint64) + 1];
+	memset(buffer, 0, sizeof(buffer));
+	struct fiemap* map = (struct fiemap*)buffer;
+	map->fm_length = FIEMAP_MAX_OFFSET;
+	map->fm_extent_count = 1;
+	bool shared = ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0 && (map->fm_extents[0].fe_flags & FIEMAP_EXTENT_SHARED);
+	close(fd);
+	return shared;
+}
+
+guint64 _file_utils_reclaimable_size(const char* path) {
+	guint64 total = 0;
+	GQueue* queue = g_queue_new();
+	g_queue_push_head(queue, strdup(path));
+
+	char* current_path;
+	while ((current_path = g_queue_pop_head(queue))) {
+		struct stat stat_buf;
+		if (lstat(current_path, &stat_buf) == 0) {
+			if (S_ISREG(stat_buf.st_mode)) {
+				// Another link or a reflink still holds the blocks after the delete
+				if (stat_buf.st_nlink == 1 && stat_buf.st_blocks > 0 && !__file_utils_is_shared(current_path))
+					total += stat_buf.st_size;
+			} else if (S_ISDIR(stat_buf.st_mode)) {
+				GDir* dir = g_dir_open(current_path, 0, NULL);
+				const char* entry;
+				while (dir && (entry = g_dir_read_name(dir)))
+					g_queue_push_head(queue, g_build_filename(current_path, entry, NULL));
+				if (dir)
+					g_dir_close(dir);
+			}
+		}
+		free(current_path);
+	}
+
+	g_queue_free(queue);
+	return total;
+}
+
+bool _file_utils_get_free_space(const char* path, guint64* bytes) {
+	struct statvfs stat_buf;
+	if (statvfs(path, &stat_buf) != 0) {
+		g_printerr("Failed to statvfs %s\n", path);
+		return false;
+	}
+	*bytes = (guint64)stat_buf.f_bavail * stat_buf.f_frsize;
+	return true;
+}
+
+bool _file_utils_fsync_path(const char* path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		g_printerr("Failed to open %s for fsync\n", path);
+		return false;
+	}
+	bool success = fsync(fd) == 0;
+	if (!success)
+		g_printerr("Failed to fsync %s\n", path);
+	close(fd);
+	return success;
+}
+
+bool _file_utils_sync_filesystem(_File_Utils_Context* context, const char* path) {
+	if (__file_utils_durability(context) != PWML_DURABILITY_BATCHED)
+		return true;
+
+	gint64 trace_start = _pwml_trace_begin();
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		g_printerr("Failed to open %s for syncfs\n", path);
+		return false;
+	}
+	bool success = syncfs(fd) == 0;
+	if (!success)
+		g_printerr("Failed to sync the filesystem of %s\n", path);
+	close(fd);
+	_pwml_trace_end("io", "syncfs", path, trace_start);
+	return success;
+}
+
+bool _file_utils_parse_durability(const char* name, PWML_Durability* durability) {
+	if (g_str_equal(name, "none"))
+		*durability = PWML_DURABILITY_NONE;
+	else if (g_str_equal(name, "batched"))
+		*durability = PWML_DURABILITY_BATCHED;
+	else if (g_str_equal(name, "strict"))
+		*durability = PWML_DURABILITY_STRICT;
+	else
+		return false;
+	return true;
+}
+
+// A rename is only durable once the folder holding the new name is synced too
+static bool __file_utils_fsync_parent(const char* path) {
+	char* folder = g_path_get_dirname(path);
+	bool success = _file_utils_fsync_path(folder);
+	g_free(folder);
+	return success;
+}
+
+static bool __file_utils_write_all(int fd, const char* data, gsize length) {
+	for (gsize written = 0; written < length;) {
+		ssize_t result = write(fd, data + written, length - written);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		written += result;
+	}
+	return true;
+}
+
+bool _file_utils_set_contents(_File_Utils_Context* context, const char* path, const char* data, gssize length, GError** error) {
+	// Always replaced by a rename so a crash never leaves half a file. Only strict pays for fsyncs, g_file_set_contents
+	// would also fsync every file that replaces a non-empty one.
+	bool strict = __file_utils_durability(context) == PWML_DURABILITY_STRICT;
+	gsize size = length < 0 ? strlen(data) : (gsize)length;
+	char* temp_path = g_strconcat(path, ".XXXXXX", NULL);
+	int fd = g_mkstemp_full(temp_path, O_WRONLY | O_CLOEXEC, 0666);
+	if (fd == -1) {
+		int saved_errno = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno), "Failed to create %s: %s", temp_path, g_strerror(saved_errno));
+		g_free(temp_path);
+		return false;
+	}
+
+	bool success = __file_utils_write_all(fd, data, size) && (!strict || fsync(fd) == 0);
+	int saved_errno = errno;
+	if (close(fd) != 0 && success) {
+		success = false;
+		saved_errno = errno;
+	}
+	if (success && rename(temp_path, path) != 0) {
+		success = false;
+		saved_errno = errno;
+	}
+
+	if (!success) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno), "Failed to write %s: %s", path, g_strerror(saved_errno));
+		unlink(temp_path);
+	} else if (strict && !__file_utils_fsync_parent(path)) {
+		g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_IO, "Failed to sync the folder of %s", path);
+		success = false;
+	}
+	g_free(temp_path);
+	return success;
+}
+
+bool _file_utils_write_if_changed(_File_Utils_Context* context, const char* path, const char* data, gsize length, bool* written) {
+	char* contents;
+	gsize contents_length;
+	if (g_file_get_contents(path, &contents, &contents_length, NULL)) {
+		bool same = contents_length == length && memcmp(contents, data, length) == 0;
+		free(contents);
+		if (same) {
+			*written = false;
+			return true;
+		}
+	}
+
+	GError* error = NULL;
+	_file_utils_set_contents(context, path, data, length, &error);
+	if (error) {
+		g_printerr("Failed to write %s\nGError: %s\n", path, error->message);
+		g_error_free(error);
+		*written = false;
+		return false;
+	}
+
+	*written = true;
+	return true;
+}
+
+// Reads until length bytes are in or the file ends, returns how many were read or -1
+static ssize_t __file_utils_read_full(int fd, char* buffer, gsize length) {
+	gsize total = 0;
+	while (total < length) {
+		ssize_t result = read(fd, buffer + total, length - total);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (result == 0)
+			break;
+		total += result;
+	}
+	return total;
+}
+
+// Compared a chunk at a time so neither file has to fit in memory. Files of different sizes are told apart by
+// their stat alone. A path that can't be read counts as different.
+static bool __file_utils_same_contents(int new_fd, const char* path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+
+	struct stat new_stat, old_stat;
+	if (fstat(new_fd, &new_stat) != 0 || fstat(fd, &old_stat) != 0 || new_stat.st_size != old_stat.st_size) {
+		close(fd);
+		return false;
+	}
+
+	char* buffer = malloc(COMPARE_BUFFER_SIZE * 2);
+	char* new_buffer = buffer + COMPARE_BUFFER_SIZE;
+	bool same = true;
+	while (same) {
+		ssize_t new_length = __file_utils_read_full(new_fd, new_buffer, COMPARE_BUFFER_SIZE);
+		ssize_t length = __file_utils_read_full(fd, buffer, COMPARE_BUFFER_SIZE);
+		if (new_length < 0 || length != new_length) {
+			same = false;
+		} else {
+			same = memcmp(buffer, new_buffer, length) == 0;
+			if (length < COMPARE_BUFFER_SIZE)
+				break;
+		}
+	}
+	free(buffer);
+	close(fd);
+	return same;
+}
+
+bool _file_utils_replace_if_changed(_File_Utils_Context* context, const char* new_path, const char* path, bool* replaced) {
+	int new_fd = open(new_path, O_RDONLY | O_CLOEXEC);
+	if (new_fd == -1) {
+		g_printerr("Failed to read %s\nError: %s\n", new_path, g_strerror(errno));
+		*replaced = false;
+		return false;
+	}
+	bool same = __file_utils_same_contents(new_fd, path);
+	close(new_fd);
+
+	if (same) {
+		remove(new_path);
+		*replaced = false;
+		return true;
+	}
+
+	if (__file_utils_durability(context) == PWML_DURABILITY_STRICT && !_file_utils_fsync_path(new_path)) {
+		remove(new_path);
+		*replaced = false;
+		return false;
+	}
+
+	if (rename(new_path, path) != 0) {
+		g_printerr("Failed to move %s to %s\n", new_path, path);
+		remove(new_path);
+		*replaced = false;
+		return false;
+	}
+
+	*replaced = true;
+	return __file_utils_durability(context) != PWML_DURABILITY_STRICT || __file_utils_fsync_parent(path);
 }
@@ -0,0 +1,58 @@
+#include "PWML/hash.h"
+#include <glib.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef PWML_HAVE_XXHASH
+#include <xxhash.h>
+#define HASH_PREFIX "xxh3:"
+#else
+#define HASH_PREFIX "md5:"
+#endif
+
+#define HASH_BUFFER_SIZE (1024 * 1024)
+
+char* _pwml_hash_file(const char* path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+#ifdef PWML_HAVE_XXHASH
+	XXH3_state_t* state = XXH3_createState();
+	XXH3_64bits_reset(state);
+#else
+	GChecksum* checksum = g_checksum_new(G_CHECKSUM_MD5);
+#endif
+
+	char* buffer = malloc(HASH_BUFFER_SIZE);
+	ssize_t length;
+	while ((length = read(fd, buffer, HASH_BUFFER_SIZE)) > 0) {
+#ifdef PWML_HAVE_XXHASH
+		XXH3_64bits_update(state, buffer, length);
+#else
+		g_checksum_update(checksum, (const guchar*)buffer, length);
+#endif
+	}
+	free(buffer);
+	close(fd);
+
+	char* digest = NULL;
+#ifdef PWML_HAVE_XXHASH
+	if (length == 0)
+		digest = g_strdup_printf(HASH_PREFIX "%016" G_GINT64_MODIFIER "x", (guint64)XXH3_64bits_digest(state));
+	XXH3_freeState(state);
+#else
+	if (length == 0)
+		digest = g_strconcat(HASH_PREFIX, g_checksum_get_string(checksum), NULL);
+	g_checksum_free(checksum);
+#endif
+	return digest;
+}
+
+bool _pwml_hash_is_current(const char* digest) {
+	return digest && g_str_has_prefix(digest, HASH_PREFIX);
+}
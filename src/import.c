@@ -0,0 +1,346 @@
+#include "PWML/import.h"
+#include "PWML/file_utils.h"
+#include "PWML/hash.h"
+#include "PWML/index.h"
+#include "PWML/json_utils.h"
+#include "PWML/mod.h"
+#include "PWML/pwml.h"
+#include "PWML/trace.h"
+#include "PWML/weapon.h"
+#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <json-c/json_object.h>
+#include <libxml/parser.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+	_File_Utils_CopyJob* job;
+	// Of the source, NULL if it couldn't be read
+	char* digest;
+	// The source's, stat'ed before it was hashed
+	struct stat stat_buf;
+	bool valid;
+} __PWML_ImportTask;
+
+static void __pwml_import_task_free(void* voidptr_task) {
+	__PWML_ImportTask* task = (__PWML_ImportTask*)voidptr_task;
+	free(task->digest);
+	free(task);
+}
+
+// Parses the json and xml PWML or the game reads and hashes every file, from any thread
+static void __pwml_import_validate_task(gpointer data, gpointer user_data) {
+	(void)user_data;
+	__PWML_ImportTask* task = (__PWML_ImportTask*)data;
+	const char* source = task->job->source;
+
+	task->valid = true;
+	if (g_str_has_suffix(source, ".json")) {
+		json_object* root = _json_utils_load(source, NULL);
+		task->valid = root != NULL;
+		json_object_put(root);
+	} else if (g_str_has_suffix(source, ".xml")) {
+		xmlDocPtr doc = xmlReadFile(source, NULL, XML_PARSE_NONET);
+		if (!doc)
+			g_printerr("Failed to parse xml file %s\n", source);
+		task->valid = doc != NULL;
+		xmlFreeDoc(doc);
+	}
+
+	// A change after this shows in the size or mtime, which are checked again once the file is transferred
+	if (lstat(source, &task->stat_buf) == 0)
+		task->digest = _pwml_hash_file(source);
+	if (!task->digest)
+		g_printerr("Failed to read %s\n", source);
+}
+
+// vanilla is the game's own files, captured by pwml_new
+static bool __pwml_import_is_valid_id(const char* id) {
+	return id[0] != '\0' && id[0] != '.' && !strchr(id, G_DIR_SEPARATOR) && !g_str_equal(id, "vanilla");
+}
+
+// What g_mkdtemp_full makes of ".<id>.XXXXXX"
+static bool __pwml_import_is_staging_name(const char* name) {
+	const char* suffix = strrchr(name, '.');
+	if (name[0] != '.' || suffix == name || strlen(suffix + 1) != 6)
+		return false;
+	for (const char* c = suffix + 1; *c; c++) {
+		if (!g_ascii_isalnum(*c))
+			return false;
+	}
+	return true;
+}
+
+// An import holds its staging folder's lock until it is done, so a folder that can be locked was left behind
+// by one that crashed. -1 if path can't be opened or another import holds it.
+static int __pwml_import_lock_staging(const char* path) {
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd != -1 && flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void __pwml_import_sweep_staging(PWML* pwml) {
+	GDir* dir = g_dir_open(pwml->mods_path, 0, NULL);
+	if (!dir)
+		return;
+
+	const char* name;
+	while ((name = g_dir_read_name(dir))) {
+		if (!__pwml_import_is_staging_name(name))
+			continue;
+		char* path = g_build_filename(pwml->mods_path, name, NULL);
+		int fd = __pwml_import_lock_staging(path);
+		if (fd != -1) {
+			_file_utils_delete_recursive(NULL, path);
+			close(fd);
+		}
+		free(path);
+	}
+	g_dir_close(dir);
+}
+
+static gint64 __pwml_import_mtime(const struct stat* stat_buf) {
+	return (gint64)stat_buf->st_mtim.tv_sec * 1000000000 + stat_buf->st_mtim.tv_nsec;
+}
+
+// Hashes and parses the files on all cores, false if a file can't be read or doesn't parse
+static bool __pwml_import_validate(GPtrArray* tasks, PWML_ImportResult* result) {
+	gint64 trace_start = _pwml_trace_begin();
+
+	// libxml2 has to be initialised before it is used from more than one thread
+	xmlInitParser();
+	GThreadPool* pool = g_thread_pool_new(__pwml_import_validate_task, NULL, g_get_num_processors(), true, NULL);
+	for (uint i = 0; i < tasks->len; i++) {
+		g_thread_pool_push(pool, g_ptr_array_index(tasks, i), NULL);
+	}
+	// Waits for every task
+	g_thread_pool_free(pool, false, true);
+
+	bool valid = true;
+	for (uint i = 0; i < tasks->len; i++) {
+		__PWML_ImportTask* task = g_ptr_array_index(tasks, i);
+		if (!task->valid)
+			result->invalid++;
+		if (!task->valid || !task->digest)
+			valid = false;
+	}
+
+	_pwml_trace_end("import", "validate", NULL, trace_start);
+	return valid;
+}
+
+// The weapons source_path adds, NULL if it has no valid metadata or a weapon can't be read
+static GPtrArray* __pwml_import_read_mod(const char* source_path) {
+	json_object *name, *short_description;
+	bool missing;
+	json_object* metadata = _pwml_mod_read_metadata(source_path, &missing, &name, &short_description);
+	if (!metadata) {
+		if (missing)
+			g_printerr("%s has no %s, it isn't a mod\n", source_path, PWML_METADATA_JSON);
+		return NULL;
+	}
+	json_object_put(metadata);
+
+	const char* weapons_path = g_build_filename(source_path, PWML_MOD_DATA_FOLDER, PWML_WEAPONS_FOLDER, NULL);
+	bool has_weapons = g_file_test(weapons_path, G_FILE_TEST_IS_DIR);
+	free((char*)weapons_path);
+	if (!has_weapons)
+		return g_ptr_array_new_with_free_func(_pwml_weapon_free);
+
+	_File_Utils_Counters counters = { 0 };
+	GPtrArray* weapons = _pwml_mod_scan_weapons(source_path, &counters);
+	if (counters.errors > 0) {
+		g_ptr_array_free(weapons, true);
+		return NULL;
+	}
+	return weapons;
+}
+
+// Whether the source of task still has the size and mtime it had when it was hashed, so the transferred file
+// has the contents of the digest. A moved source is the transferred file now.
+static bool __pwml_import_is_unchanged(__PWML_ImportTask* task, PWML_CaptureMode mode) {
+	struct stat stat_buf;
+	const char* path = mode == PWML_CAPTURE_MOVE ? task->job->destination : task->job->source;
+	if (lstat(path, &stat_buf) != 0 || stat_buf.st_size != task->stat_buf.st_size
+		|| __pwml_import_mtime(&stat_buf) != __pwml_import_mtime(&task->stat_buf)) {
+		g_printerr("%s changed while it was imported\n", task->job->source);
+		return false;
+	}
+	return true;
+}
+
+// What the transfer put in staging_path, with the digests the validation made of the sources.
+// NULL if a source changed since it was hashed.
+static _PWML_Index* __pwml_import_build_index(GPtrArray* tasks, GPtrArray* weapons, const char* staging_path, PWML_CaptureMode mode) {
+	_PWML_Index* index = _pwml_index_new();
+	size_t staging_length = strlen(staging_path);
+	for (uint i = 0; i < tasks->len; i++) {
+		__PWML_ImportTask* task = g_ptr_array_index(tasks, i);
+		if (!__pwml_import_is_unchanged(task, mode)) {
+			_pwml_index_free(index);
+			return NULL;
+		}
+		struct stat stat_buf;
+		if (lstat(task->job->destination, &stat_buf) != 0)
+			continue;
+		_pwml_index_add_file(index, task->job->destination + staging_length + 1, task->digest, stat_buf.st_size, __pwml_import_mtime(&stat_buf));
+		// The index has it now
+		task->digest = NULL;
+	}
+
+	for (uint i = 0; i < weapons->len; i++) {
+		g_ptr_array_add(index->weapons, _pwml_weapon_copy(g_ptr_array_index(weapons, i)));
+	}
+
+	const char* weapons_path = g_build_filename(staging_path, PWML_MOD_DATA_FOLDER, PWML_WEAPONS_FOLDER, NULL);
+	struct stat stat_buf;
+	if (stat(weapons_path, &stat_buf) == 0)
+		index->weapons_mtime = __pwml_import_mtime(&stat_buf);
+	free((char*)weapons_path);
+
+	return index;
+}
+
+bool pwml_import_mod(PWML* pwml, const char* source_path, const char* id, PWML_CaptureMode mode, PWML_ImportResult* result) {
+	memset(result, 0, sizeof(PWML_ImportResult));
+
+	if (!_file_utils_is_dir(source_path)) {
+		g_printerr("Cannot import %s; Not a directory.\n", source_path);
+		return false;
+	}
+
+	char* mod_id = id ? strdup(id) : g_path_get_basename(source_path);
+	if (!__pwml_import_is_valid_id(mod_id)) {
+		g_printerr("Invalid mod id %s\n", mod_id);
+		free(mod_id);
+		return false;
+	}
+
+	__pwml_import_sweep_staging(pwml);
+
+	const char* mod_path = g_build_filename(pwml->mods_path, mod_id, NULL);
+	if (g_file_test(mod_path, G_FILE_TEST_EXISTS)) {
+		g_printerr("Mod %s already exists\n", mod_id);
+		free((char*)mod_path);
+		free(mod_id);
+		return false;
+	}
+
+	// Hidden so pwml_load_mods doesn't pick up a half imported mod, unique so imports don't share it
+	char* staging_path = g_strdup_printf("%s%c.%s.XXXXXX", pwml->mods_path, G_DIR_SEPARATOR, mod_id);
+	if (!g_mkdtemp_full(staging_path, 0755)) {
+		g_printerr("Failed to create %s\n", staging_path);
+		free(staging_path);
+		free((char*)mod_path);
+		free(mod_id);
+		return false;
+	}
+	// Only fails if another sweep got to the folder first, which can only happen to a stale one
+	int staging_fd = __pwml_import_lock_staging(staging_path);
+	if (staging_fd == -1) {
+		g_printerr("Failed to lock %s\n", staging_path);
+		free(staging_path);
+		free((char*)mod_path);
+		free(mod_id);
+		return false;
+	}
+
+	gint64 import_start = _pwml_trace_begin();
+	_File_Utils_Counters counters = { 0 };
+	_File_Utils_Context context = { .counters = &counters, .order = pwml->copy_order, .durability = pwml->durability };
+
+	// An index the source brought along describes another copy of the mod
+	_File_Utils_Filter* filter = _file_utils_filter_new(source_path);
+	const char* index_rule = g_build_filename(G_DIR_SEPARATOR_S, PWML_MOD_INDEX_JSON, NULL);
+	_file_utils_filter_add_rule(filter, index_rule);
+	free((char*)index_rule);
+
+	GPtrArray* jobs = g_ptr_array_new_with_free_func(_file_utils_copy_job_free);
+	_file_utils_collect_all(source_path, staging_path, filter, jobs);
+	_file_utils_filter_free(filter);
+
+	GPtrArray* tasks = g_ptr_array_new_full(jobs->len, __pwml_import_task_free);
+	for (uint i = 0; i < jobs->len; i++) {
+		// Empty folders have nothing to validate or index
+		if (((_File_Utils_CopyJob*)g_ptr_array_index(jobs, i))->folder)
+			continue;
+		__PWML_ImportTask* task = calloc(1, sizeof(__PWML_ImportTask));
+		task->job = g_ptr_array_index(jobs, i);
+		g_ptr_array_add(tasks, task);
+	}
+
+	GPtrArray* weapons = NULL;
+	bool imported = false;
+	// Nothing has been transferred yet, a rejected mod is left as it was
+	if (!__pwml_import_validate(tasks, result) || !(weapons = __pwml_import_read_mod(source_path))) {
+		g_printerr("Rejected mod %s\n", source_path);
+		_file_utils_delete_recursive(NULL, staging_path);
+		goto cleanup;
+	}
+
+	gint64 trace_start = _pwml_trace_begin();
+	for (uint i = 0; i < jobs->len; i++) {
+		((_File_Utils_CopyJob*)g_ptr_array_index(jobs, i))->method = _pwml_resource_get_capture_method(mode);
+	}
+	_file_utils_copy_jobs(&context, jobs);
+	_pwml_trace_end("import", "transfer", mod_id, trace_start);
+	result->files = counters.files;
+	result->bytes = counters.bytes;
+
+	_PWML_Index* index = counters.errors == 0 ? __pwml_import_build_index(tasks, weapons, staging_path, mode) : NULL;
+	if (!index) {
+		// Moved files only exist in the staging folder now, which is renamed so no sweep takes it for a stale one
+		if (mode == PWML_CAPTURE_MOVE) {
+			char* kept_path = g_strconcat(staging_path, ".moved", NULL);
+			g_printerr("Failed to import %s, what was moved is in %s\n", source_path, g_rename(staging_path, kept_path) == 0 ? kept_path : staging_path);
+			free(kept_path);
+		} else {
+			g_printerr("Failed to import %s\n", source_path);
+			_file_utils_delete_recursive(NULL, staging_path);
+		}
+		goto cleanup;
+	}
+
+	_pwml_index_save(index, staging_path, &context);
+	_pwml_index_free(index);
+	_file_utils_sync_filesystem(&context, staging_path);
+
+	if (g_rename(staging_path, mod_path) != 0) {
+		g_printerr("Failed to move %s to %s: %s\n", staging_path, mod_path, g_strerror(errno));
+		if (mode == PWML_CAPTURE_MOVE) {
+			char* kept_path = g_strconcat(staging_path, ".moved", NULL);
+			g_rename(staging_path, kept_path);
+			free(kept_path);
+		} else {
+			_file_utils_delete_recursive(NULL, staging_path);
+		}
+		goto cleanup;
+	}
+	imported = true;
+
+cleanup:
+	close(staging_fd);
+	if (weapons)
+		g_ptr_array_free(weapons, true);
+	g_ptr_array_free(tasks, true);
+	g_ptr_array_free(jobs, true);
+	_pwml_trace_end("import", "pwml_import_mod", mod_id, import_start);
+	free(staging_path);
+	free((char*)mod_path);
+	free(mod_id);
+
+	if (imported)
+		pwml_load_mods(pwml);
+	_pwml_trace_flush();
+	return imported;
+}
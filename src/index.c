@@ -0,0 +1,206 @@
+#include "PWML/index.h"
+#include "PWML/file_utils.h"
+#include "PWML/json_utils.h"
+#include "PWML/pwml.h"
+#include "PWML/weapon.h"
+#include <glib.h>
+#include <json-c/json_object.h>
+#include <json-c/json_types.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+const char* const PWML_MOD_INDEX_JSON = ".pwml_index.json";
+
+// Indexes of another version are ignored, the mod is treated as if it had none
+#define INDEX_VERSION 1
+
+static void __pwml_index_file_free(void* voidptr_file) {
+	_PWML_IndexFile* file = (_PWML_IndexFile*)voidptr_file;
+	free(file->digest);
+	free(file);
+}
+
+_PWML_Index* _pwml_index_new(void) {
+	_PWML_Index* index = malloc(sizeof(_PWML_Index));
+	index->files = g_hash_table_new_full(g_str_hash, g_str_equal, free, __pwml_index_file_free);
+	index->weapons = g_ptr_array_new_with_free_func(_pwml_weapon_free);
+	index->weapons_mtime = 0;
+	return index;
+}
+
+void _pwml_index_free(_PWML_Index* index) {
+	if (!index)
+		return;
+	g_hash_table_destroy(index->files);
+	g_ptr_array_free(index->weapons, true);
+	free(index);
+}
+
+void _pwml_index_add_file(_PWML_Index* index, const char* relative_path, char* digest, gint64 size, gint64 mtime) {
+	_PWML_IndexFile* file = malloc(sizeof(_PWML_IndexFile));
+	file->digest = digest;
+	file->size = size;
+	file->mtime = mtime;
+	g_hash_table_insert(index->files, strdup(relative_path), file);
+}
+
+static gint64 __pwml_index_mtime(const struct stat* stat_buf) {
+	return (gint64)stat_buf->st_mtim.tv_sec * 1000000000 + stat_buf->st_mtim.tv_nsec;
+}
+
+_PWML_Index* _pwml_index_load(const char* mod_path) {
+	json_object *version, *files, *weapons, *weapons_mtime;
+	const _JSON_Utils_Field fields[] = {
+		{ "version", json_type_int, &version, false },
+		{ "files", json_type_object, &files, false },
+		{ "weapons", json_type_array, &weapons, false },
+		{ "weapons_mtime", json_type_int, &weapons_mtime, false },
+	};
+
+	const char* json_path = g_build_filename(mod_path, PWML_MOD_INDEX_JSON, NULL);
+	bool missing;
+	json_object* root = _json_utils_load_fields(json_path, &missing, fields, G_N_ELEMENTS(fields));
+	if (!root || json_object_get_int(version) != INDEX_VERSION) {
+		json_object_put(root);
+		free((char*)json_path);
+		return NULL;
+	}
+
+	_PWML_Index* index = _pwml_index_new();
+	index->weapons_mtime = json_object_get_int64(weapons_mtime);
+
+	json_object_object_foreach(files, key, j_file) {
+		json_object *digest, *size, *mtime;
+		const _JSON_Utils_Field file_fields[] = {
+			{ "digest", json_type_string, &digest, false },
+			{ "size", json_type_int, &size, false },
+			{ "mtime", json_type_int, &mtime, false },
+		};
+		if (_json_utils_get_fields(j_file, json_path, file_fields, G_N_ELEMENTS(file_fields)))
+			_pwml_index_add_file(index, key, strdup(json_object_get_string(digest)), json_object_get_int64(size), json_object_get_int64(mtime));
+	}
+
+	uint len = json_object_array_length(weapons);
+	for (uint i = 0; i < len; i++) {
+		json_object *name, *ship, *pilot, *built_in;
+		const _JSON_Utils_Field weapon_fields[] = {
+			{ "name", json_type_string, &name, false },
+			{ "ship", json_type_boolean, &ship, false },
+			{ "pilot", json_type_boolean, &pilot, false },
+			{ "built_in", json_type_boolean, &built_in, false },
+		};
+		if (!_json_utils_get_fields(json_object_array_get_idx(weapons, i), json_path, weapon_fields, G_N_ELEMENTS(weapon_fields)))
+			continue;
+
+		_PWML_Weapon* weapon = malloc(sizeof(_PWML_Weapon));
+		weapon->name = strdup(json_object_get_string(name));
+		weapon->ship = json_object_get_boolean(ship);
+		weapon->pilot = json_object_get_boolean(pilot);
+		weapon->has_built_in_files = json_object_get_boolean(built_in);
+		g_ptr_array_add(index->weapons, weapon);
+	}
+
+	json_object_put(root);
+	free((char*)json_path);
+	return index;
+}
+
+bool _pwml_index_save(_PWML_Index* index, const char* mod_path, _File_Utils_Context* context) {
+	json_object* root = json_object_new_object();
+	json_object_object_add(root, "version", json_object_new_int(INDEX_VERSION));
+	json_object_object_add(root, "weapons_mtime", json_object_new_int64(index->weapons_mtime));
+
+	json_object* files = json_object_new_object();
+	GHashTableIter iter;
+	g_hash_table_iter_init(&iter, index->files);
+
+	const char* relative_path;
+	_PWML_IndexFile* file;
+	while (g_hash_table_iter_next(&iter, (void**)&relative_path, (void**)&file)) {
+		json_object* j_file = json_object_new_object();
+		json_object_object_add(j_file, "digest", json_object_new_string(file->digest));
+		json_object_object_add(j_file, "size", json_object_new_int64(file->size));
+		json_object_object_add(j_file, "mtime", json_object_new_int64(file->mtime));
+		json_object_object_add(files, relative_path, j_file);
+	}
+	json_object_object_add(root, "files", files);
+
+	json_object* weapons = json_object_new_array();
+	for (uint i = 0; i < index->weapons->len; i++) {
+		_PWML_Weapon* weapon = g_ptr_array_index(index->weapons, i);
+		json_object* j_weapon = json_object_new_object();
+		json_object_object_add(j_weapon, "name", json_object_new_string(weapon->name));
+		json_object_object_add(j_weapon, "ship", json_object_new_boolean(weapon->ship));
+		json_object_object_add(j_weapon, "pilot", json_object_new_boolean(weapon->pilot));
+		json_object_object_add(j_weapon, "built_in", json_object_new_boolean(weapon->has_built_in_files));
+		json_object_array_add(weapons, j_weapon);
+	}
+	json_object_object_add(root, "weapons", weapons);
+
+	const char* json_path = g_build_filename(mod_path, PWML_MOD_INDEX_JSON, NULL);
+	GError* error = NULL;
+	_file_utils_set_contents(context, json_path, json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN), -1, &error);
+	json_object_put(root);
+
+	bool saved = !error;
+	if (error) {
+		g_printerr("Failed to write %s\nGError: %s\n", json_path, error->message);
+		g_error_free(error);
+	}
+	free((char*)json_path);
+	return saved;
+}
+
+// Also true for a file that wasn't there at the import and still isn't
+static bool __pwml_index_file_is_fresh(_PWML_Index* index, const char* mod_path, const char* relative_path) {
+	_PWML_IndexFile* file = g_hash_table_lookup(index->files, relative_path);
+	const char* path = g_build_filename(mod_path, relative_path, NULL);
+	struct stat stat_buf;
+	bool exists = lstat(path, &stat_buf) == 0;
+	free((char*)path);
+
+	if (!file)
+		return !exists;
+	return exists && stat_buf.st_size == file->size && __pwml_index_mtime(&stat_buf) == file->mtime;
+}
+
+GPtrArray* _pwml_index_get_weapons(_PWML_Index* index, const char* mod_path) {
+	const char* weapons_path = g_build_filename(mod_path, PWML_MOD_DATA_FOLDER, PWML_WEAPONS_FOLDER, NULL);
+	struct stat stat_buf;
+	bool fresh = stat(weapons_path, &stat_buf) == 0 && __pwml_index_mtime(&stat_buf) == index->weapons_mtime;
+	free((char*)weapons_path);
+	if (!fresh)
+		return NULL;
+
+	// Checked even if it listed no weapons, it can list new ones without adding a folder
+	const char* builtin_weapons_json = g_build_filename(PWML_MOD_DATA_FOLDER, PWML_WEAPONS_FOLDER, PWML_BUILTIN_WEAPONS_JSON, NULL);
+	fresh = __pwml_index_file_is_fresh(index, mod_path, builtin_weapons_json);
+	free((char*)builtin_weapons_json);
+
+	GPtrArray* weapons = g_ptr_array_new_with_free_func(_pwml_weapon_free);
+	for (uint i = 0; i < index->weapons->len && fresh; i++) {
+		_PWML_Weapon* weapon = g_ptr_array_index(index->weapons, i);
+		if (!weapon->has_built_in_files) {
+			const char* weapon_json = g_build_filename(PWML_MOD_DATA_FOLDER, PWML_WEAPONS_FOLDER, weapon->name, PWML_WEAPON_JSON, NULL);
+			fresh = __pwml_index_file_is_fresh(index, mod_path, weapon_json);
+			free((char*)weapon_json);
+		}
+
+		g_ptr_array_add(weapons, _pwml_weapon_copy(weapon));
+	}
+
+	if (!fresh) {
+		g_ptr_array_free(weapons, true);
+		return NULL;
+	}
+	return weapons;
+}
+
+const _PWML_IndexFile* _pwml_index_get_file(_PWML_Index* index, const char* mod_path, const char* path) {
+	size_t length = strlen(mod_path);
+	if (strncmp(path, mod_path, length) != 0 || path[length] != G_DIR_SEPARATOR)
+		return NULL;
+	return g_hash_table_lookup(index->files, path + length + 1);
+}
@@ -0,0 +1,178 @@
+#include "PWML/json_utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <json-c/json_object.h>
+#include <json-c/json_tokener.h>
+#include <json-c/json_types.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Metadata and weapon.json are a few hundred bytes, manifests of big installs are what gets mapped
+#define MMAP_THRESHOLD (256 * 1024)
+
+typedef struct {
+	json_tokener* tokener;
+	// Reused for every file under MMAP_THRESHOLD, so it never grows past that
+	char* buffer;
+	size_t capacity;
+} __JSON_Utils_Parser;
+
+static void __json_utils_parser_free(gpointer voidptr_parser) {
+	__JSON_Utils_Parser* parser = (__JSON_Utils_Parser*)voidptr_parser;
+	json_tokener_free(parser->tokener);
+	free(parser->buffer);
+	free(parser);
+}
+
+// Mods are planned on several threads at once, a tokener can only parse one file at a time
+static GPrivate parser_key = G_PRIVATE_INIT(__json_utils_parser_free);
+
+static const char* const TYPE_NAMES[] = {
+	[json_type_null] = "null",
+	[json_type_boolean] = "a boolean",
+	[json_type_double] = "a number",
+	[json_type_int] = "an integer",
+	[json_type_object] = "an object",
+	[json_type_array] = "an array",
+	[json_type_string] = "a string",
+};
+
+static __JSON_Utils_Parser* __json_utils_get_parser(void) {
+	__JSON_Utils_Parser* parser = g_private_get(&parser_key);
+	if (parser)
+		return parser;
+
+	parser = malloc(sizeof(__JSON_Utils_Parser));
+	parser->tokener = json_tokener_new();
+	parser->buffer = NULL;
+	parser->capacity = 0;
+	g_private_set(&parser_key, parser);
+	return parser;
+}
+
+static json_object* __json_utils_parse(__JSON_Utils_Parser* parser, const char* path, const char* data, size_t length) {
+	json_tokener_reset(parser->tokener);
+	json_object* root = json_tokener_parse_ex(parser->tokener, data, (int)length);
+	enum json_tokener_error error = json_tokener_get_error(parser->tokener);
+
+	// A number at the top level only ends at the end of the input, which the data doesn't include
+	if (error == json_tokener_continue) {
+		root = json_tokener_parse_ex(parser->tokener, "", 1);
+		error = json_tokener_get_error(parser->tokener);
+	}
+
+	if (error != json_tokener_success) {
+		g_printerr("Failed to parse json file %s: %s\n", path, json_tokener_error_desc(error));
+		json_object_put(root);
+		return NULL;
+	}
+	// NULL for a file that is only null
+	return root;
+}
+
+static bool __json_utils_read(int fd, char* buffer, size_t length) {
+	size_t total = 0;
+	while (total < length) {
+		ssize_t bytes_read = read(fd, buffer + total, length - total);
+		if (bytes_read == -1 && errno == EINTR)
+			continue;
+		if (bytes_read <= 0)
+			return false;
+		total += bytes_read;
+	}
+	return true;
+}
+
+json_object* _json_utils_load(const char* path, bool* missing) {
+	if (missing)
+		*missing = false;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno == ENOENT && missing)
+			*missing = true;
+		else
+			g_printerr("Failed to open %s: %s\n", path, g_strerror(errno));
+		return NULL;
+	}
+
+	struct stat stat_buf;
+	if (fstat(fd, &stat_buf) != 0 || stat_buf.st_size >= INT_MAX) {
+		g_printerr("Failed to read %s\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	size_t length = stat_buf.st_size;
+	__JSON_Utils_Parser* parser = __json_utils_get_parser();
+	json_object* root = NULL;
+
+	if (length >= MMAP_THRESHOLD) {
+		void* data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED) {
+			g_printerr("Failed to map %s: %s\n", path, g_strerror(errno));
+			return NULL;
+		}
+		madvise(data, length, MADV_SEQUENTIAL);
+		root = __json_utils_parse(parser, path, data, length);
+		munmap(data, length);
+		return root;
+	}
+
+	// One more byte so an empty file still gets a buffer
+	if (!parser->buffer || parser->capacity < length) {
+		free(parser->buffer);
+		parser->capacity = length + 1;
+		parser->buffer = malloc(parser->capacity);
+	}
+
+	if (__json_utils_read(fd, parser->buffer, length))
+		root = __json_utils_parse(parser, path, parser->buffer, length);
+	else
+		g_printerr("Failed to read %s\n", path);
+
+	close(fd);
+	return root;
+}
+
+bool _json_utils_get_fields(json_object* object, const char* path, const _JSON_Utils_Field* fields, uint count) {
+	if (json_object_get_type(object) != json_type_object) {
+		g_printerr("Expected an object in %s\n", path);
+		return false;
+	}
+
+	for (uint i = 0; i < count; i++) {
+		const _JSON_Utils_Field* field = &fields[i];
+		json_object* value;
+		if (!json_object_object_get_ex(object, field->key, &value)) {
+			if (field->optional) {
+				*field->value = NULL;
+				continue;
+			}
+			g_printerr("Missing %s field in %s\n", field->key, path);
+			return false;
+		}
+
+		if (json_object_get_type(value) != field->type) {
+			g_printerr("Field %s in %s has to be %s\n", field->key, path, TYPE_NAMES[field->type]);
+			return false;
+		}
+		*field->value = value;
+	}
+	return true;
+}
+
+json_object* _json_utils_load_fields(const char* path, bool* missing, const _JSON_Utils_Field* fields, uint count) {
+	json_object* root = _json_utils_load(path, missing);
+	if (root && !_json_utils_get_fields(root, path, fields, count)) {
+		json_object_put(root);
+		return NULL;
+	}
+	return root;
+}
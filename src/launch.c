@@ -0,0 +1,170 @@
+// readahead
+#define _GNU_SOURCE
+#include "PWML/launch.h"
+#include "PWML/pwml.h"
+#include "PWML/trace.h"
+#include "PWML/xml_utils.h"
+#include <fcntl.h>
+#include <glib.h>
+#include <libxml/parser.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The game's first load is mostly small files, more threads than this just thrash a disk
+#define PREWARM_MAX_THREADS 4
+
+typedef struct {
+	// Paths in the order they should be read, owned by the last thread out
+	GPtrArray* paths;
+	gint next;
+	gint threads_left;
+} __PWML_Prewarm;
+
+static void __pwml_prewarm_file(const char* path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return;
+
+	off_t size = lseek(fd, 0, SEEK_END);
+	// readahead blocks until the pages are queued, which is what keeps the threads in order
+	if (size > 0 && readahead(fd, 0, size) != 0)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+}
+
+static gpointer __pwml_prewarm_thread(gpointer data) {
+	__PWML_Prewarm* prewarm = (__PWML_Prewarm*)data;
+	gint64 trace_start = _pwml_trace_begin();
+
+	guint index;
+	while ((index = (guint)g_atomic_int_add(&prewarm->next, 1)) < prewarm->paths->len) {
+		__pwml_prewarm_file(g_ptr_array_index(prewarm->paths, index));
+	}
+
+	_pwml_trace_end("launch", "prewarm", NULL, trace_start);
+	if (g_atomic_int_dec_and_test(&prewarm->threads_left)) {
+		g_ptr_array_free(prewarm->paths, true);
+		free(prewarm);
+	}
+	return NULL;
+}
+
+static void __pwml_prewarm_add_references(const char* folder, const char* xml_name, GHashTable* seen, GPtrArray* paths) {
+	const char* xml_path = g_build_filename(folder, xml_name, NULL);
+	GPtrArray* references = _xml_utils_collect_file_references(xml_path, folder);
+	for (uint i = 0; i < references->len; i++) {
+		char* path = g_ptr_array_index(references, i);
+		if (g_hash_table_add(seen, path))
+			g_ptr_array_add(paths, path);
+		else
+			free(path);
+	}
+	// The paths now belong to paths
+	g_ptr_array_set_free_func(references, NULL);
+	g_ptr_array_free(references, true);
+	free((char*)xml_path);
+}
+
+static void __pwml_prewarm_add_folder(const char* folder, GHashTable* seen, GPtrArray* paths) {
+	GQueue* queue = g_queue_new();
+	g_queue_push_head(queue, strdup(folder));
+
+	char* current_path;
+	while ((current_path = g_queue_pop_head(queue))) {
+		GDir* dir = g_dir_open(current_path, 0, NULL);
+		if (dir) {
+			const char* entry;
+			while ((entry = g_dir_read_name(dir))) {
+				char* path = g_build_filename(current_path, entry, NULL);
+				if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
+					g_queue_push_tail(queue, path);
+				} else if (g_hash_table_add(seen, path)) {
+					g_ptr_array_add(paths, path);
+				} else {
+					free(path);
+				}
+			}
+			g_dir_close(dir);
+		}
+		free(current_path);
+	}
+
+	g_queue_free(queue);
+}
+
+void pwml_prewarm_assets(PWML* pwml) {
+	gint64 trace_start = _pwml_trace_begin();
+
+	// paths owns the strings, seen only borrows them
+	GHashTable* seen = g_hash_table_new(g_str_hash, g_str_equal);
+	GPtrArray* paths = g_ptr_array_new_with_free_func(free);
+
+	// What the merged xml names is what the game loads first
+	xmlInitParser();
+	__pwml_prewarm_add_references(pwml->graphics_path, PWML_GRAPHICS_XML, seen, paths);
+	__pwml_prewarm_add_references(pwml->sound_path, PWML_SOUNDS_XML, seen, paths);
+
+	__pwml_prewarm_add_folder(pwml->graphics_path, seen, paths);
+	__pwml_prewarm_add_folder(pwml->sound_path, seen, paths);
+	__pwml_prewarm_add_folder(pwml->objects_path, seen, paths);
+	__pwml_prewarm_add_folder(pwml->levels_path, seen, paths);
+
+	g_hash_table_destroy(seen);
+
+	__PWML_Prewarm* prewarm = malloc(sizeof(__PWML_Prewarm));
+	prewarm->paths = paths;
+	prewarm->next = 0;
+	uint thread_count = CLAMP(g_get_num_processors(), 1, PREWARM_MAX_THREADS);
+	prewarm->threads_left = thread_count;
+
+	if (trace_start) {
+		char* detail = g_strdup_printf("%u files on %u threads", prewarm->paths->len, thread_count);
+		_pwml_trace_end("launch", "prewarm_plan", detail, trace_start);
+		free(detail);
+	}
+
+	for (uint i = 0; i < thread_count; i++) {
+		g_thread_unref(g_thread_new("pwml-prewarm", __pwml_prewarm_thread, prewarm));
+	}
+}
+
+bool pwml_launch(PWML* pwml) {
+	if (!g_file_test(pwml->exectuable_path, G_FILE_TEST_IS_REGULAR)) {
+		g_printerr("Couldn't launch %s; No such file.\n", pwml->exectuable_path);
+		return false;
+	}
+
+	pwml_prewarm_assets(pwml);
+
+	GPtrArray* argv = g_ptr_array_new_with_free_func(g_free);
+	const char* launcher = g_getenv("PWML_LAUNCHER");
+	if (launcher && *launcher) {
+		int launcher_argc;
+		char** launcher_argv;
+		GError* error = NULL;
+		if (!g_shell_parse_argv(launcher, &launcher_argc, &launcher_argv, &error)) {
+			g_printerr("Failed to parse PWML_LAUNCHER %s\nGError: %s\n", launcher, error->message);
+			g_error_free(error);
+			g_ptr_array_free(argv, true);
+			return false;
+		}
+		for (int i = 0; i < launcher_argc; i++) {
+			g_ptr_array_add(argv, launcher_argv[i]);
+		}
+		// The strings now belong to argv
+		g_free(launcher_argv);
+	}
+	g_ptr_array_add(argv, g_strdup(pwml->exectuable_path));
+	g_ptr_array_add(argv, NULL);
+
+	GError* error = NULL;
+	bool success = g_spawn_async(pwml->working_directory, (char**)argv->pdata, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, &error);
+	if (!success) {
+		g_printerr("Failed to launch %s\nGError: %s\n", pwml->exectuable_path, error->message);
+		g_error_free(error);
+	}
+
+	g_ptr_array_free(argv, true);
+	return success;
+}
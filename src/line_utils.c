@@ -0,0 +1,83 @@
+#include "PWML/line_utils.h"
+#include "PWML/file_utils.h"
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define WRITE_BUFFER_SIZE (64 * 1024)
+
+// Returns false if the file couldn't be read, whatever was read before that is kept
+static bool __line_utils_merge_file(const char* path, FILE* destination, GHashTable* seen, char** line, size_t* capacity, guint64* bytes) {
+	FILE* source = fopen(path, "r");
+	if (!source) {
+		g_printerr("Failed to open file %s\n", path);
+		return false;
+	}
+
+	ssize_t length;
+	while ((length = getline(line, capacity, source)) != -1) {
+		char* text = *line;
+		while (length > 0 && (text[length - 1] == '\n' || text[length - 1] == '\r'))
+			text[--length] = '\0';
+		if (length == 0)
+			continue;
+
+		if (seen) {
+			if (g_hash_table_contains(seen, text))
+				continue;
+			g_hash_table_add(seen, strdup(text));
+		}
+
+		fwrite(text, 1, length, destination);
+		fputc('\n', destination);
+		*bytes += length + 1;
+	}
+
+	bool success = !ferror(source);
+	if (!success)
+		g_printerr("Failed to read file %s\n", path);
+	fclose(source);
+	return success;
+}
+
+bool _line_utils_merge_files(GPtrArray* paths, bool deduplicate, const char* destination_path, _File_Utils_Counters* counters) {
+	FILE* destination = fopen(destination_path, "w");
+	if (!destination) {
+		g_printerr("Failed to open file %s for writing\n", destination_path);
+		counters->errors++;
+		return false;
+	}
+	setvbuf(destination, NULL, _IOFBF, WRITE_BUFFER_SIZE);
+
+	GHashTable* seen = deduplicate ? g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL) : NULL;
+	// Reused for every line of every file
+	char* line = NULL;
+	size_t capacity = 0;
+	guint64 bytes = 0;
+
+	for (uint i = 0; i < paths->len; i++) {
+		if (__line_utils_merge_file(g_ptr_array_index(paths, i), destination, seen, &line, &capacity, &bytes))
+			counters->files++;
+		else
+			counters->errors++;
+	}
+
+	free(line);
+	if (seen)
+		g_hash_table_destroy(seen);
+
+	bool success = !ferror(destination);
+	if (fclose(destination) != 0)
+		success = false;
+	if (!success) {
+		g_printerr("Failed to write file %s\n", destination_path);
+		counters->errors++;
+		return false;
+	}
+
+	counters->bytes += bytes;
+	return true;
+}
@@ -1,9 +1,13 @@
 #include "PWML/mod.h"
+#include "PWML/deploy.h"
 #include "PWML/file_utils.h"
+#include "PWML/index.h"
+#include "PWML/json_utils.h"
 #include "PWML/pwml.h"
+#include "PWML/schedule_utils.h"
+#include "PWML/stats.h"
 #include "PWML/weapon.h"
 #include "json_object.h"
-#include "json_tokener.h"
 #include "json_types.h"
 #include <glib.h>
 #include <stdio.h>
@@ -11,16 +15,91 @@
 #include <string.h>
 #include <sys/types.h>
 
+// A few hundred mods' worth of strings per block
+#define MOD_STRINGS_CHUNK_SIZE (64 * 1024)
+
 void pwml_mod_free(PWML_Mod *mod) {
-	free((char*)mod->path);
-	free((char*)mod->id);
-	free((char*)mod->name);
 	free((char*)mod->description);
+	_pwml_mod_strings_unref(mod->strings);
 	free(mod);
 }
 
-static GPtrArray* __pwml_mod_get_weapons(PWML_Mod* mod) {
-	const char* weapons_path = g_build_filename(mod->path, PWML_MOD_DATA_FOLDER, PWML_WEAPONS_FOLDER, NULL);
+_PWML_ModStrings* _pwml_mod_strings_new(void) {
+	_PWML_ModStrings* strings = malloc(sizeof(_PWML_ModStrings));
+	strings->chunk = g_string_chunk_new(MOD_STRINGS_CHUNK_SIZE);
+	strings->interned = g_hash_table_new(g_str_hash, g_str_equal);
+	strings->bytes = 0;
+	strings->ref_count = 1;
+	return strings;
+}
+
+_PWML_ModStrings* _pwml_mod_strings_ref(_PWML_ModStrings* strings) {
+	g_atomic_int_inc(&strings->ref_count);
+	return strings;
+}
+
+void _pwml_mod_strings_unref(_PWML_ModStrings* strings) {
+	if (g_atomic_int_dec_and_test(&strings->ref_count)) {
+		g_hash_table_destroy(strings->interned);
+		g_string_chunk_free(strings->chunk);
+		free(strings);
+	}
+}
+
+// Does what g_string_chunk_insert_const does, but knows when a copy is new so only those are counted
+const char* _pwml_mod_strings_insert(_PWML_ModStrings* strings, const char* string) {
+	const char* interned = g_hash_table_lookup(strings->interned, string);
+	if (interned)
+		return interned;
+
+	interned = g_string_chunk_insert(strings->chunk, string);
+	g_hash_table_add(strings->interned, (char*)interned);
+	strings->bytes += strlen(string) + 1;
+	return interned;
+}
+
+// Vanilla goes first so every mod overrides it, ties are broken by id so the result doesn't depend on the catalog
+int _pwml_mod_compare_apply_order(const void* a, const void* b) {
+	const PWML_Mod* mod_a = a;
+	const PWML_Mod* mod_b = b;
+	bool vanilla_a = g_str_equal(mod_a->id, "vanilla");
+	bool vanilla_b = g_str_equal(mod_b->id, "vanilla");
+	if (vanilla_a != vanilla_b)
+		return vanilla_a ? -1 : 1;
+	if (mod_a->priority != mod_b->priority)
+		return mod_a->priority < mod_b->priority ? -1 : 1;
+	return strcmp(mod_a->id, mod_b->id);
+}
+
+char* _pwml_mod_get_path(const PWML_Mod* mod) {
+	return g_build_filename(mod->mods_path, mod->id, NULL);
+}
+
+PWML_Mod* _pwml_mod_ref(PWML_Mod* mod) {
+	g_atomic_int_inc(&mod->ref_count);
+	return mod;
+}
+
+void _pwml_mod_unref(void* voidptr_mod) {
+	PWML_Mod* mod = (PWML_Mod*)voidptr_mod;
+	if (g_atomic_int_dec_and_test(&mod->ref_count))
+		pwml_mod_free(mod);
+}
+
+json_object* _pwml_mod_read_metadata(const char* mod_path, bool* missing, json_object** name, json_object** short_description) {
+	const _JSON_Utils_Field fields[] = {
+		{ "name", json_type_string, name, false },
+		{ "short_description", json_type_string, short_description, false },
+	};
+
+	const char* metadata_path = g_build_filename(mod_path, PWML_METADATA_JSON, NULL);
+	json_object* root = _json_utils_load_fields(metadata_path, missing, fields, G_N_ELEMENTS(fields));
+	free((char*)metadata_path);
+	return root;
+}
+
+static GPtrArray* __pwml_mod_get_weapons(const char* mod_path, _File_Utils_Counters* counters) {
+	const char* weapons_path = g_build_filename(mod_path, PWML_MOD_DATA_FOLDER, PWML_WEAPONS_FOLDER, NULL);
 	GPtrArray* files = _file_utils_list_files_in_directory(weapons_path);
 
 	GPtrArray* weapons = g_ptr_array_new_with_free_func(_pwml_weapon_free);
@@ -32,175 +111,315 @@ static GPtrArray* __pwml_mod_get_weapons(PWML_Mod* mod) {
 			continue;
 		}
 
+		json_object *ship, *pilot;
+		const _JSON_Utils_Field fields[] = {
+			{ "ship", json_type_boolean, &ship, false },
+			{ "pilot", json_type_boolean, &pilot, false },
+		};
+
+		// Folders without a weapon.json aren't weapons
 		const char* weapon_json_path = g_build_filename(weapon_path, PWML_WEAPON_JSON, NULL);
-		if (!g_file_test(weapon_json_path, G_FILE_TEST_EXISTS)) {
+		bool missing;
+		json_object* root = _json_utils_load_fields(weapon_json_path, &missing, fields, G_N_ELEMENTS(fields));
+		free((char*)weapon_json_path);
+		if (!root) {
+			if (!missing)
+				counters->errors++;
 			free((char*)weapon_path);
-			free((char*)weapon_json_path);
 			continue;
 		}
 
-		char* buffer;
-		GError* error = NULL;
+		_PWML_Weapon* weapon = malloc(sizeof(_PWML_Weapon));
+		weapon->name = g_path_get_basename(weapon_path);
+		weapon->ship = json_object_get_boolean(ship);
+		weapon->pilot = json_object_get_boolean(pilot);
+		weapon->has_built_in_files = false;
+		g_ptr_array_add(weapons, weapon);
+		counters->files++;
+
+		free((char*)weapon_path);
+		json_object_put(root);
+	}
 
-		g_file_get_contents(weapon_json_path, &buffer, NULL, &error);
-		if (error) {
-			g_printerr("Failed to load contents of %s\nGError: %s\n", weapon_json_path, error->message);
-			free((char*)weapon_path);
-			free((char*)weapon_json_path);
-			g_error_free(error);
-			continue;
-		}
-		
-		json_object* root = json_tokener_parse(buffer);
-		free(buffer);
+	return weapons;
+}
 
-		if (!root) {
-			g_printerr("Failed to parse json file %s\n", weapon_json_path);
-			free((char*)weapon_path);
-			free((char*)weapon_json_path);
-			continue;
-		}
+GPtrArray* _pwml_mod_scan_weapons(const char* mod_path, _File_Utils_Counters* counters) {
+	const char* mod_weapons_path = g_build_filename(mod_path, PWML_MOD_DATA_FOLDER, PWML_WEAPONS_FOLDER, NULL);
+	GPtrArray* weapons = __pwml_mod_get_weapons(mod_path, counters);
 
-		json_object *ship, *pilot;
+	json_object* j_weapons;
+	const _JSON_Utils_Field fields[] = {
+		{ "weapons", json_type_array, &j_weapons, false },
+	};
 
-		if (!json_object_object_get_ex(root, "ship", &ship) || json_object_get_type(ship) != json_type_boolean) {
-			g_printerr("Failed to read ship from weapon.json at %s\n", weapon_json_path);
-			free((char*)weapon_path);
-			free((char*)weapon_json_path);
-			continue;
-		}
+	const char* mod_builtin_weapons_json_path = g_build_filename(mod_weapons_path, PWML_BUILTIN_WEAPONS_JSON, NULL);
+	bool missing;
+	json_object* root = _json_utils_load_fields(mod_builtin_weapons_json_path, &missing, fields, G_N_ELEMENTS(fields));
+	if (!root) {
+		if (!missing)
+			counters->errors++;
+		goto cleanup;
+	}
 
-		if (!json_object_object_get_ex(root, "pilot", &pilot) || json_object_get_type(pilot) != json_type_boolean) {
-			g_printerr("Failed to read pilot from weapon.json at %s\n", weapon_json_path);
-			free((char*)weapon_path);
-			free((char*)weapon_json_path);
+	uint len = json_object_array_length(j_weapons);
+	for (uint i = 0; i < len; i++) {
+		json_object *weapon_name, *ship, *pilot;
+		const _JSON_Utils_Field weapon_fields[] = {
+			{ "name", json_type_string, &weapon_name, false },
+			{ "ship", json_type_boolean, &ship, false },
+			{ "pilot", json_type_boolean, &pilot, false },
+		};
+		if (!_json_utils_get_fields(json_object_array_get_idx(j_weapons, i), mod_builtin_weapons_json_path, weapon_fields, G_N_ELEMENTS(weapon_fields))) {
+			counters->errors++;
 			continue;
 		}
 
 		_PWML_Weapon* weapon = malloc(sizeof(_PWML_Weapon));
-		weapon->name = g_path_get_basename(weapon_path);
+		weapon->has_built_in_files = true;
+		weapon->name = strdup(json_object_get_string(weapon_name));
 		weapon->ship = json_object_get_boolean(ship);
 		weapon->pilot = json_object_get_boolean(pilot);
 		g_ptr_array_add(weapons, weapon);
-
-		free((char*)weapon_json_path);
-		free((char*)weapon_path);
-		json_object_put(root);
 	}
 
+	json_object_put(root);
+	counters->files++;
+
+cleanup:
+	free((char*)mod_builtin_weapons_json_path);
+	free((char*)mod_weapons_path);
 	return weapons;
 }
 
-static void __pwml_mod_apply_weapons(PWML* pwml, PWML_Mod* mod) {
-	const char* mod_weapons_path = g_build_filename(mod->path, PWML_MOD_DATA_FOLDER, PWML_WEAPONS_FOLDER, NULL);
-	const char* game_weapons_path = g_build_filename(pwml->working_directory, PWML_WEAPONS_FOLDER, NULL);
-	GPtrArray* weapons = __pwml_mod_get_weapons(mod);
+static void __pwml_mod_plan_weapons(PWML* pwml, _PWML_ModPlan* plan, const _File_Utils_Filter* filter) {
+	const char* mod_weapons_path = g_build_filename(plan->path, PWML_MOD_DATA_FOLDER, PWML_WEAPONS_FOLDER, NULL);
+
+	for (uint i = 0; i < plan->weapons->len; i++) {
+		_PWML_Weapon* weapon = g_ptr_array_index(plan->weapons, i);
+		if (weapon->has_built_in_files)
+			continue;
 
-	for (uint i = 0; i < weapons->len; i++) {
-		_PWML_Weapon* weapon = g_ptr_array_index(weapons, i);
 		const char* weapon_path = g_build_filename(mod_weapons_path, weapon->name, NULL);
+		_file_utils_collect_copy_jobs(weapon_path, pwml->weapons_path, filter, plan->jobs[PWML_RESOURCE_WEAPONS]);
+		free((char*)weapon_path);
+	}
 
-		_file_utils_copy_recursive(weapon_path, game_weapons_path);
-		
-		const char* installed_weapons_json_path = g_build_filename(game_weapons_path, weapon->name, PWML_WEAPON_JSON, NULL);
-		remove(installed_weapons_json_path);
-		free((char*)installed_weapons_json_path);
+	free((char*)mod_weapons_path);
+}
 
-		free((char*)weapon_path);
+static void __collect_all_if_dir(const char* from, const char* to, const _File_Utils_Filter* filter, GPtrArray* jobs) {
+	if (g_file_test(from, G_FILE_TEST_IS_DIR)) {
+		_file_utils_collect_all(from, to, filter, jobs);
+	}
+}
 
-		g_ptr_array_add(pwml->weapons, weapon);
+// Version control folders are left out unless the mod's .pwmlignore says otherwise. What PWML reads
+// itself is always left out: each weapon's weapon.json and the files the mods' copies are merged into.
+static _File_Utils_Filter* __pwml_mod_get_filter(const char* mod_path) {
+	_File_Utils_Filter* filter = _file_utils_filter_new(mod_path);
+	_file_utils_filter_add_rule(filter, ".git/");
+	_file_utils_filter_add_rule(filter, ".svn/");
+	_file_utils_filter_add_rule(filter, ".hg/");
+
+	const char* ignore_path = g_build_filename(mod_path, PWML_MOD_IGNORE_FILE, NULL);
+	if (!_file_utils_filter_add_file(filter, ignore_path))
+		g_printerr("Failed to read %s, copying the whole mod\n", ignore_path);
+	free((char*)ignore_path);
+
+	const char* weapon_json_rule = g_build_filename(PWML_MOD_DATA_FOLDER, PWML_WEAPONS_FOLDER, "*", PWML_WEAPON_JSON, NULL);
+	_file_utils_filter_add_rule(filter, weapon_json_rule);
+	free((char*)weapon_json_rule);
+
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		const _PWML_ResourceHandler* handler = _pwml_resource_get_handler(type);
+		if (!handler->generated_file)
+			continue;
+		const char* generated_file_rule = g_build_filename(PWML_MOD_DATA_FOLDER, *handler->folder, *handler->generated_file, NULL);
+		_file_utils_filter_add_rule(filter, generated_file_rule);
+		free((char*)generated_file_rule);
 	}
 
-	const char* mod_builtin_weapons_json_path = g_build_filename(mod_weapons_path, PWML_BUILTIN_WEAPONS_JSON, NULL);
-	if (g_file_test(mod_builtin_weapons_json_path, G_FILE_TEST_EXISTS)) {
-		char* contents;
-		GError* error = NULL;
-		g_file_get_contents(mod_builtin_weapons_json_path, &contents, NULL, &error);
-		if (error) {
-			g_printerr("Failed to read %s\n", mod_builtin_weapons_json_path);
-			g_error_free(error);
-			goto cleanup;
-		}
+	return filter;
+}
 
-		json_object* root = json_tokener_parse(contents);
-		json_object* j_weapons = json_object_object_get(root, "weapons");
-
-		uint len = json_object_array_length(j_weapons);
-		for (uint i = 0; i < len; i++) {
-			json_object* j_weapon = json_object_array_get_idx(j_weapons, i);
-			json_object* weapon_name = json_object_object_get(j_weapon, "name");
-			json_object* ship = json_object_object_get(j_weapon, "ship");
-			json_object* pilot = json_object_object_get(j_weapon, "pilot");
-
-			_PWML_Weapon* weapon = malloc(sizeof(_PWML_Weapon));
-			weapon->has_built_in_files = true;
-			weapon->name = strdup(json_object_get_string(weapon_name));
-			weapon->ship = json_object_get_boolean(ship);
-			weapon->pilot = json_object_get_boolean(pilot);
-			g_ptr_array_add(pwml->weapons, weapon);
-		}
+static char* __existing_path_or_null(const char* folder, const char* file) {
+	char* path = g_build_filename(folder, file, NULL);
+	if (g_file_test(path, G_FILE_TEST_EXISTS))
+		return path;
+	free(path);
+	return NULL;
+}
 
-		json_object_put(root);
+void _pwml_mod_plan_free(void* voidptr_plan) {
+	_PWML_ModPlan* plan = (_PWML_ModPlan*)voidptr_plan;
+	g_ptr_array_free(plan->weapons, true);
+	_pwml_index_free(plan->index);
+	g_free(plan->path);
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		g_ptr_array_free(plan->jobs[type], true);
+		free(plan->merge_inputs[type]);
 	}
+	free(plan);
+}
 
-cleanup:
-	free((char*)mod_builtin_weapons_json_path);
-	g_ptr_array_free(weapons, false);
+static void __pwml_mod_plan_resource(PWML* pwml, _PWML_ModPlan* plan, PWML_ResourceType type, const _File_Utils_Filter* filter) {
+	const _PWML_ResourceHandler* handler = _pwml_resource_get_handler(type);
+	const char* mod_resource_path = g_build_filename(plan->path, PWML_MOD_DATA_FOLDER, *handler->folder, NULL);
+	const char* generated_file = handler->generated_file ? *handler->generated_file : NULL;
+	GPtrArray* jobs = plan->jobs[type];
+
+	__collect_all_if_dir(mod_resource_path, _pwml_resource_get_path(pwml, type), filter, jobs);
+	if (pwml->deploy_strategies[type] == PWML_DEPLOY_LINK) {
+		for (uint i = 0; i < jobs->len; i++)
+			((_File_Utils_CopyJob*)g_ptr_array_index(jobs, i))->method = _FILE_UTILS_LINK;
+	}
+
+	if (_pwml_resource_get_merge_inputs(pwml, type))
+		plan->merge_inputs[type] = __existing_path_or_null(mod_resource_path, generated_file);
+
+	free((char*)mod_resource_path);
+}
+
+_PWML_ModPlan* _pwml_mod_plan(PWML* pwml, PWML_Mod* mod) {
+	_PWML_ModPlan* plan = malloc(sizeof(_PWML_ModPlan));
+	plan->mod = mod;
+	plan->path = _pwml_mod_get_path(mod);
+	plan->index = _pwml_index_load(plan->path);
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		plan->jobs[type] = g_ptr_array_new_with_free_func(_file_utils_copy_job_free);
+		plan->merge_inputs[type] = NULL;
+	}
+
+	_File_Utils_Filter* filter = __pwml_mod_get_filter(plan->path);
+	const char* mod_weapons_path = g_build_filename(plan->path, PWML_MOD_DATA_FOLDER, PWML_WEAPONS_FOLDER, NULL);
+	_File_Utils_Counters scan_counters = { 0 };
+	gint64 start = _pwml_stats_begin(pwml);
+	if (g_file_test(mod_weapons_path, G_FILE_TEST_IS_DIR)) {
+		plan->weapons = plan->index ? _pwml_index_get_weapons(plan->index, plan->path) : NULL;
+		if (!plan->weapons)
+			plan->weapons = _pwml_mod_scan_weapons(plan->path, &scan_counters);
+		__pwml_mod_plan_weapons(pwml, plan, filter);
+	} else {
+		plan->weapons = g_ptr_array_new_with_free_func(_pwml_weapon_free);
+	}
+	_pwml_stats_end(pwml, PWML_PHASE_WEAPONS_SCAN, mod->id, start, &scan_counters);
 	free((char*)mod_weapons_path);
-	free((char*)game_weapons_path);
+
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		if (!_pwml_resource_get_handler(type)->custom_deploy)
+			__pwml_mod_plan_resource(pwml, plan, type, filter);
+	}
+	_file_utils_filter_free(filter);
+
+	// Sorted once here, alongside the other plans, so the copy tasks don't each sort their share again
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		_schedule_utils_sort_jobs(pwml->copy_order, plan->jobs[type]);
+	}
+
+	return plan;
 }
 
-static void __copy_all_if_dir(const char* from, const char* to) {
-	if (g_file_test(from, G_FILE_TEST_IS_DIR)) {
-		_file_utils_copy_all(from, to);
+// Whether a later mod deploys a file at one of the folders path is in
+static bool __pwml_mod_is_under_claimed_file(GHashTable* claimed, const char* path) {
+	char* folder = g_strdup(path);
+	char* separator;
+	bool claimed_file = false;
+	while (!claimed_file && (separator = strrchr(folder, G_DIR_SEPARATOR)) && separator != folder) {
+		*separator = '\0';
+		claimed_file = g_hash_table_contains(claimed, folder);
 	}
+	g_free(folder);
+	return claimed_file;
 }
 
-static void __copy_all_if_dir_except(const char* from, const char* to, const char* ignore) {
-	if (g_file_test(from, G_FILE_TEST_IS_DIR)) {
-		_file_utils_copy_all_except(from, to, ignore);
+static void __pwml_mod_claim_folders(GHashTable* claimed_folders, const char* path) {
+	char* folder = g_path_get_dirname(path);
+	// The folders above one that is claimed already are too
+	while (!g_hash_table_contains(claimed_folders, folder)) {
+		char* parent = g_path_get_dirname(folder);
+		g_hash_table_add(claimed_folders, folder);
+		if (g_str_equal(parent, folder)) {
+			g_free(parent);
+			return;
+		}
+		folder = parent;
 	}
+	g_free(folder);
 }
 
-void _pwml_mod_apply(PWML* pwml, PWML_Mod* mod) {
-	// I feel like there should be a better way
-	const char* mod_weapons_path = g_build_filename(mod->path, PWML_MOD_DATA_FOLDER, PWML_WEAPONS_FOLDER, NULL);
-	const char* mod_objects_path = g_build_filename(mod->path, PWML_MOD_DATA_FOLDER, PWML_OBJECTS_FOLDER, NULL);
-	const char* mod_levels_path = g_build_filename(mod->path, PWML_MOD_DATA_FOLDER, PWML_LEVELS_FOLDER, NULL);
-	const char* mod_music_path = g_build_filename(mod->path, PWML_MOD_DATA_FOLDER, PWML_MUSIC_FOLDER, NULL);
-	const char* mod_graphics_path = g_build_filename(mod->path, PWML_MOD_DATA_FOLDER, PWML_GRAPHICS_FOLDER, NULL);
-	const char* mod_sounds_path = g_build_filename(mod->path, PWML_MOD_DATA_FOLDER, PWML_SOUND_FOLDER, NULL);
-	const char* mod_menu_music_file_path = g_build_filename(mod_music_path, PWML_MENU_MUSIC_TXT, NULL);
-	const char* mod_graphics_xml_file_path = g_build_filename(mod_graphics_path, PWML_GRAPHICS_XML, NULL);
-	const char* mod_sounds_xml_file_path = g_build_filename(mod_sounds_path, PWML_SOUNDS_XML, NULL);
+guint _pwml_mod_plan_drop_overridden(_PWML_ModPlan* plan, GHashTable* claimed, GHashTable* claimed_folders) {
+	guint dropped = 0;
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		GPtrArray* jobs = plan->jobs[type];
+		GPtrArray* kept = g_ptr_array_new_full(jobs->len, _file_utils_copy_job_free);
+		for (uint i = 0; i < jobs->len; i++) {
+			_File_Utils_CopyJob* job = g_ptr_array_index(jobs, i);
+			// Copying both sides of a file against a folder would fail whichever went second
+			if (g_hash_table_contains(claimed, job->destination) || g_hash_table_contains(claimed_folders, job->destination)
+				|| __pwml_mod_is_under_claimed_file(claimed, job->destination)) {
+				_file_utils_copy_job_free(job);
+				dropped++;
+				continue;
+			}
+			// An empty folder only overrides a file at its path, earlier mods' files still go in it
+			if (job->folder)
+				g_hash_table_add(claimed_folders, g_strdup(job->destination));
+			else
+				g_hash_table_add(claimed, job->destination);
+			__pwml_mod_claim_folders(claimed_folders, job->destination);
+			g_ptr_array_add(kept, job);
+		}
 
-	if (g_file_test(mod_weapons_path, G_FILE_TEST_IS_DIR)) {
-		__pwml_mod_apply_weapons(pwml, mod);
+		// The jobs were either moved to kept or freed
+		g_ptr_array_set_free_func(jobs, NULL);
+		g_ptr_array_free(jobs, true);
+		plan->jobs[type] = kept;
 	}
+	return dropped;
+}
 
-	__copy_all_if_dir(mod_objects_path, pwml->objects_path);
-	__copy_all_if_dir(mod_levels_path, pwml->levels_path);
-	__copy_all_if_dir_except(mod_music_path, pwml->music_path, PWML_MENU_MUSIC_TXT);
-	__copy_all_if_dir_except(mod_graphics_path, pwml->graphics_path, PWML_GRAPHICS_XML);
-	__copy_all_if_dir_except(mod_sounds_path, pwml->sound_path, PWML_SOUNDS_XML);
+bool _pwml_mod_plan_copy(PWML* pwml, _PWML_ModPlan* plan, PWML_ResourceType type, uint first, uint count) {
+	// Always counted, a failed copy fails the apply
+	_File_Utils_Counters counters = { 0 };
+	_File_Utils_Context context = { .counters = &counters, .order = pwml->copy_order, .presorted = true, .durability = pwml->durability };
+	gint64 start = _pwml_stats_begin(pwml);
 
-	if (g_file_test(mod_menu_music_file_path, G_FILE_TEST_EXISTS)) {
-		g_ptr_array_add(pwml->menu_music_paths, strdup(mod_menu_music_file_path));
+	// Only borrows the plan's jobs
+	GPtrArray* jobs = g_ptr_array_sized_new(count);
+	for (uint i = first; i < first + count; i++) {
+		g_ptr_array_add(jobs, g_ptr_array_index(plan->jobs[type], i));
 	}
-	if (g_file_test(mod_graphics_xml_file_path, G_FILE_TEST_EXISTS)) {
-		g_ptr_array_add(pwml->graphics_xml_paths, strdup(mod_graphics_xml_file_path));
+	_file_utils_copy_jobs(&context, jobs);
+	g_ptr_array_free(jobs, true);
+
+	_pwml_stats_end(pwml, PWML_PHASE_COPY, plan->mod->id, start, &counters);
+	return counters.errors == 0;
+}
+
+void _pwml_mod_plan_finish(PWML* pwml, _PWML_ModPlan* plan) {
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		for (uint i = 0; i < plan->jobs[type]->len; i++) {
+			_File_Utils_CopyJob* job = g_ptr_array_index(plan->jobs[type], i);
+			if (job->folder)
+				continue;
+			const _PWML_IndexFile* file = plan->index ? _pwml_index_get_file(plan->index, plan->path, job->source) : NULL;
+			if (file)
+				_pwml_deploy_record_hashed(pwml, job->destination, job->source, file->digest, file->size, file->mtime);
+			else
+				_pwml_deploy_record(pwml, job->destination, job->source);
+		}
 	}
-	if (g_file_test(mod_sounds_xml_file_path, G_FILE_TEST_EXISTS)) {
-		g_ptr_array_add(pwml->sounds_xml_paths, strdup(mod_sounds_xml_file_path));
+
+	// The weapons now belong to pwml->weapons
+	g_ptr_array_set_free_func(plan->weapons, NULL);
+	for (uint i = 0; i < plan->weapons->len; i++) {
+		g_ptr_array_add(pwml->weapons, g_ptr_array_index(plan->weapons, i));
 	}
+	g_ptr_array_set_size(plan->weapons, 0);
 
-	free((char*)mod_weapons_path);
-	free((char*)mod_objects_path);
-	free((char*)mod_levels_path);
-	free((char*)mod_music_path);
-	free((char*)mod_graphics_path);
-	free((char*)mod_sounds_path);
-	free((char*)mod_menu_music_file_path);
-	free((char*)mod_graphics_xml_file_path);
-	free((char*)mod_sounds_xml_file_path);
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		if (plan->merge_inputs[type])
+			g_ptr_array_add(_pwml_resource_get_merge_inputs(pwml, type), strdup(plan->merge_inputs[type]));
+	}
 }
@@ -0,0 +1,521 @@
+#include "PWML/profile.h"
+#include "PWML/cache.h"
+#include "PWML/deploy.h"
+#include "PWML/file_utils.h"
+#include "PWML/json_utils.h"
+#include "PWML/pwml.h"
+#include "PWML/resource.h"
+#include "PWML/trace.h"
+#include <glib.h>
+#include <json-c/json_object.h>
+#include <json-c/json_types.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+const char* const PWML_PROFILES_FOLDER = ".pwml_profiles";
+const char* const PWML_DEFAULT_PROFILE = "default";
+const char* const PWML_PROFILES_JSON = "profiles.json";
+const char* const PWML_PROFILE_JSON = "profile.json";
+const char* const PWML_PROFILE_DEPLOYMENT_FOLDER = "deployment";
+// Kept in the cache folder next to the deploy manifest and moved along with it
+const char* const PWML_DEPLOYED_FINGERPRINT = "deployed_fingerprint";
+
+// The files in the cache folder that describe the live deployment rather than the mods
+static const char* const* const DEPLOYMENT_CACHE_FILES[] = { &PWML_DEPLOY_MANIFEST_JSON, &PWML_DEPLOYED_FINGERPRINT };
+
+static bool __pwml_profile_is_valid_name(const char* name) {
+	return name && *name && !strchr(name, G_DIR_SEPARATOR) && !g_str_equal(name, ".") && !g_str_equal(name, "..");
+}
+
+// file may be NULL for the profile's own folder
+static char* __pwml_profile_get_path(PWML* pwml, const char* name, const char* file) {
+	return g_build_filename(pwml->working_directory, PWML_PROFILES_FOLDER, name, file, NULL);
+}
+
+// Profiles and states that were never saved have no file, which isn't an error
+static json_object* __pwml_profile_read_json(const char* path) {
+	bool missing;
+	return _json_utils_load(path, &missing);
+}
+
+// Takes the reference to root
+static bool __pwml_profile_write_json(PWML* pwml, const char* path, json_object* root) {
+	char* folder = g_path_get_dirname(path);
+	g_mkdir_with_parents(folder, 0755);
+	free(folder);
+
+	GError* error = NULL;
+	_File_Utils_Context context = { .durability = pwml->durability };
+	_file_utils_set_contents(&context, path, json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN), -1, &error);
+	json_object_put(root);
+	if (error) {
+		g_printerr("Failed to write %s\nGError: %s\n", path, error->message);
+		g_error_free(error);
+		return false;
+	}
+	return true;
+}
+
+static void __pwml_profile_read_state(PWML* pwml, char** current, char** previous) {
+	const char* path = g_build_filename(pwml->working_directory, PWML_PROFILES_FOLDER, PWML_PROFILES_JSON, NULL);
+	json_object* root = __pwml_profile_read_json(path);
+	free((char*)path);
+
+	json_object *j_current, *j_previous;
+	if (root && json_object_object_get_ex(root, "current", &j_current))
+		*current = strdup(json_object_get_string(j_current));
+	else
+		*current = strdup(PWML_DEFAULT_PROFILE);
+	if (root && json_object_object_get_ex(root, "previous", &j_previous))
+		*previous = strdup(json_object_get_string(j_previous));
+	else
+		*previous = NULL;
+
+	if (root)
+		json_object_put(root);
+}
+
+static bool __pwml_profile_write_state(PWML* pwml, const char* current, const char* previous) {
+	json_object* root = json_object_new_object();
+	json_object_object_add(root, "current", json_object_new_string(current));
+	if (previous)
+		json_object_object_add(root, "previous", json_object_new_string(previous));
+
+	const char* path = g_build_filename(pwml->working_directory, PWML_PROFILES_FOLDER, PWML_PROFILES_JSON, NULL);
+	bool success = __pwml_profile_write_json(pwml, path, root);
+	free((char*)path);
+	return success;
+}
+
+static int __pwml_profile_compare_ids(const void* a, const void* b) {
+	return strcmp(a, b);
+}
+
+// In apply order, which is what the profile's file keeps
+static GPtrArray* __pwml_profile_get_active_ids(PWML* pwml) {
+	GPtrArray* mods = g_ptr_array_new();
+	g_rw_lock_reader_lock(&pwml->catalog_lock);
+
+	GHashTableIter iter;
+	g_hash_table_iter_init(&iter, pwml->mods);
+
+	PWML_Mod* mod;
+	while (g_hash_table_iter_next(&iter, NULL, (void**)&mod)) {
+		if (mod->active)
+			g_ptr_array_add(mods, mod);
+	}
+	g_ptr_array_sort_values(mods, _pwml_mod_compare_apply_order);
+
+	GPtrArray* ids = g_ptr_array_new_with_free_func(free);
+	for (uint i = 0; i < mods->len; i++) {
+		g_ptr_array_add(ids, strdup(((PWML_Mod*)g_ptr_array_index(mods, i))->id));
+	}
+
+	g_rw_lock_reader_unlock(&pwml->catalog_lock);
+	g_ptr_array_free(mods, true);
+	return ids;
+}
+
+static json_object* __pwml_profile_ids_to_json(GPtrArray* ids) {
+	json_object* root = json_object_new_object();
+	json_object* active = json_object_new_array();
+	for (uint i = 0; i < ids->len; i++) {
+		json_object_array_add(active, json_object_new_string(g_ptr_array_index(ids, i)));
+	}
+	json_object_object_add(root, "active", active);
+	return root;
+}
+
+// NULL if there's no such profile
+static GPtrArray* __pwml_profile_read_set(PWML* pwml, const char* name) {
+	char* path = __pwml_profile_get_path(pwml, name, PWML_PROFILE_JSON);
+	json_object* root = __pwml_profile_read_json(path);
+	free(path);
+	if (!root)
+		return NULL;
+
+	GPtrArray* ids = g_ptr_array_new_with_free_func(free);
+	json_object* active;
+	if (json_object_object_get_ex(root, "active", &active) && json_object_get_type(active) == json_type_array) {
+		uint len = json_object_array_length(active);
+		for (uint i = 0; i < len; i++) {
+			json_object* id = json_object_array_get_idx(active, i);
+			if (json_object_get_type(id) == json_type_string)
+				g_ptr_array_add(ids, strdup(json_object_get_string(id)));
+		}
+	}
+
+	json_object_put(root);
+	return ids;
+}
+
+static bool __pwml_profile_write_set(PWML* pwml, const char* name, GPtrArray* ids) {
+	char* path = __pwml_profile_get_path(pwml, name, PWML_PROFILE_JSON);
+	bool success = __pwml_profile_write_json(pwml, path, __pwml_profile_ids_to_json(ids));
+	free(path);
+	return success;
+}
+
+// Makes ids the active mods in that order, in the catalog and in active_mods.json
+static void __pwml_profile_activate(PWML* pwml, GPtrArray* ids) {
+	// Id -> position counting from 1, like pwml_load_mods reads active_mods.json
+	GHashTable* positions = g_hash_table_new(g_str_hash, g_str_equal);
+	for (uint i = 0; i < ids->len; i++) {
+		if (!g_hash_table_contains(positions, g_ptr_array_index(ids, i)))
+			g_hash_table_insert(positions, g_ptr_array_index(ids, i), GUINT_TO_POINTER(i + 1));
+	}
+
+	g_rw_lock_writer_lock(&pwml->catalog_lock);
+	GHashTableIter iter;
+	g_hash_table_iter_init(&iter, pwml->mods);
+
+	PWML_Mod* mod;
+	while (g_hash_table_iter_next(&iter, NULL, (void**)&mod)) {
+		guint position = GPOINTER_TO_UINT(g_hash_table_lookup(positions, mod->id));
+		mod->active = position != 0;
+		if (mod->active)
+			mod->priority = position;
+	}
+	g_rw_lock_writer_unlock(&pwml->catalog_lock);
+	g_hash_table_destroy(positions);
+
+	const char* path = g_build_filename(pwml->working_directory, PWML_ACTIVE_MODS_JSON, NULL);
+	__pwml_profile_write_json(pwml, path, __pwml_profile_ids_to_json(ids));
+	free((char*)path);
+}
+
+static void __pwml_profile_fingerprint_folder(GChecksum* checksum, const char* path) {
+	GDir* dir = g_dir_open(path, 0, NULL);
+	if (!dir)
+		return;
+
+	GPtrArray* names = g_ptr_array_new_with_free_func(free);
+	const char* name;
+	while ((name = g_dir_read_name(dir))) {
+		g_ptr_array_add(names, strdup(name));
+	}
+	g_dir_close(dir);
+	// Directory order can change without the files changing
+	g_ptr_array_sort_values(names, __pwml_profile_compare_ids);
+
+	for (uint i = 0; i < names->len; i++) {
+		char* file_path = g_build_filename(path, g_ptr_array_index(names, i), NULL);
+		struct stat stat_buf;
+		if (lstat(file_path, &stat_buf) == 0) {
+			gint64 mtime = (gint64)stat_buf.st_mtim.tv_sec * 1000000000 + stat_buf.st_mtim.tv_nsec;
+			char* line = g_strdup_printf("\n%s\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT, file_path, (gint64)stat_buf.st_size, mtime);
+			g_checksum_update(checksum, (const guchar*)line, -1);
+			free(line);
+			if (S_ISDIR(stat_buf.st_mode))
+				__pwml_profile_fingerprint_folder(checksum, file_path);
+		}
+		free(file_path);
+	}
+
+	g_ptr_array_free(names, true);
+}
+
+// Every file the mods would deploy by path, size and mtime, along with how they are deployed
+static char* __pwml_profile_fingerprint(PWML* pwml, GPtrArray* ids) {
+	GChecksum* checksum = g_checksum_new(G_CHECKSUM_SHA256);
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		char* line = g_strdup_printf("strategy\t%u\t%d\n", type, pwml->deploy_strategies[type]);
+		g_checksum_update(checksum, (const guchar*)line, -1);
+		free(line);
+	}
+
+	for (uint i = 0; i < ids->len; i++) {
+		const char* id = g_ptr_array_index(ids, i);
+		char* line = g_strdup_printf("\nmod\t%s", id);
+		g_checksum_update(checksum, (const guchar*)line, -1);
+		free(line);
+
+		const char* mod_data_path = g_build_filename(pwml->mods_path, id, PWML_MOD_DATA_FOLDER, NULL);
+		__pwml_profile_fingerprint_folder(checksum, mod_data_path);
+		free((char*)mod_data_path);
+
+		// Changing the ignore rules changes what is deployed too
+		const char* ignore_path = g_build_filename(pwml->mods_path, id, PWML_MOD_IGNORE_FILE, NULL);
+		struct stat stat_buf;
+		if (lstat(ignore_path, &stat_buf) == 0) {
+			gint64 mtime = (gint64)stat_buf.st_mtim.tv_sec * 1000000000 + stat_buf.st_mtim.tv_nsec;
+			char* ignore_line = g_strdup_printf("\n%s\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT, ignore_path, (gint64)stat_buf.st_size, mtime);
+			g_checksum_update(checksum, (const guchar*)ignore_line, -1);
+			free(ignore_line);
+		}
+		free((char*)ignore_path);
+	}
+
+	char* fingerprint = strdup(g_checksum_get_string(checksum));
+	g_checksum_free(checksum);
+	return fingerprint;
+}
+
+void _pwml_profile_store_fingerprint(PWML* pwml, GPtrArray* mods) {
+	const char* profiles_path = g_build_filename(pwml->working_directory, PWML_PROFILES_FOLDER, NULL);
+	bool in_use = g_file_test(profiles_path, G_FILE_TEST_IS_DIR);
+	free((char*)profiles_path);
+	if (!in_use)
+		return;
+
+	const char* cache_folder = g_build_filename(pwml->working_directory, PWML_CACHE_FOLDER, NULL);
+	const char* path = g_build_filename(cache_folder, PWML_DEPLOYED_FINGERPRINT, NULL);
+	if (!mods) {
+		remove(path);
+		free((char*)path);
+		free((char*)cache_folder);
+		return;
+	}
+
+	gint64 trace_start = _pwml_trace_begin();
+	GPtrArray* ids = g_ptr_array_new();
+	// Already in apply order, which changes what is deployed as much as the files do
+	for (uint i = 0; i < mods->len; i++) {
+		g_ptr_array_add(ids, (char*)((PWML_Mod*)g_ptr_array_index(mods, i))->id);
+	}
+	char* fingerprint = __pwml_profile_fingerprint(pwml, ids);
+	g_ptr_array_free(ids, true);
+
+	g_mkdir_with_parents(cache_folder, 0755);
+
+	GError* error = NULL;
+	_File_Utils_Context context = { .durability = pwml->durability };
+	_file_utils_set_contents(&context, path, fingerprint, -1, &error);
+	if (error) {
+		g_printerr("Failed to write %s\nGError: %s\n", path, error->message);
+		g_error_free(error);
+	}
+
+	free(fingerprint);
+	free((char*)path);
+	free((char*)cache_folder);
+	_pwml_trace_end("profile", "store_fingerprint", NULL, trace_start);
+}
+
+// Renames the game folders and the cache files describing them into deployment_path, or back out of it.
+// Anything that isn't there is skipped, so a half done move can be undone by moving the other way.
+static bool __pwml_profile_move_deployment(PWML* pwml, const char* deployment_path, bool into_game) {
+	bool success = true;
+	for (uint type = 0; type < PWML_RESOURCE_COUNT && success; type++) {
+		const char* game_path = _pwml_resource_get_path(pwml, type);
+		char* stored_path = g_build_filename(deployment_path, *_pwml_resource_get_handler(type)->folder, NULL);
+		const char* from = into_game ? stored_path : game_path;
+		const char* to = into_game ? game_path : stored_path;
+		if (g_file_test(from, G_FILE_TEST_EXISTS) && rename(from, to) != 0) {
+			g_printerr("Failed to move %s to %s\n", from, to);
+			success = false;
+		}
+		free(stored_path);
+	}
+
+	const char* cache_folder = g_build_filename(pwml->working_directory, PWML_CACHE_FOLDER, NULL);
+	g_mkdir_with_parents(cache_folder, 0755);
+	for (uint i = 0; i < G_N_ELEMENTS(DEPLOYMENT_CACHE_FILES) && success; i++) {
+		char* live_path = g_build_filename(cache_folder, *DEPLOYMENT_CACHE_FILES[i], NULL);
+		char* stored_path = g_build_filename(deployment_path, *DEPLOYMENT_CACHE_FILES[i], NULL);
+		const char* from = into_game ? stored_path : live_path;
+		const char* to = into_game ? live_path : stored_path;
+		if (g_file_test(from, G_FILE_TEST_EXISTS) && rename(from, to) != 0) {
+			g_printerr("Failed to move %s to %s\n", from, to);
+			success = false;
+		}
+		free(live_path);
+		free(stored_path);
+	}
+	free((char*)cache_folder);
+
+	// The manifest in memory described the folders that just moved
+	_pwml_deploy_free(pwml);
+	return success;
+}
+
+static bool __pwml_profile_deployment_matches(const char* deployment_path, const char* fingerprint) {
+	char* path = g_build_filename(deployment_path, PWML_DEPLOYED_FINGERPRINT, NULL);
+	char* stored;
+	bool matches = g_file_get_contents(path, &stored, NULL, NULL);
+	free(path);
+	if (!matches)
+		return false;
+	matches = g_str_equal(stored, fingerprint);
+	free(stored);
+	return matches;
+}
+
+static void __pwml_profile_delete_folder(const char* path) {
+	if (g_file_test(path, G_FILE_TEST_EXISTS))
+		_file_utils_delete_recursive(NULL, path);
+}
+
+bool pwml_save_profile(PWML* pwml, const char* name) {
+	if (!__pwml_profile_is_valid_name(name)) {
+		g_printerr("Invalid profile name %s\n", name);
+		return false;
+	}
+
+	g_mutex_lock(&pwml->apply_mutex);
+	GPtrArray* ids = __pwml_profile_get_active_ids(pwml);
+	bool success = __pwml_profile_write_set(pwml, name, ids);
+	g_ptr_array_free(ids, true);
+	g_mutex_unlock(&pwml->apply_mutex);
+	return success;
+}
+
+bool pwml_switch_profile(PWML* pwml, const char* name) {
+	if (!__pwml_profile_is_valid_name(name)) {
+		g_printerr("Invalid profile name %s\n", name);
+		return false;
+	}
+
+	g_mutex_lock(&pwml->apply_mutex);
+	gint64 trace_start = _pwml_trace_begin();
+	char *current, *previous;
+	__pwml_profile_read_state(pwml, &current, &previous);
+
+	if (g_str_equal(current, name)) {
+		free(current);
+		free(previous);
+		g_mutex_unlock(&pwml->apply_mutex);
+		return true;
+	}
+
+	GPtrArray* ids = __pwml_profile_read_set(pwml, name);
+	if (!ids) {
+		g_printerr("Couldn't switch to profile %s; No such profile exists.\n", name);
+		free(current);
+		free(previous);
+		g_mutex_unlock(&pwml->apply_mutex);
+		return false;
+	}
+
+	bool success = false;
+	char* current_deployment = __pwml_profile_get_path(pwml, current, PWML_PROFILE_DEPLOYMENT_FOLDER);
+	char* target_deployment = __pwml_profile_get_path(pwml, name, PWML_PROFILE_DEPLOYMENT_FOLDER);
+
+	// The live deployment, and whatever was activated since it was applied, belong to the current profile
+	GPtrArray* current_ids = __pwml_profile_get_active_ids(pwml);
+	__pwml_profile_write_set(pwml, current, current_ids);
+
+	char* fingerprint = __pwml_profile_fingerprint(pwml, ids);
+	bool reusable = __pwml_profile_deployment_matches(target_deployment, fingerprint);
+	free(fingerprint);
+
+	__pwml_profile_delete_folder(current_deployment);
+	g_mkdir_with_parents(current_deployment, 0755);
+	if (!__pwml_profile_move_deployment(pwml, current_deployment, false)) {
+		__pwml_profile_move_deployment(pwml, current_deployment, true);
+		goto cleanup;
+	}
+
+	if (reusable) {
+		if (!__pwml_profile_move_deployment(pwml, target_deployment, true)) {
+			__pwml_profile_move_deployment(pwml, target_deployment, false);
+			__pwml_profile_move_deployment(pwml, current_deployment, true);
+			goto cleanup;
+		}
+		__pwml_profile_activate(pwml, ids);
+	} else {
+		// Out of date, it's applied from scratch into empty folders
+		__pwml_profile_delete_folder(target_deployment);
+		for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+			g_mkdir_with_parents(_pwml_resource_get_path(pwml, type), 0755);
+		}
+
+		__pwml_profile_activate(pwml, ids);
+		if (!_pwml_apply_mods_locked(pwml)) {
+			for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+				__pwml_profile_delete_folder(_pwml_resource_get_path(pwml, type));
+			}
+			__pwml_profile_move_deployment(pwml, current_deployment, true);
+			__pwml_profile_activate(pwml, current_ids);
+			goto cleanup;
+		}
+	}
+
+	__pwml_profile_write_state(pwml, name, current);
+	_File_Utils_Context context = { .durability = pwml->durability };
+	_file_utils_sync_filesystem(&context, pwml->working_directory);
+	success = true;
+
+cleanup:
+	_pwml_trace_end("profile", "pwml_switch_profile", name, trace_start);
+	g_ptr_array_free(current_ids, true);
+	g_ptr_array_free(ids, true);
+	free(current_deployment);
+	free(target_deployment);
+	free(current);
+	free(previous);
+	g_mutex_unlock(&pwml->apply_mutex);
+	return success;
+}
+
+bool pwml_rollback_profile(PWML* pwml) {
+	char *current, *previous;
+	__pwml_profile_read_state(pwml, &current, &previous);
+	free(current);
+	if (!previous) {
+		g_printerr("Couldn't roll back; No profile was switched from.\n");
+		return false;
+	}
+
+	bool success = pwml_switch_profile(pwml, previous);
+	free(previous);
+	return success;
+}
+
+GPtrArray* pwml_list_profiles(PWML* pwml) {
+	GPtrArray* profiles = g_ptr_array_new();
+	const char* profiles_path = g_build_filename(pwml->working_directory, PWML_PROFILES_FOLDER, NULL);
+	GDir* dir = g_dir_open(profiles_path, 0, NULL);
+	free((char*)profiles_path);
+	if (!dir)
+		return profiles;
+
+	const char* name;
+	while ((name = g_dir_read_name(dir))) {
+		char* path = __pwml_profile_get_path(pwml, name, PWML_PROFILE_JSON);
+		if (g_file_test(path, G_FILE_TEST_EXISTS))
+			g_ptr_array_add(profiles, strdup(name));
+		free(path);
+	}
+
+	g_dir_close(dir);
+	return profiles;
+}
+
+char* pwml_get_current_profile(PWML* pwml) {
+	char *current, *previous;
+	__pwml_profile_read_state(pwml, &current, &previous);
+	free(previous);
+	return current;
+}
+
+bool pwml_delete_profile(PWML* pwml, const char* name) {
+	if (!__pwml_profile_is_valid_name(name)) {
+		g_printerr("Invalid profile name %s\n", name);
+		return false;
+	}
+
+	g_mutex_lock(&pwml->apply_mutex);
+	char *current, *previous;
+	__pwml_profile_read_state(pwml, &current, &previous);
+
+	bool success = false;
+	if (g_str_equal(current, name)) {
+		g_printerr("Couldn't delete profile %s; It is the current profile.\n", name);
+	} else {
+		char* path = __pwml_profile_get_path(pwml, name, NULL);
+		__pwml_profile_delete_folder(path);
+		free(path);
+		if (previous && g_str_equal(previous, name))
+			__pwml_profile_write_state(pwml, current, NULL);
+		success = true;
+	}
+
+	free(current);
+	free(previous);
+	g_mutex_unlock(&pwml->apply_mutex);
+	return success;
+}
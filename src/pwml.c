@@ -1,16 +1,29 @@
 #include "PWML/pwml.h"
+#include "PWML/bounded_queue.h"
+#include "PWML/cache.h"
+#include "PWML/deploy.h"
 #include "PWML/file_utils.h"
+#include "PWML/json_utils.h"
+#include "PWML/line_utils.h"
 #include "PWML/mod.h"
+#include "PWML/profile.h"
+#include "PWML/resource.h"
+#include "PWML/schedule_utils.h"
+#include "PWML/stats.h"
+#include "PWML/trace.h"
+#include "PWML/vanilla.h"
 #include "PWML/weapon.h"
 #include "PWML/xml_utils.h"
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <json-c/json_object.h>
-#include <json-c/json_tokener.h>
 #include <json-c/json_types.h>
+#include <libxml/parser.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <json-c/json.h>
+#include <stdio.h>
 
 const char* const PWML_MODS_FOLDER = "mods";
 
@@ -25,6 +38,7 @@ const char* const PWML_WEAPONS_DAT = "Weapons.dat";
 
 const char* const PWML_METADATA_JSON = "metadata.json";
 const char* const PWML_MOD_DESCRIPTION_FILE = "description.pango";
+const char* const PWML_MOD_IGNORE_FILE = ".pwmlignore";
 const char* const PWML_ACTIVE_MODS_JSON = "active_mods.json";
 const char* const PWML_WEAPON_JSON = "weapon.json";
 const char* const PWML_BUILTIN_WEAPONS_JSON = "builtin_weapons.json";
@@ -72,7 +86,7 @@ typedef enum {
 
 
 
-static GHashTable* _pwml_parse_weapons_dat(PWML* pwml, const char* weapons_path) {
+GHashTable* _pwml_parse_weapons_dat(PWML* pwml, const char* weapons_path) {
 	char* contents;
 	GError* error = NULL;
 	
@@ -175,235 +189,17 @@ static GHashTable* _pwml_parse_weapons_dat(PWML* pwml, const char* weapons_path)
 	return weapons;
 }
 
-static const char* __pwml_get_vanilla_mod_data_folder(PWML* pwml) {
-	const char* vanilla_mod_path = g_build_filename(pwml->mods_path, "vanilla", NULL);
-	const char* vanilla_mod_data = g_build_filename(vanilla_mod_path, PWML_MOD_DATA_FOLDER, NULL);
-	free((char*)vanilla_mod_path);
-	return vanilla_mod_data;
-}
-
-static bool __pwml_clone_vanilla_weapons(PWML* pwml) {
-	GHashTable* weapons = _pwml_parse_weapons_dat(pwml, PWML_WEAPONS_FOLDER);
-	if (!weapons) {
-		g_printerr("Failed to retrieve vanilla weapons\n");
-		return false;
-	}
-
-	const char* vanilla_mod_data = __pwml_get_vanilla_mod_data_folder(pwml);
-	const char* vanilla_mod_weapons = g_build_filename(vanilla_mod_data, PWML_WEAPONS_FOLDER, NULL);
-
-	if (g_mkdir_with_parents(vanilla_mod_weapons, 0755) == -1) {
-		g_print("Failed to make vanilla weapons directory\n");
-		return false;
-	};
-
-	GPtrArray* files = _file_utils_list_files_in_directory(pwml->weapons_path);
-	for (uint i = 0; i < files->len; i++) {
-		const char* path = g_ptr_array_index(files, i);
-		if (_file_utils_is_dir(path)) {
-			_PWML_Weapon* weapon;
-			const char* name = g_path_get_basename(path);
-			if (g_hash_table_contains(weapons, name)) {
-				weapon = g_hash_table_lookup(weapons, name);
-				weapon->has_built_in_files = false;
-			} else {
-				weapon = malloc(sizeof(_PWML_Weapon));
-				weapon->name = g_strdup(name);
-				weapon->pilot = false;
-				weapon->ship = false;
-				weapon->has_built_in_files = false;
-			}
-
-			_file_utils_copy_recursive(path, vanilla_mod_weapons);
-			const char* weapon_json_path = g_build_filename(vanilla_mod_weapons, name, PWML_WEAPON_JSON, NULL);
-
-			json_object* root = json_object_new_object();
-
-			json_object *ship = json_object_new_boolean(weapon->ship);
-			json_object_object_add(root, "ship", ship);
-			
-			json_object *pilot = json_object_new_boolean(weapon->pilot);
-			json_object_object_add(root, "pilot", pilot);
-
-			const char* json_str = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
-
-			GError* error = NULL;
-			g_file_set_contents(weapon_json_path, json_str, -1, &error);
-			if (error) {
-				g_printerr("Failed to write weapon json at %s\nGError: %s\n", weapon_json_path, error->message);
-				g_free(error);
-			}
-
-			json_object_put(root);
-
-			free((char*)name);
-			free((char*)weapon_json_path);
-		}
-	}
-
-	json_object* root = json_object_new_object();
-	json_object* j_weapons = json_object_new_array();
-
-	GHashTableIter iter;
-	g_hash_table_iter_init(&iter, weapons);
-
-	_PWML_Weapon* weapon;
-	while (g_hash_table_iter_next(&iter, NULL, (void**)&weapon)) {
-		if (weapon->has_built_in_files) {
-			json_object* j_weapon = json_object_new_object();
-
-			json_object* name = json_object_new_string(weapon->name);
-			json_object_object_add(j_weapon, "name", name);
-			json_object* ship = json_object_new_boolean(weapon->ship);
-			json_object_object_add(j_weapon, "ship", ship);
-			json_object* pilot = json_object_new_boolean(weapon->pilot);
-			json_object_object_add(j_weapon, "pilot", pilot);
-
-			json_object_array_add(j_weapons, j_weapon);
-		}
-	}
-
-	json_object_object_add(root, "weapons", j_weapons);
-
-	const char* built_in_weapons_json_path = g_build_filename(pwml->mods_path, "vanilla", PWML_MOD_DATA_FOLDER, PWML_WEAPONS_FOLDER, PWML_BUILTIN_WEAPONS_JSON, NULL);
-	const char* json_str = json_object_to_json_string(root);
-
-	GError* error = NULL;
-	g_file_set_contents(built_in_weapons_json_path, json_str, -1, &error);
-	if (error) {
-		g_printerr("Failed to write json file %s\n", built_in_weapons_json_path);
-		g_error_free(error);
-	}
-
-	json_object_put(root);
-	free((char*)built_in_weapons_json_path);
-	free((char*)vanilla_mod_data);
-	free((char*)vanilla_mod_weapons);
-	g_hash_table_destroy(weapons);
-	g_ptr_array_free(files, true);
-
-	return true;
-}
-
-static bool __pwml_clone_vanilla_levels(PWML* pwml) {
-	const char* vanilla_mod_data = __pwml_get_vanilla_mod_data_folder(pwml);
-	const char* vanilla_mod_levels = g_build_filename(vanilla_mod_data, PWML_LEVELS_FOLDER, NULL);
-	
-	if (g_mkdir_with_parents(vanilla_mod_levels, 0755) == -1) {
-		g_print("Failed to make vanilla levels directory\n");
-		return false;
-	};
-
-	GPtrArray* files = _file_utils_list_files_in_directory(pwml->levels_path);
-	for (uint i = 0; i < files->len; i++) {
-		const char* path = g_ptr_array_index(files, i);
-
-		const char* basename = g_path_get_basename(path);
-		if (g_str_equal(basename, "received")) {
-			free((char*)basename);
-			continue;
-		}
-		free((char*)basename);
-
-		_file_utils_copy_recursive(path, vanilla_mod_levels);
-	}
-
-	g_ptr_array_free(files, true);
-
-	free((char*)vanilla_mod_data);
-	free((char*)vanilla_mod_levels);
-
-	return true;
-}
-
-static bool __pwml_clone_vanilla_folder_simple(PWML* pwml, const char* folder) {
-	const char* vanilla_mod_data = __pwml_get_vanilla_mod_data_folder(pwml);
-	const char* vanilla_mod_folder_path = g_build_filename(vanilla_mod_data, folder, NULL);
-
-	if (g_mkdir_with_parents(vanilla_mod_folder_path, 0755) == -1) {
-		g_printerr("Failed to clone %s\n", folder);
-		free((char*)vanilla_mod_data);
-		free((char*)vanilla_mod_folder_path);
-		return false;
-	}
-	const char* folder_path = g_build_filename(pwml->working_directory, folder, NULL);
-	_file_utils_copy_all(folder_path, vanilla_mod_folder_path);
-
-	free((char*)folder_path);
-	free((char*)vanilla_mod_data);
-	free((char*)vanilla_mod_folder_path);
-
-	return true;
-}
-
-static void _pwml_clone_vanilla(PWML* pwml) {
-	const char* vanilla_mod_path = g_build_filename(pwml->mods_path, "vanilla", NULL);
-
-	if (g_mkdir_with_parents(vanilla_mod_path, 0755) == -1) {
-		g_printerr("Failed to make vanilla mod folder at %s\n", vanilla_mod_path);
-		return;
-	}
-
-	json_object* root = json_object_new_object();
-
-	json_object* name = json_object_new_string("Vanilla");
-	json_object_object_add(root, "name", name);
-
-	json_object* description = json_object_new_string("Base Wings 2 by Miika Virpioja et al.");
-	json_object_object_add(root, "short_description", description);
-
-	const char* metadata_path = g_build_filename(vanilla_mod_path, PWML_METADATA_JSON, NULL);
-
-	const char* json_str = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
-
-	GError* error = NULL;
-	g_file_set_contents(metadata_path, json_str, -1, &error);
-	if (error) {
-		g_printerr("Failed to write vanilla mod metadata json at %s\nGError: %s\n", metadata_path, error->message);
-		g_free(error);
-	}
-
-	json_object_put(root);
-	free((char*)metadata_path);
-
-	if (!__pwml_clone_vanilla_weapons(pwml)) {
-		g_printerr("Vanilla weapon cloning failed\n");
-		return;
-	}
-
-	if (!__pwml_clone_vanilla_levels(pwml)) {
-		g_printerr("Vanilla level cloning failed\n");
-		return;
-	}
-
-	if (!__pwml_clone_vanilla_folder_simple(pwml, PWML_OBJECTS_FOLDER)) {
-		g_printerr("Vanilla object cloning failed\n");
-		return;
-	}
-
-	if (!__pwml_clone_vanilla_folder_simple(pwml, PWML_SOUND_FOLDER)) {
-		g_printerr("Vanilla sound cloning failed\n");
-		return;
-	}
-
-	if (!__pwml_clone_vanilla_folder_simple(pwml, PWML_MUSIC_FOLDER)) {
-		g_printerr("Vanilla music cloning failed\n");
-		return;
-	}
-	
-	if (!__pwml_clone_vanilla_folder_simple(pwml, PWML_GRAPHICS_FOLDER)) {
-		g_printerr("Vanilla graphics cloning failed\n");
-		return;
-	}
-
-	free((char*)vanilla_mod_path);
-}
-
-
-
 void pwml_free(PWML* pwml) {
+	_pwml_trace_flush();
+
 	free((char*)pwml->working_directory);
+	_pwml_catalog_forget_descriptions(pwml);
 	g_hash_table_destroy(pwml->mods);
+	if (pwml->mod_strings)
+		_pwml_mod_strings_unref(pwml->mod_strings);
+	g_rw_lock_clear(&pwml->catalog_lock);
+	g_mutex_clear(&pwml->description_mutex);
+	g_mutex_clear(&pwml->apply_mutex);
 	g_ptr_array_free(pwml->weapons, true);
 
 	g_ptr_array_free(pwml->menu_music_paths, true);
@@ -419,6 +215,11 @@ void pwml_free(PWML* pwml) {
 	free((char*)pwml->weapons_path);
 	free((char*)pwml->bin_path);
 	free((char*)pwml->exectuable_path);
+	pwml_stats_free(pwml->stats);
+	g_mutex_clear(&pwml->stats_mutex);
+	_pwml_search_index_free(pwml->search_index);
+	_pwml_cache_free(pwml);
+	_pwml_deploy_free(pwml);
 	free(pwml);
 }
 
@@ -429,12 +230,19 @@ PWML* pwml_new(const char* working_directory) {
 	PWML* pwml = malloc(sizeof(PWML));
 
 	pwml->working_directory = g_strdup(working_directory);
-	pwml->mods = g_hash_table_new(g_str_hash, g_str_equal);
+	g_rw_lock_init(&pwml->catalog_lock);
+	g_mutex_init(&pwml->apply_mutex);
+	pwml->mods = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _pwml_mod_unref);
+	pwml->mod_strings = NULL;
+	g_mutex_init(&pwml->description_mutex);
+	g_queue_init(&pwml->description_lru);
+	pwml->description_bytes = 0;
+	pwml->description_budget = 0;
 	pwml->weapons = g_ptr_array_new_with_free_func(_pwml_weapon_free);
 
-	pwml->menu_music_paths = g_ptr_array_new();
-	pwml->graphics_xml_paths = g_ptr_array_new();
-	pwml->sounds_xml_paths = g_ptr_array_new();
+	pwml->menu_music_paths = g_ptr_array_new_with_free_func(free);
+	pwml->graphics_xml_paths = g_ptr_array_new_with_free_func(free);
+	pwml->sounds_xml_paths = g_ptr_array_new_with_free_func(free);
 
 	pwml->bin_path = g_build_filename(pwml->working_directory, PWML_BIN_FOLDER, NULL);
 	pwml->graphics_path = g_build_filename(pwml->working_directory, PWML_GRAPHICS_FOLDER, NULL);
@@ -445,6 +253,31 @@ PWML* pwml_new(const char* working_directory) {
 	pwml->sound_path = g_build_filename(pwml->working_directory, PWML_SOUND_FOLDER, NULL);
 	pwml->weapons_path = g_build_filename(pwml->working_directory, PWML_WEAPONS_FOLDER, NULL);
 	pwml->exectuable_path = g_build_filename(pwml->bin_path, PWML_WINGS_EXECUTABLE, NULL);
+
+	pwml->copy_order = PWML_COPY_ORDER_INODE;
+	const char* copy_order = g_getenv("PWML_COPY_ORDER");
+	if (copy_order && !_schedule_utils_parse_order(copy_order, &pwml->copy_order))
+		g_printerr("Unknown PWML_COPY_ORDER %s, expected none, inode or physical\n", copy_order);
+
+	pwml->durability = PWML_DURABILITY_BATCHED;
+	const char* durability = g_getenv("PWML_DURABILITY");
+	if (durability && !_file_utils_parse_durability(durability, &pwml->durability))
+		g_printerr("Unknown PWML_DURABILITY %s, expected none, batched or strict\n", durability);
+
+	pwml->capture_mode = PWML_CAPTURE_COPY;
+	const char* capture_mode = g_getenv("PWML_CAPTURE");
+	if (capture_mode && !_pwml_resource_parse_capture_mode(capture_mode, &pwml->capture_mode))
+		g_printerr("Unknown PWML_CAPTURE %s, expected copy, link, reflink or move\n", capture_mode);
+
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++)
+		pwml->deploy_strategies[type] = PWML_DEPLOY_COPY;
+
+	g_mutex_init(&pwml->stats_mutex);
+	pwml->stats = NULL;
+	pwml->search_index = NULL;
+	pwml->generated_cache = NULL;
+	pwml->generated_cache_dirty = false;
+	pwml->deploy_manifest = NULL;
 	
 	if (!_pwml_ensure_folder(pwml, PWML_MODS_FOLDER)) {
 		pwml_free(pwml);
@@ -453,7 +286,7 @@ PWML* pwml_new(const char* working_directory) {
 
 	const char* active_mods_json_path = g_build_filename(pwml->working_directory, PWML_ACTIVE_MODS_JSON, NULL);
 	if (!g_file_test(active_mods_json_path, G_FILE_TEST_EXISTS)) {
-		_pwml_clone_vanilla(pwml);
+		_pwml_vanilla_capture(pwml);
 
 		json_object* root = json_object_new_object();
 
@@ -464,11 +297,14 @@ PWML* pwml_new(const char* working_directory) {
 		const char* json_str = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
 
 		GError* error = NULL;
-		g_file_set_contents(active_mods_json_path, json_str, -1, &error);
+		_File_Utils_Context context = { .durability = pwml->durability };
+		_file_utils_set_contents(&context, active_mods_json_path, json_str, -1, &error);
 		if (error) {
 			g_printerr("Failed to write active_mods.json: %s\n", error->message);
 			g_free(error);
 		}
+		// active_mods.json is what says the clone is done, so it is synced along with the clone
+		_file_utils_sync_filesystem(&context, pwml->working_directory);
 
 		json_object_put(root);
 	}
@@ -480,108 +316,66 @@ PWML* pwml_new(const char* working_directory) {
 
 
 
-static PWML_Mod* _pwml_load_mod(const char* path) {
-	PWML_Mod* mod = malloc(sizeof(PWML_Mod));
-	mod->path = g_strdup(path);
-	mod->id = g_path_get_basename(path);
-	mod->name = NULL;
-	mod->short_description = NULL;
-	mod->description = NULL;
-	mod->active = false;
-	
-	char* buffer;
-	GError* error = NULL;
-
-	const char* metadata_path = g_build_filename(mod->path, PWML_METADATA_JSON, NULL);
-	if (!g_file_test(metadata_path, G_FILE_TEST_EXISTS)) {
-		g_printerr("Missing metadata for mod %s\n", mod->id);
-		pwml_mod_free(mod);
-		free((char*)metadata_path);
-		return NULL;
-	}
-
-	if (!g_file_get_contents(metadata_path, &buffer, NULL, &error)) {
-		g_printerr("Error reading file %s: %s\n", metadata_path, error->message);
-		pwml_mod_free(mod);
-		g_error_free(error);
-		free((char*)metadata_path);
-		return NULL;
-	}
-
-	json_object* parsed_json = json_tokener_parse(buffer);
-	free(buffer);
-
-	if (!parsed_json) {
-		g_printerr("Failed to parse json for %s\n", metadata_path);
-		pwml_mod_free(mod);
-		free((char*)metadata_path);
-		return NULL;
+// path is the mod's folder in mods_path
+static PWML_Mod* _pwml_load_mod(const char* mods_path, const char* path, _PWML_ModStrings* strings) {
+	json_object *name, *description;
+	bool missing;
+	json_object* parsed_json = _pwml_mod_read_metadata(path, &missing, &name, &description);
+	if (missing) {
+		const char* id = g_path_get_basename(path);
+		g_printerr("Missing metadata for mod %s\n", id);
+		free((char*)id);
 	}
-
-	struct json_object *name, *description;
-	if (!json_object_object_get_ex(parsed_json, "name", &name)) {
-		g_printerr("Missing name field in %s\n", metadata_path);
-		pwml_mod_free(mod);
-		json_object_put(parsed_json);
-		free((char*)metadata_path);
+	if (!parsed_json)
 		return NULL;
-	}
-	if (!json_object_object_get_ex(parsed_json, "short_description", &description)) {
-		g_printerr("Missing short_description field in %s\n", metadata_path);
-		pwml_mod_free(mod);
-		json_object_put(parsed_json);
-		free((char*)metadata_path);
-		return NULL;
-	}
-	
-	free((char*)metadata_path);
 
-	mod->name = g_strdup(json_object_get_string(name));
-	mod->short_description = g_strdup(json_object_get_string(description));
+	// Only mods that load take up space in the catalog's strings
+	PWML_Mod* mod = malloc(sizeof(PWML_Mod));
+	mod->strings = _pwml_mod_strings_ref(strings);
+	mod->mods_path = _pwml_mod_strings_insert(strings, mods_path);
+	// The id is the end of the path
+	const char* separator = strrchr(path, G_DIR_SEPARATOR);
+	mod->id = _pwml_mod_strings_insert(strings, separator ? separator + 1 : path);
+	mod->name = _pwml_mod_strings_insert(strings, json_object_get_string(name));
+	mod->short_description = _pwml_mod_strings_insert(strings, json_object_get_string(description));
+	mod->description = NULL;
+	mod->description_link = NULL;
+	mod->active = false;
+	mod->priority = 0;
+	mod->ref_count = 1;
 
 	json_object_put(parsed_json);
 
 	return mod;
 }
 
+// Id -> position in active_mods.json counting from 1
 static GHashTable* _pwml_get_active_mods(PWML* pwml) {
-	GHashTable* active_mods = g_hash_table_new(g_str_hash, g_str_equal);
+	GHashTable* active_mods = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
 
 	const char* active_mods_json_path = g_build_filename(pwml->working_directory, PWML_ACTIVE_MODS_JSON, NULL);
-	if (g_file_test(active_mods_json_path, G_FILE_TEST_EXISTS)) {
-		char* buffer;
-		GError* error = NULL;
-
-		if (!g_file_get_contents(active_mods_json_path, &buffer, NULL, &error)){
-			g_printerr("Failed to read active_mods.json at %s\n", active_mods_json_path);
-			g_error_free(error);
-			g_hash_table_destroy(active_mods);
-			return NULL;
-		}
- 
-		json_object* root = json_tokener_parse(buffer);
-		free(buffer);
-
-		if (!root) {
-			g_printerr("Failed to parse active_mods.json at %s\n", active_mods_json_path);
-			return NULL;
-		}
+	json_object* j_active_mods;
+	const _JSON_Utils_Field fields[] = {
+		{ "active", json_type_array, &j_active_mods, false },
+	};
 
-		json_object* j_active_mods;
-		if (!json_object_object_get_ex(root, "active", &j_active_mods) || json_object_get_type(j_active_mods) != json_type_array) {
-			json_object_put(root);
-			g_printerr("Couldn't get array of active mods from %s\n", active_mods_json_path);
-			g_hash_table_destroy(active_mods);
-			return NULL;
-		}
+	bool missing;
+	json_object* root = _json_utils_load_fields(active_mods_json_path, &missing, fields, G_N_ELEMENTS(fields));
+	if (!root && !missing) {
+		g_printerr("Couldn't get array of active mods from %s\n", active_mods_json_path);
+		free((char*)active_mods_json_path);
+		g_hash_table_destroy(active_mods);
+		return NULL;
+	}
 
+	if (root) {
 		uint len = json_object_array_length(j_active_mods);
 		for (uint i = 0; i < len; i++) {
 			json_object* name = json_object_array_get_idx(j_active_mods, i);
-			if (json_object_get_type(name) != json_type_string)
+			if (json_object_get_type(name) != json_type_string || g_hash_table_contains(active_mods, json_object_get_string(name)))
 				continue;
-			
-			g_hash_table_add(active_mods, strdup(json_object_get_string(name)));
+
+			g_hash_table_insert(active_mods, strdup(json_object_get_string(name)), GUINT_TO_POINTER(i + 1));
 		}
 
 		json_object_put(root);
@@ -592,26 +386,77 @@ static GHashTable* _pwml_get_active_mods(PWML* pwml) {
 }
 
 void pwml_load_mods(PWML* pwml) {
+	gint64 load_start = _pwml_trace_begin();
 	GHashTable* active_mods = _pwml_get_active_mods(pwml);
 	GPtrArray* files = _file_utils_list_files_in_directory(pwml->mods_path);
-	
+
+	// Built on the side so queries keep using the old catalog until the swap
+	GHashTable* mods = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _pwml_mod_unref);
+	_PWML_ModStrings* strings = _pwml_mod_strings_new();
 	for (uint i = 0; i < files->len; i++) {
-		PWML_Mod* mod = _pwml_load_mod(g_ptr_array_index(files, i));
+		const char* path = g_ptr_array_index(files, i);
+		// Hidden folders aren't mods, pwml_import_mod stages new ones in them
+		const char* separator = strrchr(path, G_DIR_SEPARATOR);
+		if ((separator ? separator[1] : path[0]) == '.')
+			continue;
+
+		gint64 mod_start = _pwml_trace_begin();
+		PWML_Mod* mod = _pwml_load_mod(pwml->mods_path, path, strings);
+		_pwml_trace_end("load", "load_mod", path, mod_start);
 		if (mod) {
-			if (g_hash_table_contains(active_mods, mod->id))
+			guint position = active_mods ? GPOINTER_TO_UINT(g_hash_table_lookup(active_mods, mod->id)) : 0;
+			if (position) {
 				mod->active = true;
+				mod->priority = position;
+			}
 
-			g_hash_table_insert(pwml->mods, strdup(mod->id), mod);
+			g_hash_table_insert(mods, (char*)mod->id, mod);
 		}
 	}
 
 	g_ptr_array_free(files, true);
 	if (active_mods)
 		g_hash_table_destroy(active_mods);
+
+	_PWML_SearchIndex* search_index = _pwml_search_index_new(mods);
+
+	g_rw_lock_writer_lock(&pwml->catalog_lock);
+	GHashTable* old_mods = pwml->mods;
+	_PWML_ModStrings* old_strings = pwml->mod_strings;
+	_PWML_SearchIndex* old_search_index = pwml->search_index;
+	// Mods that were already loaded keep what pwml_set_mod_active made of them, even if it wasn't saved yet
+	GHashTableIter iter;
+	g_hash_table_iter_init(&iter, mods);
+	PWML_Mod* mod;
+	while (g_hash_table_iter_next(&iter, NULL, (void**)&mod)) {
+		PWML_Mod* old_mod = g_hash_table_lookup(old_mods, mod->id);
+		if (old_mod) {
+			mod->active = old_mod->active;
+			mod->priority = old_mod->priority;
+		}
+	}
+	pwml->mods = mods;
+	pwml->mod_strings = strings;
+	pwml->search_index = search_index;
+	g_mutex_lock(&pwml->description_mutex);
+	_pwml_catalog_forget_descriptions(pwml);
+	g_mutex_unlock(&pwml->description_mutex);
+	g_rw_lock_writer_unlock(&pwml->catalog_lock);
+
+	// A running apply keeps its own references to the mods it uses
+	g_hash_table_destroy(old_mods);
+	if (old_strings)
+		_pwml_mod_strings_unref(old_strings);
+	_pwml_search_index_free(old_search_index);
+
+	_pwml_trace_end("load", "pwml_load_mods", NULL, load_start);
+	_pwml_trace_flush();
 }
 
 GPtrArray* pwml_list_mods(PWML* pwml) {
 	GPtrArray* mods = g_ptr_array_new();
+	g_rw_lock_reader_lock(&pwml->catalog_lock);
+
 	GHashTableIter iter;
 	g_hash_table_iter_init(&iter, pwml->mods);
 
@@ -620,14 +465,35 @@ GPtrArray* pwml_list_mods(PWML* pwml) {
 		g_ptr_array_add(mods, strdup(mod->id));
 	}
 
+	g_rw_lock_reader_unlock(&pwml->catalog_lock);
 	return mods;
 }
 
+// Expects the catalog's write lock
+static guint __pwml_next_priority(PWML* pwml) {
+	guint highest = 0;
+	GHashTableIter iter;
+	g_hash_table_iter_init(&iter, pwml->mods);
+
+	PWML_Mod* mod;
+	while (g_hash_table_iter_next(&iter, NULL, (void**)&mod)) {
+		if (mod->active)
+			highest = MAX(highest, mod->priority);
+	}
+	return highest + 1;
+}
+
 void pwml_set_mod_active(PWML* pwml, const char* id, bool active) {
-	if (g_hash_table_contains(pwml->mods, id)) {
-		PWML_Mod* mod = g_hash_table_lookup(pwml->mods, id);
+	g_rw_lock_writer_lock(&pwml->catalog_lock);
+	PWML_Mod* mod = g_hash_table_lookup(pwml->mods, id);
+	// A newly activated mod goes after the ones already active
+	if (mod && active && !mod->active)
+		mod->priority = __pwml_next_priority(pwml);
+	if (mod)
 		mod->active = active;
-	} else {
+	g_rw_lock_writer_unlock(&pwml->catalog_lock);
+
+	if (!mod) {
 		char activity[11];
 		if (active)
 			strcpy(activity, "activate");
@@ -639,41 +505,93 @@ void pwml_set_mod_active(PWML* pwml, const char* id, bool active) {
 }
 
 bool pwml_is_mod_active(PWML* pwml, const char* id) {
-	return g_hash_table_contains(pwml->mods, id) ? ((PWML_Mod*)g_hash_table_lookup(pwml->mods, id))->active : false;
+	g_rw_lock_reader_lock(&pwml->catalog_lock);
+	PWML_Mod* mod = g_hash_table_lookup(pwml->mods, id);
+	bool active = mod ? mod->active : false;
+	g_rw_lock_reader_unlock(&pwml->catalog_lock);
+	return active;
 }
 
-const char* pwml_get_mod_name(PWML* pwml, const char* id) {
-	if (!g_hash_table_contains(pwml->mods, id)) {
+char* pwml_get_mod_name(PWML* pwml, const char* id) {
+	g_rw_lock_reader_lock(&pwml->catalog_lock);
+	PWML_Mod* mod = g_hash_table_lookup(pwml->mods, id);
+	char* name = mod ? strdup(mod->name) : NULL;
+	g_rw_lock_reader_unlock(&pwml->catalog_lock);
+
+	if (!mod)
 		g_printerr("Couldn't get name of mod with id %s; No such mod exists.\n", id);
-	}
-	return ((PWML_Mod*)g_hash_table_lookup(pwml->mods, id))->name;
+	return name;
 }
 
-const char* pwml_get_mod_description(PWML* pwml, const char* id) {
-	if (!g_hash_table_contains(pwml->mods, id)) {
-		g_printerr("Couldn't get name of mod with id %s; No such mod exists.\n", id);
+static char* __pwml_read_mod_description(PWML_Mod* mod) {
+	const char* path = g_build_filename(mod->mods_path, mod->id, PWML_MOD_DESCRIPTION_FILE, NULL);
+	if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+		free((char*)path);
+		return NULL;
 	}
-	PWML_Mod* mod = g_hash_table_lookup(pwml->mods, id);
-	if (!mod->description) {
-		const char* path = g_build_filename(mod->path, PWML_MOD_DESCRIPTION_FILE, NULL);
-		if (!g_file_test(path, G_FILE_TEST_EXISTS))
-			return NULL;
 
-		GError* error = NULL;
-		char* buffer;
+	GError* error = NULL;
+	char* buffer;
 
-		g_file_get_contents(path, &buffer, NULL, &error);
-		if (error) {
-			g_print("<span foreground=\"red\"><b>Error:</b></span> failed to read description file at %s\n\nGError->message = %s", path, error->message);
-			return NULL;
-		}
+	g_file_get_contents(path, &buffer, NULL, &error);
+	if (error) {
+		g_print("<span foreground=\"red\"><b>Error:</b></span> failed to read description file at %s\n\nGError->message = %s", path, error->message);
+		g_error_free(error);
+		free((char*)path);
+		return NULL;
+	}
+	free((char*)path);
+	return buffer;
+}
+
+// Expects the catalog's read lock. The copy is made while the description can't be evicted.
+static char* __pwml_load_mod_description(PWML* pwml, PWML_Mod* mod) {
+	g_mutex_lock(&pwml->description_mutex);
+	if (mod->description) {
+		_pwml_catalog_touch_description(pwml, mod);
+		char* description = strdup(mod->description);
+		g_mutex_unlock(&pwml->description_mutex);
+		return description;
+	}
+	g_mutex_unlock(&pwml->description_mutex);
+
+	// Read without the lock, another reader may load it at the same time and the first one to finish wins
+	char* buffer = __pwml_read_mod_description(mod);
+	if (!buffer)
+		return NULL;
 
-		mod->description = buffer;
+	g_mutex_lock(&pwml->description_mutex);
+	if (mod->description) {
+		free(buffer);
+		_pwml_catalog_touch_description(pwml, mod);
+		char* description = strdup(mod->description);
+		g_mutex_unlock(&pwml->description_mutex);
+		return description;
 	}
-	return mod->description;
+
+	mod->description = buffer;
+	_pwml_catalog_add_description(pwml, mod);
+	// Also what the search index reads once the lock is released
+	char* description = strdup(buffer);
+	bool searchable = pwml->description_budget == 0;
+	g_mutex_unlock(&pwml->description_mutex);
+
+	if (searchable)
+		_pwml_search_index_add_description(pwml->search_index, mod, description);
+	return description;
+}
+
+char* pwml_get_mod_description(PWML* pwml, const char* id) {
+	g_rw_lock_reader_lock(&pwml->catalog_lock);
+	PWML_Mod* mod = g_hash_table_lookup(pwml->mods, id);
+	char* description = mod ? __pwml_load_mod_description(pwml, mod) : NULL;
+	g_rw_lock_reader_unlock(&pwml->catalog_lock);
+
+	if (!mod)
+		g_printerr("Couldn't get description of mod with id %s; No such mod exists.\n", id);
+	return description;
 }
 
-// pretty sure you can replace this with strcmp and a cast
 static int __compare_alphabetical(const void* _a, const void* _b) {
 	const char* a = _a;
 	const char* b = _b;
@@ -689,7 +607,32 @@ static int __compare_alphabetical(const void* _a, const void* _b) {
 	return strlen(a) - strlen(b);
 }
 
-static void __pwml_write_weapons_dat(PWML* pwml) {
+void pwml_set_copy_order(PWML* pwml, PWML_CopyOrder order) {
+	pwml->copy_order = order;
+}
+
+void pwml_set_durability(PWML* pwml, PWML_Durability durability) {
+	pwml->durability = durability;
+}
+
+// Writes a generated file unless the cache or its current contents say it is already up to date
+static void __pwml_write_generated(PWML* pwml, const char* key, const char* fingerprint, const char* path, const char* data, gsize length, _File_Utils_Counters* counters) {
+	bool written;
+	_File_Utils_Context context = { .durability = pwml->durability };
+	if (!_file_utils_write_if_changed(&context, path, data, length, &written)) {
+		_pwml_cache_forget(pwml, key);
+		counters->errors++;
+		return;
+	}
+
+	_pwml_cache_store(pwml, key, fingerprint, path);
+	if (written) {
+		counters->files++;
+		counters->bytes += length;
+	}
+}
+
+static void __pwml_write_weapons_dat(PWML* pwml, const char* weapons_dat_path, _File_Utils_Counters* counters) {
 	//g_print("--------------\nApplying mods:\npwml->weapons->len: %u\n", pwml->weapons->len);
 
 	GPtrArray* weapon_names = g_ptr_array_new();
@@ -751,16 +694,13 @@ static void __pwml_write_weapons_dat(PWML* pwml) {
 		strcat(weapons_dat_data, "\n");
 	}
 
-	const char* weapons_dat_path = g_build_filename(pwml->weapons_path, PWML_WEAPONS_DAT, NULL);
-
-	GError* error = NULL;
-	g_file_set_contents(weapons_dat_path, weapons_dat_data, -1, &error);
-	if (error) {
-		g_printerr("Failed to write weapons.dat at %s\nGError: %s\n", weapons_dat_path, error->message);
-		g_error_free(error);
-	}
+	// Building the contents is cheap, writing and syncing them isn't
+	gsize weapons_dat_length = strlen(weapons_dat_data);
+	char* fingerprint = _pwml_cache_fingerprint_data(weapons_dat_data, weapons_dat_length);
+	if (!_pwml_cache_is_fresh(pwml, PWML_WEAPONS_DAT, fingerprint, weapons_dat_path))
+		__pwml_write_generated(pwml, PWML_WEAPONS_DAT, fingerprint, weapons_dat_path, weapons_dat_data, weapons_dat_length, counters);
 
-	free((char*)weapons_dat_path);
+	free(fingerprint);
 	free((char*)weapons_dat_data);
 
 	g_ptr_array_free(weapon_names, true);
@@ -768,78 +708,423 @@ static void __pwml_write_weapons_dat(PWML* pwml) {
 	g_ptr_array_free(pilot_weapon_names, true);
 }
 
-static void __pwml_write_menu_music_txt(PWML* pwml) {
-	uint size = 0;
-	char* buffer = calloc(1, sizeof(char));
-	for (uint i = 0; i < pwml->menu_music_paths->len; i++) {
-		const char* path = g_ptr_array_index(pwml->menu_music_paths, i);
+// Streams the lines of the files into destination_path, see line_utils.h
+static bool __pwml_merge_lines(PWML* pwml, PWML_Phase phase, const char* key, GPtrArray* files, bool deduplicate, const char* destination_path, _File_Utils_Counters* counters) {
+	char* mode = g_strdup_printf("%s:lines%s", pwml_phase_get_name(phase), deduplicate ? ":deduplicate" : "");
+	char* fingerprint = _pwml_cache_fingerprint_files(files, mode);
+	free(mode);
+	if (_pwml_cache_is_fresh(pwml, key, fingerprint, destination_path)) {
+		free(fingerprint);
+		return true;
+	}
 
-		char* contents;
-		GError* error = NULL;
+	// Merged next to the destination so it can replace it only if something changed
+	const char* new_path = g_strconcat(destination_path, ".new", NULL);
+	bool replaced = false;
+	_File_Utils_Context context = { .durability = pwml->durability };
+	bool merged = _line_utils_merge_files(files, deduplicate, new_path, counters) && _file_utils_replace_if_changed(&context, new_path, destination_path, &replaced);
+	if (merged) {
+		_pwml_cache_store(pwml, key, fingerprint, destination_path);
+	} else {
+		remove(new_path);
+		_pwml_cache_forget(pwml, key);
+	}
 
-		g_file_get_contents(path, &contents, NULL, &error);
-		if (error) {
-			g_printerr("Failed to read file %s\nGError: %s\n", path, error->message);
-			g_error_free(error);
+	free((char*)new_path);
+	free(fingerprint);
+	return merged;
+}
+
+static void _g_ptr_array_clear(GPtrArray* array) {
+	g_ptr_array_remove_range(array, 0, array->len);
+}
+
+// merger is what the pipeline merged from files while the mods were being copied. It only has their
+// inputs if fingerprint, which the pipeline took of files while planning, wasn't fresh then.
+static bool __pwml_combine_xml(PWML* pwml, PWML_Phase phase, const char* key, GPtrArray* files, const char* fingerprint, _XML_Utils_Merger* merger, const char* destination_path) {
+	_File_Utils_Counters counters = { 0 };
+	gint64 start = _pwml_stats_begin(pwml);
+	gint64 trace_start = _pwml_trace_begin();
+
+	if (_pwml_cache_is_fresh(pwml, key, fingerprint, destination_path)) {
+		// Up to date, nothing to do
+	} else if (files->len == 0) {
+		remove(destination_path);
+		_pwml_cache_store(pwml, key, fingerprint, destination_path);
+	} else {
+		// Merged next to the destination so it can replace it only if something changed
+		const char* new_path = g_strconcat(destination_path, ".new", NULL);
+		remove(new_path);
+
+		bool replaced = false;
+		_File_Utils_Context context = { .durability = pwml->durability };
+		if (_xml_utils_merger_save(merger, new_path) && _file_utils_replace_if_changed(&context, new_path, destination_path, &replaced)) {
+			_pwml_cache_store(pwml, key, fingerprint, destination_path);
+			counters.files = replaced ? files->len : 0;
+		} else {
+			remove(new_path);
+			_pwml_cache_forget(pwml, key);
+			counters.errors++;
+		}
+		free((char*)new_path);
+	}
+
+	// Only stat the result when somebody is going to look at it
+	GStatBuf stat_buf;
+	if (pwml->stats && g_stat(destination_path, &stat_buf) == 0)
+		counters.bytes = stat_buf.st_size;
+
+	_pwml_trace_end("generate", pwml_phase_get_name(phase), destination_path, trace_start);
+	_pwml_stats_end(pwml, phase, NULL, start, &counters);
+	return counters.errors == 0;
+}
+
+// Planning lists the mods' folders and copying reads and writes, past this many threads the disk is what limits both
+#define APPLY_MAX_THREADS 8
+// Big mods are copied in tasks of this many files, so vanilla doesn't end up on a single thread
+#define APPLY_COPY_TASK_FILES 256
+// Merge inputs are tiny, this only keeps a stuck merger from piling them up
+#define APPLY_MERGE_QUEUE_CAPACITY 16
+
+typedef struct {
+	PWML* pwml;
+	// PWML_Mod*, in apply order
+	GPtrArray* mods;
+	// _PWML_ModPlan*, one for each of mods
+	GPtrArray* plans;
+	_PWML_BoundedQueue* merge_inputs;
+	// Of each xml resource's inputs as planned, NULL for the rest
+	char* xml_fingerprints[PWML_RESOURCE_COUNT];
+} __PWML_ApplyPipeline;
+
+typedef struct {
+	PWML_ResourceType type;
+	char* path;
+} __PWML_MergeInput;
+
+typedef struct {
+	// NULL for the resources that aren't merged as xml
+	_XML_Utils_Merger* mergers[PWML_RESOURCE_COUNT];
+} __PWML_MergeResult;
+
+typedef struct {
+	_PWML_ModPlan* plan;
+	PWML_ResourceType type;
+	uint first;
+	uint count;
+} __PWML_CopyTask;
+
+typedef struct {
+	PWML* pwml;
+	gint failed_tasks;
+} __PWML_CopyState;
+
+static void __pwml_push_merge_input(_PWML_BoundedQueue* queue, PWML_ResourceType type, const char* path) {
+	if (!path)
+		return;
+	__PWML_MergeInput* input = malloc(sizeof(__PWML_MergeInput));
+	input->type = type;
+	input->path = strdup(path);
+	_pwml_bounded_queue_push(queue, input);
+}
+
+// data is the mod's index plus one, so the first mod isn't NULL
+static void __pwml_apply_plan_task(gpointer data, gpointer user_data) {
+	__PWML_ApplyPipeline* pipeline = (__PWML_ApplyPipeline*)user_data;
+	uint index = GPOINTER_TO_UINT(data) - 1;
+	PWML_Mod* mod = g_ptr_array_index(pipeline->mods, index);
+
+	gint64 trace_start = _pwml_trace_begin();
+	pipeline->plans->pdata[index] = _pwml_mod_plan(pipeline->pwml, mod);
+	_pwml_trace_end("apply", "plan_mod", mod->id, trace_start);
+}
+
+static void __pwml_apply_plan(__PWML_ApplyPipeline* pipeline, uint thread_count) {
+	g_ptr_array_set_size(pipeline->plans, pipeline->mods->len);
+	GThreadPool* pool = g_thread_pool_new(__pwml_apply_plan_task, pipeline, thread_count, true, NULL);
+	for (uint i = 0; i < pipeline->mods->len; i++) {
+		g_thread_pool_push(pool, GUINT_TO_POINTER(i + 1), NULL);
+	}
+	// Waits for every plan
+	g_thread_pool_free(pool, false, true);
+
+	// The merger works through these while the mods are copied, they are never written by the copies.
+	// Only resources the cache doesn't have are merged.
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		const _PWML_ResourceHandler* handler = _pwml_resource_get_handler(type);
+		if (handler->merge != _PWML_MERGE_XML_APPEND)
 			continue;
+
+		// Borrowed, in the order _pwml_mod_plan_finish hands them to the resource
+		GPtrArray* paths = g_ptr_array_new();
+		for (uint i = 0; i < pipeline->plans->len; i++) {
+			_PWML_ModPlan* plan = g_ptr_array_index(pipeline->plans, i);
+			if (plan->merge_inputs[type])
+				g_ptr_array_add(paths, plan->merge_inputs[type]);
 		}
 
-		uint old = size;
-		size += strlen(contents) + 1;
-		buffer = realloc(buffer, size * sizeof(char));
-		strcpy(buffer + old, contents);
-		buffer[size - 1] = '\n';
+		const char* key = *handler->generated_file;
+		const char* destination_path = g_build_filename(_pwml_resource_get_path(pipeline->pwml, type), key, NULL);
+		pipeline->xml_fingerprints[type] = _pwml_cache_fingerprint_files(paths, "xml:append");
+		if (!_pwml_cache_is_fresh(pipeline->pwml, key, pipeline->xml_fingerprints[type], destination_path)) {
+			for (uint i = 0; i < paths->len; i++) {
+				__pwml_push_merge_input(pipeline->merge_inputs, type, g_ptr_array_index(paths, i));
+			}
+		}
+		free((char*)destination_path);
+		g_ptr_array_free(paths, true);
 	}
-	if (size > 0)
-		buffer[size - 1] = '\0';
-	
-	const char* menu_music_txt_path = g_build_filename(pwml->music_path, PWML_MENU_MUSIC_TXT, NULL);
+	_pwml_bounded_queue_push(pipeline->merge_inputs, NULL);
+}
 
-	GError* error = NULL;
-	g_file_set_contents(menu_music_txt_path, buffer, -1, &error);
-	if (error) {
-		g_printerr("Failed to write %s\nGError: %s\n", menu_music_txt_path, error->message);
-		g_error_free(error);
+// Leaves every path to the last mod that deploys it, so the copies left never write the same file twice
+static void __pwml_apply_drop_overridden(GPtrArray* plans) {
+	gint64 trace_start = _pwml_trace_begin();
+	GHashTable* claimed = g_hash_table_new(g_str_hash, g_str_equal);
+	GHashTable* claimed_folders = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	guint dropped = 0;
+	for (int i = plans->len - 1; i >= 0; i--) {
+		dropped += _pwml_mod_plan_drop_overridden(g_ptr_array_index(plans, i), claimed, claimed_folders);
 	}
+	g_hash_table_destroy(claimed);
+	g_hash_table_destroy(claimed_folders);
 
-	free((char*)menu_music_txt_path);
-	free(buffer);
+	if (trace_start) {
+		char* detail = g_strdup_printf("%u overridden files", dropped);
+		_pwml_trace_end("apply", "drop_overridden", detail, trace_start);
+		free(detail);
+	}
 }
 
-static void _g_ptr_array_clear(GPtrArray* array) {
-	g_ptr_array_remove_range(array, 0, array->len);
+static void __pwml_apply_copy_task(gpointer data, gpointer user_data) {
+	__PWML_CopyTask* task = (__PWML_CopyTask*)data;
+	__PWML_CopyState* state = (__PWML_CopyState*)user_data;
+
+	gint64 trace_start = _pwml_trace_begin();
+	if (!_pwml_mod_plan_copy(state->pwml, task->plan, task->type, task->first, task->count))
+		g_atomic_int_inc(&state->failed_tasks);
+	_pwml_trace_end("apply", "copy_mod", task->plan->mod->id, trace_start);
+	free(task);
+}
+
+// Returns false if any of the copies failed
+static bool __pwml_apply_copy(PWML* pwml, GPtrArray* plans, uint thread_count) {
+	__PWML_CopyState state = { .pwml = pwml, .failed_tasks = 0 };
+	GThreadPool* pool = g_thread_pool_new(__pwml_apply_copy_task, &state, thread_count, true, NULL);
+	for (uint i = 0; i < plans->len; i++) {
+		_PWML_ModPlan* plan = g_ptr_array_index(plans, i);
+		for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+			uint len = plan->jobs[type]->len;
+			for (uint first = 0; first < len; first += APPLY_COPY_TASK_FILES) {
+				__PWML_CopyTask* task = malloc(sizeof(__PWML_CopyTask));
+				task->plan = plan;
+				task->type = type;
+				task->first = first;
+				task->count = MIN(APPLY_COPY_TASK_FILES, len - first);
+				g_thread_pool_push(pool, task, NULL);
+			}
+		}
+	}
+	// Waits for every copy
+	g_thread_pool_free(pool, false, true);
+	return g_atomic_int_get(&state.failed_tasks) == 0;
+}
+
+static gpointer __pwml_apply_merger(gpointer data) {
+	__PWML_ApplyPipeline* pipeline = (__PWML_ApplyPipeline*)data;
+	__PWML_MergeResult* result = malloc(sizeof(__PWML_MergeResult));
+	const char* fragment_cache = g_build_filename(pipeline->pwml->working_directory, PWML_CACHE_FOLDER, PWML_XML_FRAGMENT_CACHE_FOLDER, NULL);
+	_File_Utils_Context context = { .durability = pipeline->pwml->durability };
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		bool xml = _pwml_resource_get_handler(type)->merge == _PWML_MERGE_XML_APPEND;
+		result->mergers[type] = xml ? _xml_utils_merger_new(&context, fragment_cache) : NULL;
+	}
+	free((char*)fragment_cache);
+
+	__PWML_MergeInput* input;
+	while ((input = _pwml_bounded_queue_pop(pipeline->merge_inputs))) {
+		_xml_utils_merger_add(result->mergers[input->type], input->path);
+		free(input->path);
+		free(input);
+	}
+
+	return result;
+}
+
+// Builds the resource's generated file from what the mods had, if it has one. Returns false if it couldn't be.
+static bool __pwml_generate_resource(PWML* pwml, PWML_ResourceType type, const char* xml_fingerprint, _XML_Utils_Merger* merger) {
+	const _PWML_ResourceHandler* handler = _pwml_resource_get_handler(type);
+	if (handler->merge == _PWML_MERGE_NONE)
+		return true;
+
+	const char* key = *handler->generated_file;
+	const char* destination_path = g_build_filename(_pwml_resource_get_path(pwml, type), key, NULL);
+	GPtrArray* inputs = _pwml_resource_get_merge_inputs(pwml, type);
+
+	bool generated = true;
+	if (handler->merge == _PWML_MERGE_XML_APPEND) {
+		generated = __pwml_combine_xml(pwml, handler->merge_phase, key, inputs, xml_fingerprint, merger, destination_path);
+	} else {
+		_File_Utils_Counters counters = { 0 };
+		gint64 start = _pwml_stats_begin(pwml);
+		gint64 trace_start = _pwml_trace_begin();
+		if (handler->merge == _PWML_MERGE_WEAPONS_DAT) {
+			__pwml_write_weapons_dat(pwml, destination_path, &counters);
+			_g_ptr_array_clear(pwml->weapons);
+		} else {
+			__pwml_merge_lines(pwml, handler->merge_phase, key, inputs, handler->deduplicate_lines, destination_path, &counters);
+		}
+		_pwml_trace_end("generate", pwml_phase_get_name(handler->merge_phase), NULL, trace_start);
+		_pwml_stats_end(pwml, handler->merge_phase, NULL, start, &counters);
+		// Unreadable inputs are counted too, the file would be missing their lines
+		generated = counters.errors == 0;
+	}
+
+	if (inputs)
+		_g_ptr_array_clear(inputs);
+	free((char*)destination_path);
+	return generated;
 }
 
-void pwml_apply_mods(PWML* pwml) {
-	_file_utils_delete_all(pwml->graphics_path);
-	_file_utils_delete_all(pwml->levels_path);
-	_file_utils_delete_all(pwml->music_path);
-	_file_utils_delete_all(pwml->objects_path);
-	_file_utils_delete_all(pwml->sound_path);
-	_file_utils_delete_all(pwml->weapons_path);
+// Bytes kept free on top of the estimate, generated files and directories aren't counted in it
+#define APPLY_SPACE_MARGIN (16 * 1024 * 1024)
+
+// Compares what the planned copies take with the free space plus what the delete gives back, before anything is touched
+static bool __pwml_check_free_space(PWML* pwml, GPtrArray* plans) {
+	guint64 available;
+	if (!_file_utils_get_free_space(pwml->working_directory, &available))
+		return true;
+
+	gint64 trace_start = _pwml_trace_begin();
+	guint64 required = APPLY_SPACE_MARGIN;
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		available += _file_utils_reclaimable_size(_pwml_resource_get_path(pwml, type));
+		for (uint i = 0; i < plans->len; i++) {
+			GPtrArray* jobs = ((_PWML_ModPlan*)g_ptr_array_index(plans, i))->jobs[type];
+			for (uint j = 0; j < jobs->len; j++) {
+				_File_Utils_CopyJob* job = g_ptr_array_index(jobs, j);
+				// Links take no space
+				if (job->method == _FILE_UTILS_COPY)
+					required += job->size;
+			}
+		}
+	}
+	_pwml_trace_end("apply", "check_free_space", NULL, trace_start);
+
+	if (required > available) {
+		g_printerr("Not enough free space to apply the mods; %" G_GUINT64_FORMAT " bytes needed, %" G_GUINT64_FORMAT " available.\n", required, available);
+		return false;
+	}
+	return true;
+}
+
+bool pwml_apply_mods(PWML* pwml) {
+	g_mutex_lock(&pwml->apply_mutex);
+	bool applied = _pwml_apply_mods_locked(pwml);
+	g_mutex_unlock(&pwml->apply_mutex);
+	return applied;
+}
+
+bool _pwml_apply_mods_locked(PWML* pwml) {
+	gint64 apply_start = _pwml_trace_begin();
+
+	__PWML_ApplyPipeline pipeline = {
+		.pwml = pwml,
+		.mods = g_ptr_array_new_with_free_func(_pwml_mod_unref),
+		.plans = g_ptr_array_new_with_free_func(_pwml_mod_plan_free),
+		.merge_inputs = _pwml_bounded_queue_new(APPLY_MERGE_QUEUE_CAPACITY),
+	};
 
+	// The rest of the apply works on these, whatever happens to the catalog meanwhile
+	g_rw_lock_reader_lock(&pwml->catalog_lock);
 	GHashTableIter iter;
 	g_hash_table_iter_init(&iter, pwml->mods);
 
 	PWML_Mod* mod;
 	while (g_hash_table_iter_next(&iter, NULL, (void**)&mod)) {
-		if (mod->active) {
-			_pwml_mod_apply(pwml, mod);
+		if (mod->active)
+			g_ptr_array_add(pipeline.mods, _pwml_mod_ref(mod));
+	}
+	g_rw_lock_reader_unlock(&pwml->catalog_lock);
+	g_ptr_array_sort_values(pipeline.mods, _pwml_mod_compare_apply_order);
+
+	// libxml2 has to be initialised before it is used from more than one thread
+	xmlInitParser();
+
+	// The xml is merged while the mods are planned and copied. Planning only reads the mods, so the game
+	// is left alone until the plans are known to fit.
+	GThread* merger = g_thread_new("pwml-merger", __pwml_apply_merger, &pipeline);
+	uint thread_count = CLAMP(g_get_num_processors(), 1, APPLY_MAX_THREADS);
+
+	__pwml_apply_plan(&pipeline, thread_count);
+	__pwml_apply_drop_overridden(pipeline.plans);
+
+	// A full disk found halfway through the copies would leave the game without half its files
+	if (!__pwml_check_free_space(pwml, pipeline.plans)) {
+		__PWML_MergeResult* merge_result = g_thread_join(merger);
+		for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+			if (merge_result->mergers[type])
+				_xml_utils_merger_free(merge_result->mergers[type]);
+			free(pipeline.xml_fingerprints[type]);
 		}
+		free(merge_result);
+		g_ptr_array_free(pipeline.plans, true);
+		_pwml_bounded_queue_free(pipeline.merge_inputs);
+		g_ptr_array_free(pipeline.mods, true);
+		_pwml_trace_end("apply", "pwml_apply_mods", NULL, apply_start);
+		return false;
 	}
-	
-	__pwml_write_weapons_dat(pwml);
-	_g_ptr_array_clear(pwml->weapons);
-
-	__pwml_write_menu_music_txt(pwml);
-	_g_ptr_array_clear(pwml->menu_music_paths);
-
-	const char* graphics_xml_path = g_build_filename(pwml->graphics_path, PWML_GRAPHICS_XML, NULL);
-	_xml_utils_combine_all_files(pwml->graphics_xml_paths, graphics_xml_path);
-	_g_ptr_array_clear(pwml->graphics_xml_paths);
-	const char* sounds_xml_path = g_build_filename(pwml->sound_path, PWML_SOUNDS_XML, NULL);
-	_xml_utils_combine_all_files(pwml->sounds_xml_paths, sounds_xml_path);
-	_g_ptr_array_clear(pwml->sounds_xml_paths);
-	free((char*)graphics_xml_path);
-	free((char*)sounds_xml_path);
+
+	_pwml_deploy_begin(pwml);
+
+	_File_Utils_Counters delete_counters = { 0 };
+	_File_Utils_Context delete_context = { .counters = pwml->stats ? &delete_counters : NULL };
+	gint64 start = _pwml_stats_begin(pwml);
+	gint64 trace_start = _pwml_trace_begin();
+
+	// Generated files are kept so they don't have to be rewritten if nothing changed
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		const _PWML_ResourceHandler* handler = _pwml_resource_get_handler(type);
+		const char* generated_file = handler->generated_file ? *handler->generated_file : NULL;
+		_file_utils_delete_all_except(&delete_context, _pwml_resource_get_path(pwml, type), generated_file);
+	}
+
+	_pwml_trace_end("apply", "delete", NULL, trace_start);
+	_pwml_stats_end(pwml, PWML_PHASE_DELETE, NULL, start, &delete_counters);
+
+	bool applied = __pwml_apply_copy(pwml, pipeline.plans, thread_count);
+
+	for (uint i = 0; i < pipeline.plans->len; i++) {
+		_pwml_mod_plan_finish(pwml, g_ptr_array_index(pipeline.plans, i));
+	}
+
+	__PWML_MergeResult* merge_result = g_thread_join(merger);
+	g_ptr_array_free(pipeline.plans, true);
+	_pwml_bounded_queue_free(pipeline.merge_inputs);
+
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		if (!__pwml_generate_resource(pwml, type, pipeline.xml_fingerprints[type], merge_result->mergers[type]))
+			applied = false;
+		if (merge_result->mergers[type])
+			_xml_utils_merger_free(merge_result->mergers[type]);
+		free(pipeline.xml_fingerprints[type]);
+	}
+	free(merge_result);
+
+	// A half deployed tree must not look like a deployment of these mods
+	if (!applied)
+		g_printerr("Some of the mods' files couldn't be deployed.\n");
+	_pwml_profile_store_fingerprint(pwml, applied ? pipeline.mods : NULL);
+	g_ptr_array_free(pipeline.mods, true);
+
+	_pwml_cache_save(pwml);
+	_pwml_deploy_save(pwml);
+
+	// One syncfs for everything the apply wrote instead of an fsync per file
+	_File_Utils_Context sync_context = { .durability = pwml->durability };
+	_file_utils_sync_filesystem(&sync_context, pwml->working_directory);
+
+	_pwml_trace_end("apply", "pwml_apply_mods", NULL, apply_start);
+	_pwml_trace_flush();
+	return applied;
 }
@@ -0,0 +1,96 @@
+#include "PWML/resource.h"
+#include "PWML/pwml.h"
+#include <glib.h>
+#include <stddef.h>
+
+static const _PWML_ResourceHandler HANDLERS[PWML_RESOURCE_COUNT] = {
+	[PWML_RESOURCE_WEAPONS] = {
+		.folder = &PWML_WEAPONS_FOLDER,
+		.path_offset = offsetof(PWML, weapons_path),
+		.generated_file = &PWML_WEAPONS_DAT,
+		.merge = _PWML_MERGE_WEAPONS_DAT,
+		.merge_phase = PWML_PHASE_WEAPONS_DAT,
+		.custom_deploy = true,
+	},
+	[PWML_RESOURCE_OBJECTS] = {
+		.folder = &PWML_OBJECTS_FOLDER,
+		.path_offset = offsetof(PWML, objects_path),
+	},
+	[PWML_RESOURCE_LEVELS] = {
+		.folder = &PWML_LEVELS_FOLDER,
+		.path_offset = offsetof(PWML, levels_path),
+		// Levels received from other players in multiplayer
+		.clone_ignore = "received",
+	},
+	[PWML_RESOURCE_MUSIC] = {
+		.folder = &PWML_MUSIC_FOLDER,
+		.path_offset = offsetof(PWML, music_path),
+		.generated_file = &PWML_MENU_MUSIC_TXT,
+		.merge = _PWML_MERGE_LINES,
+		.merge_phase = PWML_PHASE_MENU_MUSIC,
+		// Two mods listing the same track would make it come up twice as often
+		.deduplicate_lines = true,
+		.merge_inputs_offset = offsetof(PWML, menu_music_paths),
+	},
+	[PWML_RESOURCE_GRAPHICS] = {
+		.folder = &PWML_GRAPHICS_FOLDER,
+		.path_offset = offsetof(PWML, graphics_path),
+		.generated_file = &PWML_GRAPHICS_XML,
+		.merge = _PWML_MERGE_XML_APPEND,
+		.merge_phase = PWML_PHASE_GRAPHICS_XML,
+		.merge_inputs_offset = offsetof(PWML, graphics_xml_paths),
+	},
+	[PWML_RESOURCE_SOUND] = {
+		.folder = &PWML_SOUND_FOLDER,
+		.path_offset = offsetof(PWML, sound_path),
+		.generated_file = &PWML_SOUNDS_XML,
+		.merge = _PWML_MERGE_XML_APPEND,
+		.merge_phase = PWML_PHASE_SOUNDS_XML,
+		.merge_inputs_offset = offsetof(PWML, sounds_xml_paths),
+	},
+};
+
+void pwml_set_deploy_strategy(PWML* pwml, PWML_ResourceType type, PWML_DeployStrategy strategy) {
+	if (type >= PWML_RESOURCE_COUNT)
+		return;
+	pwml->deploy_strategies[type] = strategy;
+}
+
+bool _pwml_resource_parse_capture_mode(const char* name, PWML_CaptureMode* mode) {
+	if (g_str_equal(name, "copy"))
+		*mode = PWML_CAPTURE_COPY;
+	else if (g_str_equal(name, "link"))
+		*mode = PWML_CAPTURE_LINK;
+	else if (g_str_equal(name, "reflink"))
+		*mode = PWML_CAPTURE_REFLINK;
+	else if (g_str_equal(name, "move"))
+		*mode = PWML_CAPTURE_MOVE;
+	else
+		return false;
+	return true;
+}
+
+static const _File_Utils_CopyMethod CAPTURE_METHODS[] = {
+	[PWML_CAPTURE_COPY] = _FILE_UTILS_COPY,
+	[PWML_CAPTURE_LINK] = _FILE_UTILS_LINK,
+	[PWML_CAPTURE_REFLINK] = _FILE_UTILS_REFLINK,
+	[PWML_CAPTURE_MOVE] = _FILE_UTILS_MOVE,
+};
+
+_File_Utils_CopyMethod _pwml_resource_get_capture_method(PWML_CaptureMode mode) {
+	return CAPTURE_METHODS[mode];
+}
+
+const _PWML_ResourceHandler* _pwml_resource_get_handler(PWML_ResourceType type) {
+	return &HANDLERS[type];
+}
+
+const char* _pwml_resource_get_path(PWML* pwml, PWML_ResourceType type) {
+	return *(const char**)((char*)pwml + HANDLERS[type].path_offset);
+}
+
+GPtrArray* _pwml_resource_get_merge_inputs(PWML* pwml, PWML_ResourceType type) {
+	if (HANDLERS[type].merge != _PWML_MERGE_LINES && HANDLERS[type].merge != _PWML_MERGE_XML_APPEND)
+		return NULL;
+	return *(GPtrArray**)((char*)pwml + HANDLERS[type].merge_inputs_offset);
+}
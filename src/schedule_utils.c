@@ -0,0 +1,147 @@
+#include "PWML/schedule_utils.h"
+#include "PWML/file_utils.h"
+#include "PWML/trace.h"
+#include <fcntl.h>
+#include <glib.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+	guint64 device;
+	// Files FIEMAP can't place go after the ones it can, ordered by inode
+	bool unmapped;
+	guint64 key;
+	_File_Utils_CopyJob* job;
+} __Schedule_Utils_Entry;
+
+static bool __schedule_utils_physical_offset(int fd, guint64* offset) {
+	// Room for the header and the first extent only
+	guint64 buffer[(sizeof(struct fiemap) + sizeof(struct fiemap_extent)) / sizeof(guint64) + 1];
+	memset(buffer, 0, sizeof(buffer));
+	struct fiemap* map = (struct fiemap*)buffer;
+	map->fm_start = 0;
+	map->fm_length = FIEMAP_MAX_OFFSET;
+	map->fm_extent_count = 1;
+
+	if (ioctl(fd, FS_IOC_FIEMAP, map) != 0 || map->fm_mapped_extents == 0)
+		return false;
+	// Delayed allocation and inline data have no meaningful offset yet
+	if (map->fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE))
+		return false;
+
+	*offset = map->fm_extents[0].fe_physical;
+	return true;
+}
+
+static void __schedule_utils_fill_entry(PWML_CopyOrder order, __Schedule_Utils_Entry* entry) {
+	struct stat stat_buf;
+	entry->unmapped = true;
+
+	if (order == PWML_COPY_ORDER_PHYSICAL) {
+		int fd = open(entry->job->source, O_RDONLY | O_CLOEXEC);
+		if (fd == -1 || fstat(fd, &stat_buf) != 0) {
+			if (fd != -1)
+				close(fd);
+			entry->device = entry->key = G_MAXUINT64;
+			return;
+		}
+		entry->device = stat_buf.st_dev;
+		entry->unmapped = !__schedule_utils_physical_offset(fd, &entry->key);
+		close(fd);
+		if (entry->unmapped)
+			entry->key = stat_buf.st_ino;
+		return;
+	}
+
+	// The collector already stat'ed most sources
+	if (entry->job->inode != 0) {
+		entry->device = entry->job->device;
+		entry->key = entry->job->inode;
+		return;
+	}
+	if (lstat(entry->job->source, &stat_buf) != 0) {
+		entry->device = entry->key = G_MAXUINT64;
+		return;
+	}
+	entry->device = stat_buf.st_dev;
+	entry->key = stat_buf.st_ino;
+}
+
+static int __schedule_utils_compare(const void* voidptr_a, const void* voidptr_b) {
+	const __Schedule_Utils_Entry* a = voidptr_a;
+	const __Schedule_Utils_Entry* b = voidptr_b;
+	if (a->device != b->device)
+		return a->device < b->device ? -1 : 1;
+	if (a->unmapped != b->unmapped)
+		return a->unmapped ? 1 : -1;
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	return 0;
+}
+
+void _schedule_utils_sort_jobs(PWML_CopyOrder order, GPtrArray* jobs) {
+	if (order == PWML_COPY_ORDER_NONE || jobs->len < 2)
+		return;
+
+	gint64 trace_start = _pwml_trace_begin();
+
+	__Schedule_Utils_Entry* entries = malloc(jobs->len * sizeof(__Schedule_Utils_Entry));
+	for (uint i = 0; i < jobs->len; i++) {
+		entries[i].job = g_ptr_array_index(jobs, i);
+		__schedule_utils_fill_entry(order, &entries[i]);
+	}
+
+	qsort(entries, jobs->len, sizeof(__Schedule_Utils_Entry), __schedule_utils_compare);
+	for (uint i = 0; i < jobs->len; i++) {
+		jobs->pdata[i] = entries[i].job;
+	}
+	free(entries);
+
+	if (trace_start) {
+		char* detail = g_strdup_printf("%u files by %s", jobs->len, order == PWML_COPY_ORDER_PHYSICAL ? "physical offset" : "inode");
+		_pwml_trace_end("copy", "schedule_copies", detail, trace_start);
+		free(detail);
+	}
+}
+
+void _schedule_utils_readahead_init(_Schedule_Utils_Readahead* readahead, GPtrArray* jobs) {
+	readahead->jobs = jobs;
+	readahead->next = 0;
+	for (uint i = 0; i < SCHEDULE_UTILS_READAHEAD_WINDOW; i++)
+		readahead->fds[i] = -1;
+}
+
+int _schedule_utils_readahead_take(_Schedule_Utils_Readahead* readahead, uint current) {
+	if (readahead->next < current)
+		readahead->next = current;
+
+	for (; readahead->next < readahead->jobs->len && readahead->next < current + SCHEDULE_UTILS_READAHEAD_WINDOW; readahead->next++) {
+		_File_Utils_CopyJob* job = g_ptr_array_index(readahead->jobs, readahead->next);
+		// Symlinks fail to open and are copied as links, O_NONBLOCK keeps a fifo from blocking here
+		int fd = open(job->source, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+		if (fd != -1)
+			posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		readahead->fds[readahead->next % SCHEDULE_UTILS_READAHEAD_WINDOW] = fd;
+	}
+
+	int fd = readahead->fds[current % SCHEDULE_UTILS_READAHEAD_WINDOW];
+	readahead->fds[current % SCHEDULE_UTILS_READAHEAD_WINDOW] = -1;
+	return fd;
+}
+
+bool _schedule_utils_parse_order(const char* name, PWML_CopyOrder* order) {
+	if (g_str_equal(name, "none"))
+		*order = PWML_COPY_ORDER_NONE;
+	else if (g_str_equal(name, "inode"))
+		*order = PWML_COPY_ORDER_INODE;
+	else if (g_str_equal(name, "physical"))
+		*order = PWML_COPY_ORDER_PHYSICAL;
+	else
+		return false;
+	return true;
+}
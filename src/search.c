@@ -0,0 +1,268 @@
+#include "PWML/search.h"
+#include "PWML/mod.h"
+#include "PWML/pwml.h"
+#include "PWML/trace.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+	SEARCH_FIELD_ID,
+	SEARCH_FIELD_NAME,
+	SEARCH_FIELD_SHORT_DESCRIPTION,
+	SEARCH_FIELD_DESCRIPTION,
+	SEARCH_FIELD_COUNT
+} __PWML_SearchField;
+
+static const guint FIELD_SCORES[SEARCH_FIELD_COUNT] = {
+	[SEARCH_FIELD_ID] = 8,
+	[SEARCH_FIELD_NAME] = 8,
+	[SEARCH_FIELD_SHORT_DESCRIPTION] = 3,
+	[SEARCH_FIELD_DESCRIPTION] = 1,
+};
+// Added when a word starts the field, so typing the start of a name finds it first
+#define PREFIX_SCORE 4
+
+typedef struct {
+	PWML_Mod* mod;
+	// Case folded, NULL while a description isn't loaded
+	char* fields[SEARCH_FIELD_COUNT];
+	// Which query last looked at this document, saves clearing anything between queries
+	guint stamp;
+	guint score;
+} __PWML_SearchDocument;
+
+struct _PWML_SearchIndex {
+	// __PWML_SearchDocument*, the position is the document number
+	GPtrArray* documents;
+	// PWML_Mod* -> document number + 1
+	GHashTable* document_numbers;
+	// Trigram packed in a guint32 -> GArray of guint document numbers, may hold duplicates
+	GHashTable* postings;
+	// Reused by every query
+	GPtrArray* candidates;
+	guint stamp;
+	// Queries share the scratch space above and descriptions are added from readers,
+	// so both take this on top of the catalog's read lock
+	GMutex mutex;
+};
+
+static char* __pwml_search_fold(const char* text) {
+	if (g_utf8_validate(text, -1, NULL))
+		return g_utf8_casefold(text, -1);
+	return g_ascii_strdown(text, -1);
+}
+
+static guint32 __pwml_search_trigram(const char* text) {
+	return (guint32)(guchar)text[0] << 16 | (guint32)(guchar)text[1] << 8 | (guint32)(guchar)text[2];
+}
+
+static void __pwml_search_postings_free(gpointer postings) {
+	g_array_free((GArray*)postings, true);
+}
+
+static void __pwml_search_document_free(gpointer voidptr_document) {
+	__PWML_SearchDocument* document = (__PWML_SearchDocument*)voidptr_document;
+	for (uint i = 0; i < SEARCH_FIELD_COUNT; i++) {
+		g_free(document->fields[i]);
+	}
+	free(document);
+}
+
+static void __pwml_search_index_text(_PWML_SearchIndex* index, guint document_number, const char* text) {
+	for (gsize i = 0; text[i] && text[i + 1] && text[i + 2]; i++) {
+		gpointer key = GUINT_TO_POINTER(__pwml_search_trigram(text + i));
+		GArray* postings = g_hash_table_lookup(index->postings, key);
+		if (!postings) {
+			postings = g_array_new(false, false, sizeof(guint));
+			g_hash_table_insert(index->postings, key, postings);
+		}
+		// Documents are indexed one at a time, so this catches repeats within one of them
+		if (postings->len == 0 || g_array_index(postings, guint, postings->len - 1) != document_number)
+			g_array_append_val(postings, document_number);
+	}
+}
+
+static void __pwml_search_set_field(_PWML_SearchIndex* index, guint document_number, __PWML_SearchField field, const char* text) {
+	if (!text)
+		return;
+	__PWML_SearchDocument* document = g_ptr_array_index(index->documents, document_number);
+	g_free(document->fields[field]);
+	document->fields[field] = __pwml_search_fold(text);
+	__pwml_search_index_text(index, document_number, document->fields[field]);
+}
+
+_PWML_SearchIndex* _pwml_search_index_new(GHashTable* mods) {
+	gint64 trace_start = _pwml_trace_begin();
+
+	_PWML_SearchIndex* index = malloc(sizeof(_PWML_SearchIndex));
+	index->documents = g_ptr_array_new_with_free_func(__pwml_search_document_free);
+	index->document_numbers = g_hash_table_new(g_direct_hash, g_direct_equal);
+	index->postings = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, __pwml_search_postings_free);
+	index->candidates = g_ptr_array_new();
+	index->stamp = 0;
+	g_mutex_init(&index->mutex);
+
+	GHashTableIter iter;
+	g_hash_table_iter_init(&iter, mods);
+
+	PWML_Mod* mod;
+	while (g_hash_table_iter_next(&iter, NULL, (void**)&mod)) {
+		guint document_number = index->documents->len;
+		__PWML_SearchDocument* document = calloc(1, sizeof(__PWML_SearchDocument));
+		document->mod = mod;
+		g_ptr_array_add(index->documents, document);
+		g_hash_table_insert(index->document_numbers, mod, GUINT_TO_POINTER(document_number + 1));
+
+		__pwml_search_set_field(index, document_number, SEARCH_FIELD_ID, mod->id);
+		__pwml_search_set_field(index, document_number, SEARCH_FIELD_NAME, mod->name);
+		__pwml_search_set_field(index, document_number, SEARCH_FIELD_SHORT_DESCRIPTION, mod->short_description);
+		__pwml_search_set_field(index, document_number, SEARCH_FIELD_DESCRIPTION, mod->description);
+	}
+
+	_pwml_trace_end("load", "search_index", NULL, trace_start);
+	return index;
+}
+
+void _pwml_search_index_free(_PWML_SearchIndex* index) {
+	if (!index)
+		return;
+	g_ptr_array_free(index->documents, true);
+	g_hash_table_destroy(index->document_numbers);
+	g_hash_table_destroy(index->postings);
+	g_ptr_array_free(index->candidates, true);
+	g_mutex_clear(&index->mutex);
+	free(index);
+}
+
+void _pwml_search_index_add_description(_PWML_SearchIndex* index, PWML_Mod* mod, const char* description) {
+	if (!index)
+		return;
+	guint document_number = GPOINTER_TO_UINT(g_hash_table_lookup(index->document_numbers, mod));
+	if (document_number == 0)
+		return;
+	g_mutex_lock(&index->mutex);
+	// Indexing it again would only add duplicate postings
+	__PWML_SearchDocument* document = g_ptr_array_index(index->documents, document_number - 1);
+	if (!document->fields[SEARCH_FIELD_DESCRIPTION])
+		__pwml_search_set_field(index, document_number - 1, SEARCH_FIELD_DESCRIPTION, description);
+	g_mutex_unlock(&index->mutex);
+}
+
+// 0 if some word of the query isn't in any field
+static guint __pwml_search_score(__PWML_SearchDocument* document, char** words) {
+	guint score = 0;
+	for (uint w = 0; words[w]; w++) {
+		guint word_score = 0;
+		for (uint f = 0; f < SEARCH_FIELD_COUNT; f++) {
+			if (!document->fields[f])
+				continue;
+			const char* match = strstr(document->fields[f], words[w]);
+			if (!match)
+				continue;
+			guint field_score = FIELD_SCORES[f] + (match == document->fields[f] ? PREFIX_SCORE : 0);
+			word_score = MAX(word_score, field_score);
+		}
+		if (word_score == 0)
+			return 0;
+		score += word_score;
+	}
+	return score;
+}
+
+static int __pwml_search_compare(gconstpointer a, gconstpointer b) {
+	const __PWML_SearchDocument* document_a = *(__PWML_SearchDocument* const*)a;
+	const __PWML_SearchDocument* document_b = *(__PWML_SearchDocument* const*)b;
+	if (document_a->score != document_b->score)
+		return document_a->score > document_b->score ? -1 : 1;
+	return strcmp(document_a->mod->id, document_b->mod->id);
+}
+
+// The rarest trigram of the query's words, NULL if every word is too short to have one
+static GArray* __pwml_search_rarest_postings(_PWML_SearchIndex* index, char** words, bool* empty) {
+	GArray* rarest = NULL;
+	*empty = false;
+	for (uint w = 0; words[w]; w++) {
+		for (gsize i = 0; words[w][i] && words[w][i + 1] && words[w][i + 2]; i++) {
+			GArray* postings = g_hash_table_lookup(index->postings, GUINT_TO_POINTER(__pwml_search_trigram(words[w] + i)));
+			if (!postings) {
+				*empty = true;
+				return NULL;
+			}
+			if (!rarest || postings->len < rarest->len)
+				rarest = postings;
+		}
+	}
+	return rarest;
+}
+
+static void __pwml_search_consider(_PWML_SearchIndex* index, __PWML_SearchDocument* document, char** words) {
+	if (document->stamp == index->stamp)
+		return;
+	document->stamp = index->stamp;
+	document->score = __pwml_search_score(document, words);
+	if (document->score > 0)
+		g_ptr_array_add(index->candidates, document);
+}
+
+uint pwml_search_mods(PWML* pwml, const char* query, char** results, uint max_results) {
+	if (max_results == 0)
+		return 0;
+
+	g_rw_lock_reader_lock(&pwml->catalog_lock);
+	_PWML_SearchIndex* index = pwml->search_index;
+	if (!index) {
+		g_rw_lock_reader_unlock(&pwml->catalog_lock);
+		return 0;
+	}
+	g_mutex_lock(&index->mutex);
+
+	char* folded = __pwml_search_fold(query);
+	char** words = g_strsplit_set(folded, " \t\n", -1);
+	g_free(folded);
+
+	// Drop the empty words consecutive spaces leave behind
+	uint word_count = 0;
+	for (uint i = 0; words[i]; i++) {
+		if (*words[i])
+			words[word_count++] = words[i];
+		else
+			g_free(words[i]);
+	}
+	words[word_count] = NULL;
+
+	uint result_count = 0;
+	if (word_count == 0)
+		goto cleanup;
+
+	index->stamp++;
+	g_ptr_array_set_size(index->candidates, 0);
+
+	bool empty;
+	GArray* postings = __pwml_search_rarest_postings(index, words, &empty);
+	if (empty)
+		goto cleanup;
+
+	if (postings) {
+		for (uint i = 0; i < postings->len; i++) {
+			__pwml_search_consider(index, g_ptr_array_index(index->documents, g_array_index(postings, guint, i)), words);
+		}
+	} else {
+		// Only one and two letter words, there's nothing to narrow the search with
+		for (uint i = 0; i < index->documents->len; i++) {
+			__pwml_search_consider(index, g_ptr_array_index(index->documents, i), words);
+		}
+	}
+
+	g_ptr_array_sort(index->candidates, __pwml_search_compare);
+	result_count = MIN(max_results, index->candidates->len);
+	for (uint i = 0; i < result_count; i++) {
+		results[i] = strdup(((__PWML_SearchDocument*)g_ptr_array_index(index->candidates, i))->mod->id);
+	}
+
+cleanup:
+	g_mutex_unlock(&index->mutex);
+	g_rw_lock_reader_unlock(&pwml->catalog_lock);
+	g_strfreev(words);
+	return result_count;
+}
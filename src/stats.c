@@ -0,0 +1,128 @@
+#include "PWML/stats.h"
+#include "PWML/file_utils.h"
+#include "PWML/pwml.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* const PHASE_NAMES[PWML_PHASE_COUNT] = {
+	[PWML_PHASE_DELETE] = "delete",
+	[PWML_PHASE_COPY] = "copy",
+	[PWML_PHASE_WEAPONS_SCAN] = "weapons_scan",
+	[PWML_PHASE_WEAPONS_DAT] = "weapons_dat",
+	[PWML_PHASE_MENU_MUSIC] = "menu_music",
+	[PWML_PHASE_GRAPHICS_XML] = "graphics_xml",
+	[PWML_PHASE_SOUNDS_XML] = "sounds_xml",
+};
+
+static void __pwml_mod_stats_free(void* voidptr_mod_stats) {
+	PWML_ModStats* mod_stats = (PWML_ModStats*)voidptr_mod_stats;
+	free((char*)mod_stats->id);
+	free(mod_stats);
+}
+
+static PWML_Stats* __pwml_stats_new(void) {
+	PWML_Stats* stats = calloc(1, sizeof(PWML_Stats));
+	stats->mods = g_ptr_array_new_with_free_func(__pwml_mod_stats_free);
+	stats->mods_by_id = g_hash_table_new(g_str_hash, g_str_equal);
+	return stats;
+}
+
+void pwml_stats_free(PWML_Stats* stats) {
+	if (!stats)
+		return;
+	g_hash_table_destroy(stats->mods_by_id);
+	g_ptr_array_free(stats->mods, true);
+	free(stats);
+}
+
+// Both wait for a running apply, which records into the stats as it goes
+void pwml_set_stats_enabled(PWML* pwml, bool enabled) {
+	g_mutex_lock(&pwml->apply_mutex);
+	g_mutex_lock(&pwml->stats_mutex);
+	if (enabled && !pwml->stats) {
+		pwml->stats = __pwml_stats_new();
+	} else if (!enabled && pwml->stats) {
+		pwml_stats_free(pwml->stats);
+		pwml->stats = NULL;
+	}
+	g_mutex_unlock(&pwml->stats_mutex);
+	g_mutex_unlock(&pwml->apply_mutex);
+}
+
+PWML_Stats* pwml_get_stats(PWML* pwml) {
+	g_mutex_lock(&pwml->stats_mutex);
+	if (!pwml->stats) {
+		g_mutex_unlock(&pwml->stats_mutex);
+		return NULL;
+	}
+
+	PWML_Stats* copy = __pwml_stats_new();
+	memcpy(copy->phases, pwml->stats->phases, sizeof(copy->phases));
+	for (uint i = 0; i < pwml->stats->mods->len; i++) {
+		PWML_ModStats* mod_stats = g_ptr_array_index(pwml->stats->mods, i);
+		PWML_ModStats* mod_copy = malloc(sizeof(PWML_ModStats));
+		memcpy(mod_copy, mod_stats, sizeof(PWML_ModStats));
+		mod_copy->id = strdup(mod_stats->id);
+		g_ptr_array_add(copy->mods, mod_copy);
+		g_hash_table_insert(copy->mods_by_id, (char*)mod_copy->id, mod_copy);
+	}
+	g_mutex_unlock(&pwml->stats_mutex);
+	return copy;
+}
+
+void pwml_reset_stats(PWML* pwml) {
+	g_mutex_lock(&pwml->apply_mutex);
+	g_mutex_lock(&pwml->stats_mutex);
+	if (pwml->stats) {
+		pwml_stats_free(pwml->stats);
+		pwml->stats = __pwml_stats_new();
+	}
+	g_mutex_unlock(&pwml->stats_mutex);
+	g_mutex_unlock(&pwml->apply_mutex);
+}
+
+const char* pwml_phase_get_name(PWML_Phase phase) {
+	if (phase >= PWML_PHASE_COUNT)
+		return NULL;
+	return PHASE_NAMES[phase];
+}
+
+gint64 _pwml_stats_begin(PWML* pwml) {
+	if (!pwml->stats)
+		return 0;
+	return g_get_monotonic_time();
+}
+
+static void __pwml_phase_stats_add(PWML_PhaseStats* phase_stats, gint64 elapsed, const _File_Utils_Counters* counters) {
+	phase_stats->wall_time_us += elapsed;
+	if (counters) {
+		phase_stats->files += counters->files;
+		phase_stats->bytes += counters->bytes;
+		phase_stats->errors += counters->errors;
+	}
+}
+
+void _pwml_stats_end(PWML* pwml, PWML_Phase phase, const char* mod_id, gint64 start, const _File_Utils_Counters* counters) {
+	if (!pwml->stats)
+		return;
+
+	gint64 elapsed = g_get_monotonic_time() - start;
+	g_mutex_lock(&pwml->stats_mutex);
+	__pwml_phase_stats_add(&pwml->stats->phases[phase], elapsed, counters);
+
+	if (!mod_id) {
+		g_mutex_unlock(&pwml->stats_mutex);
+		return;
+	}
+
+	PWML_ModStats* mod_stats = g_hash_table_lookup(pwml->stats->mods_by_id, mod_id);
+	if (!mod_stats) {
+		mod_stats = calloc(1, sizeof(PWML_ModStats));
+		mod_stats->id = strdup(mod_id);
+		g_ptr_array_add(pwml->stats->mods, mod_stats);
+		g_hash_table_insert(pwml->stats->mods_by_id, (char*)mod_stats->id, mod_stats);
+	}
+	__pwml_phase_stats_add(&mod_stats->phases[phase], elapsed, counters);
+	g_mutex_unlock(&pwml->stats_mutex);
+}
@@ -0,0 +1,263 @@
+#include "PWML/trace.h"
+#include <glib.h>
+#include <json-c/json_object.h>
+#include <json-c/json_types.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Events kept per thread between flushes, the oldest ones are dropped after that
+#define TRACE_BUFFER_CAPACITY 16384
+
+typedef struct {
+	const char* category;
+	const char* name;
+	char* detail;
+	gint64 start;
+	gint64 duration;
+} __PWML_TraceEvent;
+
+typedef struct {
+	GMutex mutex;
+	guint id;
+	bool named;
+	// Set once the owning thread exits, the next flush frees the buffer
+	bool orphaned;
+	guint head;
+	guint count;
+	guint64 dropped;
+	__PWML_TraceEvent events[TRACE_BUFFER_CAPACITY];
+} __PWML_TraceBuffer;
+
+static void __pwml_trace_buffer_orphan(gpointer buffer);
+
+static gint tracing = 0;
+static GMutex trace_mutex;
+static FILE* trace_file = NULL;
+static bool trace_first_event = true;
+static gint64 trace_epoch = 0;
+static GPtrArray* trace_buffers = NULL;
+static guint trace_next_thread_id = 1;
+static GPrivate trace_buffer_key = G_PRIVATE_INIT(__pwml_trace_buffer_orphan);
+static gsize trace_environment_checked = 0;
+
+static void __pwml_trace_buffer_orphan(gpointer voidptr_buffer) {
+	__PWML_TraceBuffer* buffer = (__PWML_TraceBuffer*)voidptr_buffer;
+	g_mutex_lock(&buffer->mutex);
+	buffer->orphaned = true;
+	g_mutex_unlock(&buffer->mutex);
+}
+
+static void __pwml_trace_check_environment(void) {
+	if (g_once_init_enter(&trace_environment_checked)) {
+		const char* path = g_getenv("PWML_TRACE");
+		// Nobody calls pwml_trace_stop for a trace they didn't start, the array is closed at exit instead
+		if (path && *path && pwml_trace_start(path))
+			atexit(pwml_trace_stop);
+		g_once_init_leave(&trace_environment_checked, 1);
+	}
+}
+
+static __PWML_TraceBuffer* __pwml_trace_get_buffer(void) {
+	__PWML_TraceBuffer* buffer = g_private_get(&trace_buffer_key);
+	if (buffer)
+		return buffer;
+
+	buffer = g_malloc0(sizeof(__PWML_TraceBuffer));
+	g_mutex_init(&buffer->mutex);
+
+	g_mutex_lock(&trace_mutex);
+	buffer->id = trace_next_thread_id++;
+	if (!trace_buffers)
+		trace_buffers = g_ptr_array_new();
+	g_ptr_array_add(trace_buffers, buffer);
+	g_mutex_unlock(&trace_mutex);
+
+	g_private_set(&trace_buffer_key, buffer);
+	return buffer;
+}
+
+static void __pwml_trace_write(json_object* event) {
+	fputs(trace_first_event ? "\n" : ",\n", trace_file);
+	fputs(json_object_to_json_string_ext(event, JSON_C_TO_STRING_PLAIN), trace_file);
+	trace_first_event = false;
+	json_object_put(event);
+}
+
+static json_object* __pwml_trace_new_event(const char* name, const char* phase, guint thread_id) {
+	json_object* event = json_object_new_object();
+	json_object_object_add(event, "name", json_object_new_string(name));
+	json_object_object_add(event, "ph", json_object_new_string(phase));
+	json_object_object_add(event, "pid", json_object_new_int(getpid()));
+	json_object_object_add(event, "tid", json_object_new_int(thread_id));
+	return event;
+}
+
+// Expects trace_mutex and the buffer's mutex to be held
+static void __pwml_trace_drain_buffer(__PWML_TraceBuffer* buffer) {
+	if (!buffer->named) {
+		json_object* event = __pwml_trace_new_event("thread_name", "M", buffer->id);
+		json_object* args = json_object_new_object();
+		char* thread_name = g_strdup_printf("PWML thread %u", buffer->id);
+		json_object_object_add(args, "name", json_object_new_string(thread_name));
+		json_object_object_add(event, "args", args);
+		__pwml_trace_write(event);
+		g_free(thread_name);
+		buffer->named = true;
+	}
+
+	for (guint i = 0; i < buffer->count; i++) {
+		__PWML_TraceEvent* trace_event = &buffer->events[(buffer->head + i) % TRACE_BUFFER_CAPACITY];
+
+		json_object* event = __pwml_trace_new_event(trace_event->name, "X", buffer->id);
+		json_object_object_add(event, "cat", json_object_new_string(trace_event->category));
+		json_object_object_add(event, "ts", json_object_new_int64(trace_event->start - trace_epoch));
+		json_object_object_add(event, "dur", json_object_new_int64(trace_event->duration));
+		if (trace_event->detail) {
+			json_object* args = json_object_new_object();
+			json_object_object_add(args, "detail", json_object_new_string(trace_event->detail));
+			json_object_object_add(event, "args", args);
+		}
+		__pwml_trace_write(event);
+
+		free(trace_event->detail);
+		trace_event->detail = NULL;
+	}
+
+	if (buffer->dropped > 0) {
+		json_object* event = __pwml_trace_new_event("dropped_events", "i", buffer->id);
+		json_object_object_add(event, "ts", json_object_new_int64(g_get_monotonic_time() - trace_epoch));
+		json_object_object_add(event, "s", json_object_new_string("t"));
+		json_object* args = json_object_new_object();
+		json_object_object_add(args, "count", json_object_new_int64(buffer->dropped));
+		json_object_object_add(event, "args", args);
+		__pwml_trace_write(event);
+	}
+
+	buffer->head = 0;
+	buffer->count = 0;
+	buffer->dropped = 0;
+}
+
+static void __pwml_trace_discard_buffer(__PWML_TraceBuffer* buffer) {
+	for (guint i = 0; i < buffer->count; i++) {
+		free(buffer->events[(buffer->head + i) % TRACE_BUFFER_CAPACITY].detail);
+	}
+	buffer->head = 0;
+	buffer->count = 0;
+	buffer->dropped = 0;
+	buffer->named = false;
+}
+
+// Expects trace_mutex to be held
+static void __pwml_trace_flush_locked(bool discard) {
+	if (!trace_buffers)
+		return;
+
+	for (guint i = 0; i < trace_buffers->len;) {
+		__PWML_TraceBuffer* buffer = g_ptr_array_index(trace_buffers, i);
+		g_mutex_lock(&buffer->mutex);
+		if (discard || !trace_file)
+			__pwml_trace_discard_buffer(buffer);
+		else
+			__pwml_trace_drain_buffer(buffer);
+		bool orphaned = buffer->orphaned;
+		g_mutex_unlock(&buffer->mutex);
+
+		if (orphaned) {
+			g_mutex_clear(&buffer->mutex);
+			g_free(buffer);
+			g_ptr_array_remove_index_fast(trace_buffers, i);
+		} else {
+			i++;
+		}
+	}
+
+	if (trace_file)
+		fflush(trace_file);
+}
+
+bool pwml_trace_start(const char* path) {
+	g_mutex_lock(&trace_mutex);
+	if (trace_file) {
+		g_mutex_unlock(&trace_mutex);
+		g_printerr("Couldn't start tracing to %s; Tracing is already on.\n", path);
+		return false;
+	}
+
+	trace_file = fopen(path, "w");
+	if (!trace_file) {
+		g_mutex_unlock(&trace_mutex);
+		g_printerr("Failed to open trace file %s\n", path);
+		return false;
+	}
+
+	// Anything buffered while tracing was off belongs to no file
+	__pwml_trace_flush_locked(true);
+
+	fputs("[", trace_file);
+	trace_first_event = true;
+	trace_epoch = g_get_monotonic_time();
+	g_atomic_int_set(&tracing, 1);
+	g_mutex_unlock(&trace_mutex);
+	return true;
+}
+
+void pwml_trace_stop(void) {
+	g_mutex_lock(&trace_mutex);
+	g_atomic_int_set(&tracing, 0);
+	if (trace_file) {
+		__pwml_trace_flush_locked(false);
+		fputs("\n]\n", trace_file);
+		fclose(trace_file);
+		trace_file = NULL;
+	}
+	g_mutex_unlock(&trace_mutex);
+}
+
+bool pwml_trace_is_enabled(void) {
+	__pwml_trace_check_environment();
+	return g_atomic_int_get(&tracing);
+}
+
+gint64 _pwml_trace_begin(void) {
+	if (!pwml_trace_is_enabled())
+		return 0;
+	return g_get_monotonic_time();
+}
+
+void _pwml_trace_end(const char* category, const char* name, const char* detail, gint64 start) {
+	if (start == 0 || !g_atomic_int_get(&tracing))
+		return;
+
+	gint64 now = g_get_monotonic_time();
+	__PWML_TraceBuffer* buffer = __pwml_trace_get_buffer();
+
+	g_mutex_lock(&buffer->mutex);
+	if (buffer->count == TRACE_BUFFER_CAPACITY) {
+		free(buffer->events[buffer->head].detail);
+		buffer->head = (buffer->head + 1) % TRACE_BUFFER_CAPACITY;
+		buffer->count--;
+		buffer->dropped++;
+	}
+
+	__PWML_TraceEvent* event = &buffer->events[(buffer->head + buffer->count) % TRACE_BUFFER_CAPACITY];
+	event->category = category;
+	event->name = name;
+	event->detail = detail ? strdup(detail) : NULL;
+	event->start = start;
+	event->duration = now - start;
+	buffer->count++;
+	g_mutex_unlock(&buffer->mutex);
+}
+
+void _pwml_trace_flush(void) {
+	if (!g_atomic_int_get(&tracing))
+		return;
+
+	g_mutex_lock(&trace_mutex);
+	__pwml_trace_flush_locked(false);
+	g_mutex_unlock(&trace_mutex);
+}
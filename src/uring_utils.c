@@ -0,0 +1,289 @@
+#include "PWML/uring_utils.h"
+#include "PWML/file_utils.h"
+#include "PWML/trace.h"
+#include <glib.h>
+#include <stdbool.h>
+
+#ifdef PWML_HAVE_LIBURING
+
+#include <errno.h>
+#include <fcntl.h>
+#include <liburing.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Files per batch. Every stage submits at most three sqes per file.
+#define QUEUE_DEPTH 64
+// Bigger files are handed to the synchronous copy, reading them into one buffer isn't worth it
+#define SMALL_FILE_LIMIT (1024 * 1024)
+// Fewer files than this are left to the synchronous path, the round trips between the stages cost more than they save
+#define MIN_BATCH_FILES 8
+// user_data of sqes whose result nobody looks at
+#define IGNORED_RESULT UINT64_MAX
+
+typedef struct {
+	_File_Utils_CopyJob* job;
+	int source_fd;
+	int destination_fd;
+	struct statx stat;
+	char* buffer;
+	bool failed;
+} __Uring_Utils_CopySlot;
+
+typedef struct {
+	struct io_uring ring;
+	// NULL if the ring couldn't be set up, it isn't tried again on this thread
+	struct io_uring_probe* probe;
+} __Uring_Utils_Ring;
+
+static void __uring_utils_ring_free(gpointer voidptr_ring) {
+	__Uring_Utils_Ring* ring = (__Uring_Utils_Ring*)voidptr_ring;
+	if (ring->probe) {
+		io_uring_free_probe(ring->probe);
+		io_uring_queue_exit(&ring->ring);
+	}
+	free(ring);
+}
+
+// Every batch a thread submits goes through the same ring, the copy workers of an apply set it up once
+static GPrivate ring_key = G_PRIVATE_INIT(__uring_utils_ring_free);
+
+// The calling thread's ring, NULL if io_uring can't be used or lacks one of the opcodes
+static struct io_uring* __uring_utils_get_ring(const int* opcodes, uint opcode_count) {
+	if (g_getenv("PWML_DISABLE_IO_URING"))
+		return NULL;
+
+	__Uring_Utils_Ring* ring = g_private_get(&ring_key);
+	if (!ring) {
+		ring = calloc(1, sizeof(__Uring_Utils_Ring));
+		if (io_uring_queue_init(QUEUE_DEPTH * 3, &ring->ring, 0) >= 0) {
+			ring->probe = io_uring_get_probe_ring(&ring->ring);
+			if (!ring->probe)
+				io_uring_queue_exit(&ring->ring);
+		}
+		g_private_set(&ring_key, ring);
+	}
+
+	if (!ring->probe)
+		return NULL;
+	for (uint i = 0; i < opcode_count; i++) {
+		if (!io_uring_opcode_supported(ring->probe, opcodes[i]))
+			return NULL;
+	}
+	return &ring->ring;
+}
+
+// Submits everything queued and stores each completion's result at results[user_data]
+static void __uring_utils_reap(struct io_uring* ring, uint submitted, int* results, uint result_count) {
+	for (uint i = 0; i < result_count; i++)
+		results[i] = -ECANCELED;
+
+	if (submitted == 0)
+		return;
+
+	io_uring_submit_and_wait(ring, submitted);
+	for (uint i = 0; i < submitted; i++) {
+		struct io_uring_cqe* cqe;
+		if (io_uring_wait_cqe(ring, &cqe) < 0)
+			break;
+		uint64_t index = io_uring_cqe_get_data64(cqe);
+		if (index < result_count)
+			results[index] = cqe->res;
+		io_uring_cqe_seen(ring, cqe);
+	}
+}
+
+static void __uring_utils_copy_batch(_File_Utils_Context* context, struct io_uring* ring, __Uring_Utils_CopySlot* slots, uint count) {
+	int results[QUEUE_DEPTH * 2];
+	uint result_count = count * 2;
+	uint submitted = 0;
+	struct io_uring_sqe* sqe;
+
+	// Open and stat the sources
+	for (uint i = 0; i < count; i++) {
+		sqe = io_uring_get_sqe(ring);
+		io_uring_prep_openat(sqe, AT_FDCWD, slots[i].job->source, O_RDONLY | O_CLOEXEC, 0);
+		io_uring_sqe_set_data64(sqe, i * 2);
+		sqe = io_uring_get_sqe(ring);
+		io_uring_prep_statx(sqe, AT_FDCWD, slots[i].job->source, AT_SYMLINK_NOFOLLOW, STATX_MODE | STATX_SIZE, &slots[i].stat);
+		io_uring_sqe_set_data64(sqe, i * 2 + 1);
+		submitted += 2;
+	}
+	__uring_utils_reap(ring, submitted, results, result_count);
+
+	for (uint i = 0; i < count; i++) {
+		slots[i].source_fd = results[i * 2];
+		if (slots[i].source_fd < 0 || results[i * 2 + 1] < 0)
+			slots[i].failed = true;
+		else if (!S_ISREG(slots[i].stat.stx_mode) || slots[i].stat.stx_size > SMALL_FILE_LIMIT)
+			slots[i].failed = true;
+	}
+
+	// Read the sources and create the destinations. An existing destination is unlinked first, it may be a
+	// symlink or a hard link to a mod's own copy and writing through it would change the file it points to.
+	submitted = 0;
+	for (uint i = 0; i < count; i++) {
+		if (slots[i].failed)
+			continue;
+
+		uint size = slots[i].stat.stx_size;
+		slots[i].buffer = malloc(size > 0 ? size : 1);
+		if (size > 0) {
+			sqe = io_uring_get_sqe(ring);
+			io_uring_prep_read(sqe, slots[i].source_fd, slots[i].buffer, size, 0);
+			io_uring_sqe_set_data64(sqe, i * 2);
+			submitted++;
+		}
+
+		sqe = io_uring_get_sqe(ring);
+		io_uring_prep_unlinkat(sqe, AT_FDCWD, slots[i].job->destination, 0);
+		io_uring_sqe_set_data64(sqe, IGNORED_RESULT);
+		// The open still runs if there was nothing to unlink
+		sqe->flags |= IOSQE_IO_HARDLINK;
+		sqe = io_uring_get_sqe(ring);
+		io_uring_prep_openat(sqe, AT_FDCWD, slots[i].job->destination, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, slots[i].stat.stx_mode & 07777);
+		io_uring_sqe_set_data64(sqe, i * 2 + 1);
+		submitted += 2;
+	}
+	__uring_utils_reap(ring, submitted, results, result_count);
+
+	for (uint i = 0; i < count; i++) {
+		if (slots[i].failed)
+			continue;
+		slots[i].destination_fd = results[i * 2 + 1];
+		if (slots[i].destination_fd < 0)
+			slots[i].failed = true;
+		if (slots[i].stat.stx_size > 0 && results[i * 2] != (int)slots[i].stat.stx_size)
+			slots[i].failed = true;
+	}
+
+	// Write the destinations and close the sources
+	submitted = 0;
+	for (uint i = 0; i < count; i++) {
+		if (!slots[i].failed && slots[i].stat.stx_size > 0) {
+			sqe = io_uring_get_sqe(ring);
+			io_uring_prep_write(sqe, slots[i].destination_fd, slots[i].buffer, slots[i].stat.stx_size, 0);
+			io_uring_sqe_set_data64(sqe, i * 2);
+			submitted++;
+		}
+		if (slots[i].source_fd >= 0) {
+			sqe = io_uring_get_sqe(ring);
+			io_uring_prep_close(sqe, slots[i].source_fd);
+			io_uring_sqe_set_data64(sqe, i * 2 + 1);
+			submitted++;
+		}
+	}
+	__uring_utils_reap(ring, submitted, results, result_count);
+
+	for (uint i = 0; i < count; i++) {
+		if (!slots[i].failed && slots[i].stat.stx_size > 0 && results[i * 2] != (int)slots[i].stat.stx_size)
+			slots[i].failed = true;
+	}
+
+	// Close the destinations, fsyncing them first if the copies have to be durable
+	bool strict = context && context->durability == PWML_DURABILITY_STRICT;
+	submitted = 0;
+	for (uint i = 0; i < count; i++) {
+		if (slots[i].destination_fd >= 0) {
+			if (strict && !slots[i].failed) {
+				sqe = io_uring_get_sqe(ring);
+				io_uring_prep_fsync(sqe, slots[i].destination_fd, 0);
+				io_uring_sqe_set_data64(sqe, i * 2 + 1);
+				// The close still runs if the fsync fails
+				sqe->flags |= IOSQE_IO_HARDLINK;
+				submitted++;
+			}
+			sqe = io_uring_get_sqe(ring);
+			io_uring_prep_close(sqe, slots[i].destination_fd);
+			io_uring_sqe_set_data64(sqe, i * 2);
+			submitted++;
+		}
+	}
+	__uring_utils_reap(ring, submitted, results, result_count);
+
+	if (strict) {
+		for (uint i = 0; i < count; i++) {
+			if (!slots[i].failed && slots[i].destination_fd >= 0 && results[i * 2 + 1] < 0)
+				slots[i].failed = true;
+		}
+	}
+
+	for (uint i = 0; i < count; i++) {
+		free(slots[i].buffer);
+		if (slots[i].failed)
+			_file_utils_copy_job(context, slots[i].job);
+		else
+			_file_utils_count(context, true, slots[i].stat.stx_size);
+	}
+}
+
+bool _uring_utils_copy_files(_File_Utils_Context* context, GPtrArray* jobs) {
+	const int opcodes[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_CLOSE, IORING_OP_UNLINKAT };
+	if (jobs->len < MIN_BATCH_FILES)
+		return false;
+	struct io_uring* ring = __uring_utils_get_ring(opcodes, G_N_ELEMENTS(opcodes));
+	if (!ring)
+		return false;
+
+	__Uring_Utils_CopySlot slots[QUEUE_DEPTH];
+	for (uint start = 0; start < jobs->len; start += QUEUE_DEPTH) {
+		uint count = MIN(QUEUE_DEPTH, jobs->len - start);
+		memset(slots, 0, sizeof(slots));
+		for (uint i = 0; i < count; i++) {
+			slots[i].job = g_ptr_array_index(jobs, start + i);
+			slots[i].source_fd = -1;
+			slots[i].destination_fd = -1;
+		}
+		gint64 trace_start = _pwml_trace_begin();
+		__uring_utils_copy_batch(context, ring, slots, count);
+		_pwml_trace_end("copy", "uring_batch", NULL, trace_start);
+	}
+	return true;
+}
+
+bool _uring_utils_unlink_files(_File_Utils_Context* context, GPtrArray* paths) {
+	const int opcodes[] = { IORING_OP_UNLINKAT };
+	if (paths->len < MIN_BATCH_FILES)
+		return false;
+	struct io_uring* ring = __uring_utils_get_ring(opcodes, G_N_ELEMENTS(opcodes));
+	if (!ring)
+		return false;
+
+	int results[QUEUE_DEPTH * 2];
+	for (uint start = 0; start < paths->len; start += QUEUE_DEPTH * 2) {
+		uint count = MIN(QUEUE_DEPTH * 2, paths->len - start);
+		for (uint i = 0; i < count; i++) {
+			struct io_uring_sqe* sqe = io_uring_get_sqe(ring);
+			io_uring_prep_unlinkat(sqe, AT_FDCWD, g_ptr_array_index(paths, start + i), 0);
+			io_uring_sqe_set_data64(sqe, i);
+		}
+		__uring_utils_reap(ring, count, results, count);
+
+		for (uint i = 0; i < count; i++) {
+			if (results[i] < 0 && results[i] != -ENOENT)
+				_file_utils_count(context, remove(g_ptr_array_index(paths, start + i)) == 0, 0);
+			else
+				_file_utils_count(context, true, 0);
+		}
+	}
+	return true;
+}
+
+#else
+
+bool _uring_utils_copy_files(_File_Utils_Context* context, GPtrArray* jobs) {
+	(void)context;
+	(void)jobs;
+	return false;
+}
+
+bool _uring_utils_unlink_files(_File_Utils_Context* context, GPtrArray* paths) {
+	(void)context;
+	(void)paths;
+	return false;
+}
+
+#endif
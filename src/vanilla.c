@@ -0,0 +1,596 @@
+#include "PWML/vanilla.h"
+#include "PWML/cache.h"
+#include "PWML/deploy.h"
+#include "PWML/file_utils.h"
+#include "PWML/hash.h"
+#include "PWML/json_utils.h"
+#include "PWML/pwml.h"
+#include "PWML/resource.h"
+#include "PWML/trace.h"
+#include "PWML/weapon.h"
+#include <glib.h>
+#include <json-c/json_object.h>
+#include <json-c/json_types.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+const char* const PWML_CAPTURE_MANIFEST_JSON = "capture.json";
+
+typedef struct {
+	// Of the game file when it was captured or last found unchanged
+	gint64 size;
+	gint64 mtime;
+	// The file's hash as of size and mtime, NULL until a refresh needs it
+	char* digest;
+} __PWML_CaptureEntry;
+
+typedef struct {
+	// Every captured game file relative to the working directory -> __PWML_CaptureEntry*
+	GHashTable* files;
+	// The manifest's mtime in nanoseconds, 0 if there is none
+	gint64 mtime;
+} __PWML_CaptureManifest;
+
+typedef struct {
+	PWML* pwml;
+	// PWML writes the generated files itself, ones with a newer ctime were written by something else
+	gint64 reference;
+	__PWML_CaptureManifest* manifest;
+	// Every game file the walk found, relative like the manifest
+	GHashTable* seen;
+	GPtrArray* jobs;
+	PWML_RefreshResult* result;
+} __PWML_RefreshState;
+
+static const char* __pwml_vanilla_get_data_folder(PWML* pwml) {
+	return g_build_filename(pwml->mods_path, "vanilla", PWML_MOD_DATA_FOLDER, NULL);
+}
+
+// The game folders are all built from the working directory
+static const char* __pwml_vanilla_relative(PWML* pwml, const char* path) {
+	return path + strlen(pwml->working_directory) + 1;
+}
+
+static gint64 __pwml_vanilla_mtime(const struct stat* stat_buf) {
+	return (gint64)stat_buf->st_mtim.tv_sec * 1000000000 + stat_buf->st_mtim.tv_nsec;
+}
+
+static gint64 __pwml_vanilla_ctime(const struct stat* stat_buf) {
+	return (gint64)stat_buf->st_ctim.tv_sec * 1000000000 + stat_buf->st_ctim.tv_nsec;
+}
+
+static void __pwml_vanilla_entry_free(void* voidptr_entry) {
+	__PWML_CaptureEntry* entry = (__PWML_CaptureEntry*)voidptr_entry;
+	free(entry->digest);
+	free(entry);
+}
+
+// Takes digest, which may be NULL
+static void __pwml_vanilla_record(__PWML_CaptureManifest* manifest, const char* relative, const struct stat* stat_buf, char* digest) {
+	__PWML_CaptureEntry* entry = malloc(sizeof(__PWML_CaptureEntry));
+	entry->size = stat_buf->st_size;
+	entry->mtime = __pwml_vanilla_mtime(stat_buf);
+	entry->digest = digest;
+	g_hash_table_insert(manifest->files, strdup(relative), entry);
+}
+
+static const char* __pwml_vanilla_get_manifest_path(PWML* pwml) {
+	return g_build_filename(pwml->working_directory, PWML_CACHE_FOLDER, PWML_CAPTURE_MANIFEST_JSON, NULL);
+}
+
+static void __pwml_vanilla_load_manifest(PWML* pwml, __PWML_CaptureManifest* manifest) {
+	manifest->files = g_hash_table_new_full(g_str_hash, g_str_equal, free, __pwml_vanilla_entry_free);
+	manifest->mtime = 0;
+
+	const char* json_path = __pwml_vanilla_get_manifest_path(pwml);
+	struct stat stat_buf;
+	if (stat(json_path, &stat_buf) != 0) {
+		free((char*)json_path);
+		return;
+	}
+	manifest->mtime = __pwml_vanilla_mtime(&stat_buf);
+
+	json_object* root = _json_utils_load(json_path, NULL);
+	free((char*)json_path);
+	if (!root)
+		return;
+
+	json_object* files;
+	if (json_object_object_get_ex(root, "files", &files) && json_object_get_type(files) == json_type_object) {
+		json_object_object_foreach(files, key, j_entry) {
+			json_object *size, *mtime, *digest;
+			__PWML_CaptureEntry* entry = calloc(1, sizeof(__PWML_CaptureEntry));
+			if (json_object_object_get_ex(j_entry, "size", &size) && json_object_object_get_ex(j_entry, "mtime", &mtime)) {
+				entry->size = json_object_get_int64(size);
+				entry->mtime = json_object_get_int64(mtime);
+			} else {
+				entry->size = -1;
+			}
+			if (json_object_object_get_ex(j_entry, "digest", &digest))
+				entry->digest = strdup(json_object_get_string(digest));
+			g_hash_table_insert(manifest->files, strdup(key), entry);
+		}
+	} else if (files && json_object_get_type(files) == json_type_array) {
+		// Older manifests only listed the files, a size that never matches has them compared by contents
+		uint len = json_object_array_length(files);
+		for (uint i = 0; i < len; i++) {
+			__PWML_CaptureEntry* entry = calloc(1, sizeof(__PWML_CaptureEntry));
+			entry->size = -1;
+			g_hash_table_insert(manifest->files, strdup(json_object_get_string(json_object_array_get_idx(files, i))), entry);
+		}
+	}
+
+	json_object_put(root);
+}
+
+// Always rewritten, its mtime is what the next refresh compares the game files with
+static void __pwml_vanilla_save_manifest(PWML* pwml, _File_Utils_Context* context, __PWML_CaptureManifest* manifest) {
+	const char* cache_folder = g_build_filename(pwml->working_directory, PWML_CACHE_FOLDER, NULL);
+	if (g_mkdir_with_parents(cache_folder, 0755) == -1) {
+		g_printerr("Failed to create cache folder %s\n", cache_folder);
+		free((char*)cache_folder);
+		return;
+	}
+	free((char*)cache_folder);
+
+	json_object* root = json_object_new_object();
+	json_object* files = json_object_new_object();
+
+	GHashTableIter iter;
+	g_hash_table_iter_init(&iter, manifest->files);
+
+	const char* file;
+	__PWML_CaptureEntry* entry;
+	while (g_hash_table_iter_next(&iter, (void**)&file, (void**)&entry)) {
+		json_object* j_entry = json_object_new_object();
+		json_object_object_add(j_entry, "size", json_object_new_int64(entry->size));
+		json_object_object_add(j_entry, "mtime", json_object_new_int64(entry->mtime));
+		if (entry->digest)
+			json_object_object_add(j_entry, "digest", json_object_new_string(entry->digest));
+		json_object_object_add(files, file, j_entry);
+	}
+	json_object_object_add(root, "files", files);
+
+	const char* json_path = __pwml_vanilla_get_manifest_path(pwml);
+	GError* error = NULL;
+	_file_utils_set_contents(context, json_path, json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN), -1, &error);
+	if (error) {
+		g_printerr("Failed to write %s\nGError: %s\n", json_path, error->message);
+		g_error_free(error);
+	}
+
+	json_object_put(root);
+	free((char*)json_path);
+}
+
+static void __pwml_vanilla_write_weapon_json(_File_Utils_Context* context, const char* weapon_path, const _PWML_Weapon* weapon) {
+	const char* weapon_json_path = g_build_filename(weapon_path, PWML_WEAPON_JSON, NULL);
+
+	json_object* root = json_object_new_object();
+
+	json_object *ship = json_object_new_boolean(weapon->ship);
+	json_object_object_add(root, "ship", ship);
+
+	json_object *pilot = json_object_new_boolean(weapon->pilot);
+	json_object_object_add(root, "pilot", pilot);
+
+	const char* json_str = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
+
+	bool written;
+	_file_utils_write_if_changed(context, weapon_json_path, json_str, strlen(json_str), &written);
+
+	json_object_put(root);
+	free((char*)weapon_json_path);
+}
+
+// The weapons of Weapons.dat that still have has_built_in_files set
+static void __pwml_vanilla_write_builtin_weapons(_File_Utils_Context* context, const char* vanilla_mod_weapons, GHashTable* weapons) {
+	json_object* root = json_object_new_object();
+	json_object* j_weapons = json_object_new_array();
+
+	GHashTableIter iter;
+	g_hash_table_iter_init(&iter, weapons);
+
+	_PWML_Weapon* weapon;
+	while (g_hash_table_iter_next(&iter, NULL, (void**)&weapon)) {
+		if (weapon->has_built_in_files) {
+			json_object* j_weapon = json_object_new_object();
+
+			json_object* name = json_object_new_string(weapon->name);
+			json_object_object_add(j_weapon, "name", name);
+			json_object* ship = json_object_new_boolean(weapon->ship);
+			json_object_object_add(j_weapon, "ship", ship);
+			json_object* pilot = json_object_new_boolean(weapon->pilot);
+			json_object_object_add(j_weapon, "pilot", pilot);
+
+			json_object_array_add(j_weapons, j_weapon);
+		}
+	}
+
+	json_object_object_add(root, "weapons", j_weapons);
+
+	const char* built_in_weapons_json_path = g_build_filename(vanilla_mod_weapons, PWML_BUILTIN_WEAPONS_JSON, NULL);
+	const char* json_str = json_object_to_json_string(root);
+
+	bool written;
+	_file_utils_write_if_changed(context, built_in_weapons_json_path, json_str, strlen(json_str), &written);
+
+	json_object_put(root);
+	free((char*)built_in_weapons_json_path);
+}
+
+static bool __pwml_vanilla_capture_weapons(PWML* pwml, _File_Utils_Context* context, GPtrArray* jobs) {
+	GHashTable* weapons = _pwml_parse_weapons_dat(pwml, PWML_WEAPONS_FOLDER);
+	if (!weapons) {
+		g_printerr("Failed to retrieve vanilla weapons\n");
+		return false;
+	}
+
+	const char* vanilla_mod_data = __pwml_vanilla_get_data_folder(pwml);
+	const char* vanilla_mod_weapons = g_build_filename(vanilla_mod_data, PWML_WEAPONS_FOLDER, NULL);
+
+	if (g_mkdir_with_parents(vanilla_mod_weapons, 0755) == -1) {
+		g_print("Failed to make vanilla weapons directory\n");
+		return false;
+	};
+
+	GPtrArray* files = _file_utils_list_files_in_directory(pwml->weapons_path);
+	for (uint i = 0; i < files->len; i++) {
+		const char* path = g_ptr_array_index(files, i);
+		if (_file_utils_is_dir(path)) {
+			_PWML_Weapon* weapon;
+			const char* name = g_path_get_basename(path);
+			if (g_hash_table_contains(weapons, name)) {
+				weapon = g_hash_table_lookup(weapons, name);
+				weapon->has_built_in_files = false;
+			} else {
+				weapon = malloc(sizeof(_PWML_Weapon));
+				weapon->name = g_strdup(name);
+				weapon->pilot = false;
+				weapon->ship = false;
+				weapon->has_built_in_files = false;
+				g_hash_table_insert(weapons, g_strdup(name), weapon);
+			}
+
+			_file_utils_collect_copy_jobs(path, vanilla_mod_weapons, NULL, jobs);
+			// The copies create the folder later, its weapon.json is written now
+			const char* weapon_path = g_build_filename(vanilla_mod_weapons, name, NULL);
+			g_mkdir_with_parents(weapon_path, 0755);
+			__pwml_vanilla_write_weapon_json(context, weapon_path, weapon);
+
+			free((char*)name);
+			free((char*)weapon_path);
+		}
+	}
+
+	__pwml_vanilla_write_builtin_weapons(context, vanilla_mod_weapons, weapons);
+
+	free((char*)vanilla_mod_data);
+	free((char*)vanilla_mod_weapons);
+	g_hash_table_destroy(weapons);
+	g_ptr_array_free(files, true);
+
+	return true;
+}
+
+static bool __pwml_vanilla_capture_resource(PWML* pwml, PWML_ResourceType type, GPtrArray* jobs) {
+	const _PWML_ResourceHandler* handler = _pwml_resource_get_handler(type);
+	const char* vanilla_mod_data = __pwml_vanilla_get_data_folder(pwml);
+	const char* vanilla_mod_folder_path = g_build_filename(vanilla_mod_data, *handler->folder, NULL);
+
+	if (g_mkdir_with_parents(vanilla_mod_folder_path, 0755) == -1) {
+		g_printerr("Failed to clone %s\n", *handler->folder);
+		free((char*)vanilla_mod_data);
+		free((char*)vanilla_mod_folder_path);
+		return false;
+	}
+
+	const char* game_folder_path = _pwml_resource_get_path(pwml, type);
+	_File_Utils_Filter* filter = NULL;
+	if (handler->clone_ignore) {
+		filter = _file_utils_filter_new(game_folder_path);
+		const char* rule = g_strconcat("/", handler->clone_ignore, NULL);
+		_file_utils_filter_add_rule(filter, rule);
+		free((char*)rule);
+	}
+	_file_utils_collect_all(game_folder_path, vanilla_mod_folder_path, filter, jobs);
+	_file_utils_filter_free(filter);
+
+	free((char*)vanilla_mod_data);
+	free((char*)vanilla_mod_folder_path);
+
+	return true;
+}
+
+static void __pwml_vanilla_copy(PWML* pwml, _File_Utils_Context* context, GPtrArray* jobs) {
+	for (uint i = 0; i < jobs->len; i++) {
+		((_File_Utils_CopyJob*)g_ptr_array_index(jobs, i))->method = _pwml_resource_get_capture_method(pwml->capture_mode);
+	}
+	_file_utils_copy_jobs(context, jobs);
+}
+
+void _pwml_vanilla_capture(PWML* pwml) {
+	const char* vanilla_mod_path = g_build_filename(pwml->mods_path, "vanilla", NULL);
+	_File_Utils_Context context = { .order = pwml->copy_order, .durability = pwml->durability };
+
+	if (g_mkdir_with_parents(vanilla_mod_path, 0755) == -1) {
+		g_printerr("Failed to make vanilla mod folder at %s\n", vanilla_mod_path);
+		return;
+	}
+
+	json_object* root = json_object_new_object();
+
+	json_object* name = json_object_new_string("Vanilla");
+	json_object_object_add(root, "name", name);
+
+	json_object* description = json_object_new_string("Base Wings 2 by Miika Virpioja et al.");
+	json_object_object_add(root, "short_description", description);
+
+	const char* metadata_path = g_build_filename(vanilla_mod_path, PWML_METADATA_JSON, NULL);
+
+	const char* json_str = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
+
+	GError* error = NULL;
+	_file_utils_set_contents(&context, metadata_path, json_str, -1, &error);
+	if (error) {
+		g_printerr("Failed to write vanilla mod metadata json at %s\nGError: %s\n", metadata_path, error->message);
+		g_free(error);
+	}
+
+	json_object_put(root);
+	free((char*)metadata_path);
+
+	// Everything is copied in one batch at the end, so it can be read in disk order
+	GPtrArray* jobs = g_ptr_array_new_with_free_func(_file_utils_copy_job_free);
+
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		const _PWML_ResourceHandler* handler = _pwml_resource_get_handler(type);
+		bool cloned = handler->custom_deploy
+			? __pwml_vanilla_capture_weapons(pwml, &context, jobs)
+			: __pwml_vanilla_capture_resource(pwml, type, jobs);
+		if (!cloned) {
+			g_printerr("Vanilla %s cloning failed\n", *handler->folder);
+			goto copy;
+		}
+	}
+
+copy:;
+	// Recorded before a move takes the files away. The digests are left for the first refresh that needs them.
+	__PWML_CaptureManifest manifest = { .files = g_hash_table_new_full(g_str_hash, g_str_equal, free, __pwml_vanilla_entry_free) };
+	for (uint i = 0; i < jobs->len; i++) {
+		_File_Utils_CopyJob* job = g_ptr_array_index(jobs, i);
+		if (job->folder)
+			continue;
+		const char* source = job->source;
+		struct stat stat_buf;
+		if (lstat(source, &stat_buf) == 0)
+			__pwml_vanilla_record(&manifest, __pwml_vanilla_relative(pwml, source), &stat_buf, NULL);
+	}
+
+	__pwml_vanilla_copy(pwml, &context, jobs);
+	g_ptr_array_free(jobs, true);
+	__pwml_vanilla_save_manifest(pwml, &context, &manifest);
+	g_hash_table_destroy(manifest.files);
+
+	free((char*)vanilla_mod_path);
+}
+
+// The last time PWML finished writing the game folders, 0 if it never did. Only decides for the generated files.
+static gint64 __pwml_vanilla_get_reference(PWML* pwml, __PWML_CaptureManifest* manifest) {
+	gint64 reference = manifest->mtime;
+	struct stat stat_buf;
+
+	const char* deploy_path = g_build_filename(pwml->working_directory, PWML_CACHE_FOLDER, PWML_DEPLOY_MANIFEST_JSON, NULL);
+	if (stat(deploy_path, &stat_buf) == 0)
+		reference = MAX(reference, __pwml_vanilla_mtime(&stat_buf));
+	free((char*)deploy_path);
+
+	// Captured before there was a capture manifest and never applied since, active_mods.json is written right after the capture
+	if (reference == 0) {
+		const char* active_mods_path = g_build_filename(pwml->working_directory, PWML_ACTIVE_MODS_JSON, NULL);
+		if (stat(active_mods_path, &stat_buf) == 0)
+			reference = __pwml_vanilla_mtime(&stat_buf);
+		free((char*)active_mods_path);
+	}
+
+	return reference;
+}
+
+// Whether the game file at path differs from what was captured of it. Matching the entry's size and mtime settles
+// it, otherwise the contents are hashed, so a touch or a chmod isn't taken for a change. Without a digest in the
+// entry the vanilla mod's copy at vanilla_path is what was captured. The entry is brought up to date either way.
+static bool __pwml_vanilla_file_changed(__PWML_RefreshState* state, const char* relative, const char* path, const char* vanilla_path, const struct stat* stat_buf) {
+	__PWML_CaptureEntry* entry = g_hash_table_lookup(state->manifest->files, relative);
+	if (entry && entry->size == stat_buf->st_size && entry->mtime == __pwml_vanilla_mtime(stat_buf))
+		return false;
+
+	char* digest = _pwml_hash_file(path);
+	if (!digest) {
+		g_printerr("Failed to read %s\n", path);
+		return false;
+	}
+
+	// Compared before the entry is replaced, which frees its digest
+	char* captured = NULL;
+	const char* reference = entry && _pwml_hash_is_current(entry->digest) ? entry->digest : NULL;
+	if (!reference)
+		reference = captured = _pwml_hash_file(vanilla_path);
+	bool changed = !reference || strcmp(digest, reference) != 0;
+	free(captured);
+
+	__pwml_vanilla_record(state->manifest, relative, stat_buf, digest);
+	return changed;
+}
+
+// generated is the resource's generated file, only looked for at the top of the folder like ignore
+static void __pwml_vanilla_refresh_folder(__PWML_RefreshState* state, const char* game_path, const char* vanilla_path, const char* ignore, const char* generated, bool folders_only) {
+	GDir* dir = g_dir_open(game_path, 0, NULL);
+	if (!dir)
+		return;
+
+	const char* name;
+	while ((name = g_dir_read_name(dir))) {
+		if (ignore && g_str_equal(name, ignore))
+			continue;
+
+		char* path = g_build_filename(game_path, name, NULL);
+		char* destination = g_build_filename(vanilla_path, name, NULL);
+		struct stat stat_buf;
+		if (lstat(path, &stat_buf) == 0) {
+			if (S_ISDIR(stat_buf.st_mode)) {
+				__pwml_vanilla_refresh_folder(state, path, destination, NULL, NULL, false);
+			} else if (!folders_only) {
+				const char* relative = __pwml_vanilla_relative(state->pwml, path);
+				g_hash_table_add(state->seen, strdup(relative));
+
+				// What another mod deployed over the game's file is that mod's, whatever its times say
+				const char* source = _pwml_deploy_get_source(state->pwml, relative);
+				bool changed;
+				if (source && !g_str_equal(source, destination)) {
+					changed = false;
+				} else if (generated && g_str_equal(name, generated)) {
+					changed = __pwml_vanilla_ctime(&stat_buf) > state->reference;
+					if (changed)
+						__pwml_vanilla_record(state->manifest, relative, &stat_buf, NULL);
+				} else {
+					changed = __pwml_vanilla_file_changed(state, relative, path, destination, &stat_buf);
+				}
+
+				if (changed) {
+					g_mkdir_with_parents(vanilla_path, 0755);
+					_file_utils_add_copy_job(state->jobs, path, destination);
+					state->result->captured++;
+				}
+			}
+		}
+
+		free(path);
+		free(destination);
+	}
+
+	g_dir_close(dir);
+}
+
+static void __pwml_vanilla_refresh_removed(__PWML_RefreshState* state, const char* vanilla_mod_data) {
+	GHashTableIter iter;
+	g_hash_table_iter_init(&iter, state->manifest->files);
+
+	const char* relative;
+	while (g_hash_table_iter_next(&iter, (void**)&relative, NULL)) {
+		if (g_hash_table_contains(state->seen, relative))
+			continue;
+
+		// Anything else missing may just never have been deployed
+		char* vanilla_path = g_build_filename(vanilla_mod_data, relative, NULL);
+		const char* source = _pwml_deploy_get_source(state->pwml, relative);
+		if (source && g_str_equal(source, vanilla_path)) {
+			remove(vanilla_path);
+			g_hash_table_iter_remove(&iter);
+			state->result->removed++;
+		}
+		free(vanilla_path);
+	}
+}
+
+// Every vanilla weapon folder needs a weapon.json, and all of them along with builtin_weapons.json follow a new Weapons.dat
+static void __pwml_vanilla_refresh_weapons(__PWML_RefreshState* state, _File_Utils_Context* context, const char* vanilla_mod_data) {
+	PWML* pwml = state->pwml;
+	const char* weapons_dat_path = g_build_filename(pwml->weapons_path, PWML_WEAPONS_DAT, NULL);
+	struct stat stat_buf;
+	bool changed = lstat(weapons_dat_path, &stat_buf) == 0 && __pwml_vanilla_ctime(&stat_buf) > state->reference;
+	free((char*)weapons_dat_path);
+
+	GHashTable* weapons = changed ? _pwml_parse_weapons_dat(pwml, PWML_WEAPONS_FOLDER) : NULL;
+	const char* vanilla_mod_weapons = g_build_filename(vanilla_mod_data, PWML_WEAPONS_FOLDER, NULL);
+
+	GPtrArray* files = _file_utils_list_files_in_directory(vanilla_mod_weapons);
+	if (!files) {
+		if (weapons)
+			g_hash_table_destroy(weapons);
+		free((char*)vanilla_mod_weapons);
+		return;
+	}
+
+	for (uint i = 0; i < files->len; i++) {
+		const char* path = g_ptr_array_index(files, i);
+		if (!_file_utils_is_dir(path))
+			continue;
+
+		const char* name = g_path_get_basename(path);
+		const char* weapon_json_path = g_build_filename(path, PWML_WEAPON_JSON, NULL);
+		_PWML_Weapon* weapon = weapons ? g_hash_table_lookup(weapons, name) : NULL;
+		if (weapon)
+			weapon->has_built_in_files = false;
+
+		if (weapons || !g_file_test(weapon_json_path, G_FILE_TEST_EXISTS)) {
+			_PWML_Weapon unknown = { .name = name };
+			__pwml_vanilla_write_weapon_json(context, path, weapon ? weapon : &unknown);
+		}
+
+		free((char*)name);
+		free((char*)weapon_json_path);
+	}
+
+	if (weapons) {
+		__pwml_vanilla_write_builtin_weapons(context, vanilla_mod_weapons, weapons);
+		g_hash_table_destroy(weapons);
+		state->result->weapons_refreshed = true;
+	}
+
+	free((char*)vanilla_mod_weapons);
+	g_ptr_array_free(files, true);
+}
+
+bool pwml_refresh_vanilla(PWML* pwml, PWML_RefreshResult* result) {
+	memset(result, 0, sizeof(PWML_RefreshResult));
+
+	// An apply writes the game folders the refresh is reading
+	g_mutex_lock(&pwml->apply_mutex);
+	const char* vanilla_mod_data = __pwml_vanilla_get_data_folder(pwml);
+	if (!g_file_test(vanilla_mod_data, G_FILE_TEST_IS_DIR)) {
+		g_printerr("Couldn't refresh the vanilla mod; %s doesn't exist.\n", vanilla_mod_data);
+		free((char*)vanilla_mod_data);
+		g_mutex_unlock(&pwml->apply_mutex);
+		return false;
+	}
+
+	gint64 trace_start = _pwml_trace_begin();
+	_File_Utils_Context context = { .order = pwml->copy_order, .durability = pwml->durability };
+	__PWML_CaptureManifest manifest;
+	__pwml_vanilla_load_manifest(pwml, &manifest);
+
+	__PWML_RefreshState state = {
+		.pwml = pwml,
+		.reference = __pwml_vanilla_get_reference(pwml, &manifest),
+		.manifest = &manifest,
+		.seen = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL),
+		.jobs = g_ptr_array_new_with_free_func(_file_utils_copy_job_free),
+		.result = result,
+	};
+
+	for (uint type = 0; type < PWML_RESOURCE_COUNT; type++) {
+		const _PWML_ResourceHandler* handler = _pwml_resource_get_handler(type);
+		const char* vanilla_path = g_build_filename(vanilla_mod_data, *handler->folder, NULL);
+		// Like the capture, only the weapons' folders and not Weapons.dat next to them
+		const char* generated_file = handler->generated_file ? *handler->generated_file : NULL;
+		__pwml_vanilla_refresh_folder(&state, _pwml_resource_get_path(pwml, type), vanilla_path, handler->clone_ignore, generated_file, handler->custom_deploy);
+		free((char*)vanilla_path);
+	}
+
+	__pwml_vanilla_refresh_removed(&state, vanilla_mod_data);
+	__pwml_vanilla_copy(pwml, &context, state.jobs);
+	__pwml_vanilla_refresh_weapons(&state, &context, vanilla_mod_data);
+	__pwml_vanilla_save_manifest(pwml, &context, &manifest);
+	_file_utils_sync_filesystem(&context, pwml->working_directory);
+
+	g_ptr_array_free(state.jobs, true);
+	g_hash_table_destroy(state.seen);
+	g_hash_table_destroy(manifest.files);
+	free((char*)vanilla_mod_data);
+	_pwml_trace_end("vanilla", "pwml_refresh_vanilla", NULL, trace_start);
+	g_mutex_unlock(&pwml->apply_mutex);
+	return true;
+}
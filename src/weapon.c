@@ -1,8 +1,16 @@
 #include "PWML/weapon.h"
 #include <stdlib.h>
+#include <string.h>
 
 void _pwml_weapon_free(void* voidptr_weapon) {
 	_PWML_Weapon* weapon = (_PWML_Weapon*)voidptr_weapon;
 	free((char*)weapon->name);
 	free(weapon);
 }
+
+_PWML_Weapon* _pwml_weapon_copy(const _PWML_Weapon* weapon) {
+	_PWML_Weapon* copy = malloc(sizeof(_PWML_Weapon));
+	*copy = *weapon;
+	copy->name = strdup(weapon->name);
+	return copy;
+}
@@ -1,75 +1,267 @@
 #include "PWML/xml_utils.h"
 #include "PWML/file_utils.h"
+#include "PWML/trace.h"
 #include "libxml/xmlstring.h"
 #include <glib.h>
 #include <libxml/parser.h>
+#include <libxml/tree.h>
 #include <libxml/xmlerror.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
-bool _xml_utils_combine_files(const char* path_a, const char* path_b, const char* destination_path) {
-	xmlDoc* doc_a = xmlReadFile(path_a, NULL, 0);
-	if (!doc_a) {
+// Bumped whenever the way fragments are written out changes
+#define FRAGMENT_CACHE_VERSION 1
+#define WRITE_BUFFER_SIZE (64 * 1024)
+// Stands in for the root's children while the rest of the document is written out
+#define FRAGMENT_MARKER "PWML_FRAGMENT"
+
+static void __xml_utils_fragment_free(void* voidptr_fragment) {
+	_XML_Utils_Fragment* fragment = (_XML_Utils_Fragment*)voidptr_fragment;
+	free(fragment->head);
+	free(fragment->body);
+	free(fragment->tail);
+	free(fragment);
+}
+
+static _XML_Utils_Fragment* __xml_utils_fragment_parse(const char* path) {
+	xmlDoc* doc = xmlReadFile(path, NULL, 0);
+	if (!doc) {
 		const xmlError* error = xmlGetLastError();
-		g_printerr("Failed to read xml file %s\nError: %s\n", path_a, error->message);
-		return false;
+		g_printerr("Failed to read xml file %s\nError: %s\n", path, error ? error->message : "unknown");
+		return NULL;
 	}
 
-	xmlDoc* doc_b = xmlReadFile(path_b, NULL, 0);
-	if (!doc_b) {
-		const xmlError* error = xmlGetLastError();
-		g_printerr("Failed to read xml file %s\nError: %s\n", path_b, error->message);
-		xmlFreeDoc(doc_a);
-		return false;
+	xmlNode* root = xmlDocGetRootElement(doc);
+	if (!root) {
+		g_printerr("Failed to read xml file %s\nError: no root element\n", path);
+		xmlFreeDoc(doc);
+		return NULL;
 	}
 
-	xmlNode* root_a = xmlDocGetRootElement(doc_a);
-	xmlNode* root_b = xmlDocGetRootElement(doc_b);
+	// Written out the way saving the whole document would write them
+	xmlBuffer* buffer = xmlBufferCreate();
+	for (xmlNode* cur = root->children; cur; cur = cur->next) {
+		xmlNodeDump(buffer, doc, cur, 1, 1);
+	}
 
-	xmlDoc* new_doc = xmlNewDoc(BAD_CAST "1.0");
-	xmlNode* new_root = xmlNewNode(NULL, root_a->name);
-	xmlDocSetRootElement(new_doc, new_root);
+	_XML_Utils_Fragment* fragment = malloc(sizeof(_XML_Utils_Fragment));
+	fragment->body = strdup((const char*)xmlBufferContent(buffer));
+	xmlBufferFree(buffer);
 
-	for (xmlAttr* attr = root_a->properties; attr; attr = attr->next) {
-		xmlChar* value = xmlGetProp(root_a, attr->name);
-		if (value) {
-			xmlSetProp(new_root, attr->name, value);
-			xmlFree(value);
-		}
+	while (root->children) {
+		xmlNode* child = root->children;
+		xmlUnlinkNode(child);
+		xmlFreeNode(child);
 	}
+	xmlAddChild(root, xmlNewDocComment(doc, BAD_CAST FRAGMENT_MARKER));
+
+	xmlChar* dump;
+	int size;
+	xmlDocDumpMemoryEnc(doc, &dump, &size, "UTF-8");
+	xmlFreeDoc(doc);
 
-	if (root_a->ns) {
-		xmlNewNs(new_root, root_a->ns->href, root_a->ns->prefix);
+	const char* marker = dump ? strstr((const char*)dump, "<!--" FRAGMENT_MARKER "-->") : NULL;
+	if (!marker) {
+		g_printerr("Failed to write out xml file %s\n", path);
+		xmlFree(dump);
+		free(fragment->body);
+		free(fragment);
+		return NULL;
 	}
 
-	for (xmlNode* cur = root_a->children; cur; cur = cur->next) {
-		xmlNode* copy = xmlDocCopyNode(cur, new_doc, 1);
-		xmlAddChild(new_root, copy);
+	fragment->head = g_strndup((const char*)dump, marker - (const char*)dump);
+	fragment->tail = strdup(marker + strlen("<!--" FRAGMENT_MARKER "-->"));
+	xmlFree(dump);
+	return fragment;
+}
+
+static char* __xml_utils_fragment_cache_path(_XML_Utils_Merger* merger, const char* path) {
+	char* name = g_compute_checksum_for_string(G_CHECKSUM_SHA1, path, -1);
+	char* cache_path = g_build_filename(merger->cache_folder, name, NULL);
+	g_free(name);
+	return cache_path;
+}
+
+// The header line says which version of the input the fragment was made from
+static char* __xml_utils_fragment_header(const struct stat* stat_buf) {
+	gint64 mtime = (gint64)stat_buf->st_mtim.tv_sec * 1000000000 + stat_buf->st_mtim.tv_nsec;
+	return g_strdup_printf("%d %" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n", FRAGMENT_CACHE_VERSION, (gint64)stat_buf->st_size, mtime);
+}
+
+// NULL if there's no fragment for this version of the input
+static _XML_Utils_Fragment* __xml_utils_fragment_load(const char* cache_path, const char* header) {
+	char* contents;
+	gsize length;
+	if (!g_file_get_contents(cache_path, &contents, &length, NULL))
+		return NULL;
+
+	// header, then the head, body and tail lengths, then the three of them
+	size_t header_length = strlen(header);
+	gint64 head_length, body_length;
+	char* lengths = contents + header_length;
+	char* parts = length > header_length && strncmp(contents, header, header_length) == 0 ? strchr(lengths, '\n') : NULL;
+	if (!parts || sscanf(lengths, "%" G_GINT64_FORMAT " %" G_GINT64_FORMAT, &head_length, &body_length) != 2
+		|| head_length < 0 || body_length < 0 || head_length + body_length > (gint64)(contents + length - parts - 1)) {
+		free(contents);
+		return NULL;
 	}
+	parts++;
 
-	for (xmlNode* cur = root_b->children; cur; cur = cur->next) {
-		xmlNode* copy = xmlDocCopyNode(cur, new_doc, 1);
-		xmlAddChild(new_root, copy);
+	_XML_Utils_Fragment* fragment = malloc(sizeof(_XML_Utils_Fragment));
+	fragment->head = g_strndup(parts, head_length);
+	fragment->body = g_strndup(parts + head_length, body_length);
+	fragment->tail = g_strndup(parts + head_length + body_length, contents + length - parts - head_length - body_length);
+	free(contents);
+	return fragment;
+}
+
+static void __xml_utils_fragment_store(_XML_Utils_Merger* merger, const char* cache_path, const char* header, _XML_Utils_Fragment* fragment) {
+	size_t head_length = strlen(fragment->head);
+	size_t body_length = strlen(fragment->body);
+	GString* contents = g_string_new(header);
+	g_string_append_printf(contents, "%" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n", (gint64)head_length, (gint64)body_length);
+	g_string_append(contents, fragment->head);
+	g_string_append(contents, fragment->body);
+	g_string_append(contents, fragment->tail);
+
+	// Only a cache, a failed write just means parsing again next time
+	_file_utils_set_contents(&merger->context, cache_path, contents->str, contents->len, NULL);
+	g_string_free(contents, true);
+}
+
+static _XML_Utils_Fragment* __xml_utils_fragment_get(_XML_Utils_Merger* merger, const char* path) {
+	struct stat stat_buf;
+	if (!merger->cache_folder || stat(path, &stat_buf) != 0)
+		return __xml_utils_fragment_parse(path);
+
+	char* cache_path = __xml_utils_fragment_cache_path(merger, path);
+	char* header = __xml_utils_fragment_header(&stat_buf);
+	_XML_Utils_Fragment* fragment = __xml_utils_fragment_load(cache_path, header);
+	if (!fragment) {
+		fragment = __xml_utils_fragment_parse(path);
+		if (fragment)
+			__xml_utils_fragment_store(merger, cache_path, header, fragment);
 	}
 
-	xmlSaveFormatFileEnc(destination_path, new_doc, "UTF-8", 1);
+	free(header);
+	free(cache_path);
+	return fragment;
+}
+
+_XML_Utils_Merger* _xml_utils_merger_new(const _File_Utils_Context* context, const char* cache_folder) {
+	_XML_Utils_Merger* merger = calloc(1, sizeof(_XML_Utils_Merger));
+	if (context)
+		merger->context = *context;
+	merger->context.counters = NULL;
+	merger->fragments = g_ptr_array_new_with_free_func(__xml_utils_fragment_free);
+	if (cache_folder && g_mkdir_with_parents(cache_folder, 0755) == 0)
+		merger->cache_folder = strdup(cache_folder);
+	return merger;
+}
 
-	xmlFreeDoc(doc_a);
-	xmlFreeDoc(doc_b);
-	xmlFreeDoc(new_doc);
-	xmlCleanupParser();
+bool _xml_utils_merger_add(_XML_Utils_Merger* merger, const char* path) {
+	if (merger->failed)
+		return false;
 
+	gint64 trace_start = _pwml_trace_begin();
+	_XML_Utils_Fragment* fragment = __xml_utils_fragment_get(merger, path);
+	if (!fragment) {
+		merger->failed = true;
+		return false;
+	}
+
+	if (!merger->first_path)
+		merger->first_path = strdup(path);
+	g_ptr_array_add(merger->fragments, fragment);
+
+	_pwml_trace_end("merge", "merge_xml_input", path, trace_start);
 	return true;
 }
 
-bool _xml_utils_combine_all_files(GPtrArray* files, const char* destination_path) {
-	for (uint i = 0; i < files->len; i++) {
-		const char* path = g_ptr_array_index(files, i);
-		if (g_file_test(destination_path, G_FILE_TEST_EXISTS)) {
-			if (!_xml_utils_combine_files(destination_path, path, destination_path))
-				return false;
-		} else {
-			_file_utils_copy_file_with_path(path, destination_path);
+bool _xml_utils_merger_save(_XML_Utils_Merger* merger, const char* destination_path) {
+	if (merger->failed || merger->fragments->len == 0)
+		return false;
+
+	if (merger->fragments->len == 1)
+		return _file_utils_copy_file_with_path(merger->first_path, destination_path);
+
+	FILE* destination = fopen(destination_path, "w");
+	if (!destination) {
+		g_printerr("Failed to open %s for writing\n", destination_path);
+		return false;
+	}
+	setvbuf(destination, NULL, _IOFBF, WRITE_BUFFER_SIZE);
+
+	// Everything goes under the first input's root
+	_XML_Utils_Fragment* first = g_ptr_array_index(merger->fragments, 0);
+	fputs(first->head, destination);
+	for (uint i = 0; i < merger->fragments->len; i++) {
+		fputs(((_XML_Utils_Fragment*)g_ptr_array_index(merger->fragments, i))->body, destination);
+	}
+	fputs(first->tail, destination);
+
+	bool success = !ferror(destination);
+	if (fclose(destination) != 0)
+		success = false;
+	if (!success)
+		g_printerr("Failed to write %s\n", destination_path);
+	return success;
+}
+
+void _xml_utils_merger_free(_XML_Utils_Merger* merger) {
+	g_ptr_array_free(merger->fragments, true);
+	free(merger->first_path);
+	free(merger->cache_folder);
+	free(merger);
+}
+
+static void __xml_utils_add_reference(const xmlChar* value, const char* base_folder, GHashTable* seen, GPtrArray* references) {
+	if (!value)
+		return;
+
+	char* stripped = g_strstrip(strdup((const char*)value));
+	// Only things that look like a file name are worth a stat
+	if (*stripped == '\0' || !strchr(stripped, '.') || strchr(stripped, '\n')) {
+		free(stripped);
+		return;
+	}
+
+	char* path = g_build_filename(base_folder, stripped, NULL);
+	free(stripped);
+	if (!g_hash_table_contains(seen, path) && g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+		g_hash_table_add(seen, path);
+		g_ptr_array_add(references, strdup(path));
+	} else {
+		free(path);
+	}
+}
+
+static void __xml_utils_collect_node_references(xmlNode* node, const char* base_folder, GHashTable* seen, GPtrArray* references) {
+	for (xmlNode* cur = node; cur; cur = cur->next) {
+		if (cur->type == XML_ELEMENT_NODE) {
+			for (xmlAttr* attr = cur->properties; attr; attr = attr->next) {
+				xmlChar* value = xmlNodeGetContent((xmlNode*)attr);
+				__xml_utils_add_reference(value, base_folder, seen, references);
+				xmlFree(value);
+			}
+			__xml_utils_collect_node_references(cur->children, base_folder, seen, references);
+		} else if (cur->type == XML_TEXT_NODE) {
+			__xml_utils_add_reference(cur->content, base_folder, seen, references);
 		}
 	}
+}
 
-	return true;
+GPtrArray* _xml_utils_collect_file_references(const char* xml_path, const char* base_folder) {
+	GPtrArray* references = g_ptr_array_new_with_free_func(free);
+	xmlDoc* doc = xmlReadFile(xml_path, NULL, XML_PARSE_NOWARNING | XML_PARSE_NOERROR);
+	if (!doc)
+		return references;
+
+	GHashTable* seen = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+	__xml_utils_collect_node_references(xmlDocGetRootElement(doc), base_folder, seen, references);
+	g_hash_table_destroy(seen);
+	xmlFreeDoc(doc);
+	return references;
 }